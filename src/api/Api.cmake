@@ -9,6 +9,7 @@ add_library(${NEBULA_API} STATIC
     ${NEBULA_SRC}/api/dsl/Serde.cpp
     ${NEBULA_SRC}/api/udf/Avg.cpp
     ${NEBULA_SRC}/api/udf/Like.cpp
+    ${NEBULA_SRC}/api/udf/Pct.cpp
     ${NEBULA_SRC}/api/udf/Sum.cpp)
 target_link_libraries(${NEBULA_API}
     PUBLIC ${NEBULA_TYPE}
@@ -234,8 +234,11 @@ std::unique_ptr<ExecutionPlan> Query::compile(QueryContext& qc) noexcept {
 
   // check the index are correct values and convert 1-based sort keys into 0-based keys for internal usage
   std::vector<size_t> zbSorts;
+  std::vector<bool> descs;
   zbSorts.reserve(sorts_.size());
-  for (size_t index : sorts_) {
+  descs.reserve(sorts_.size());
+  for (size_t i = 0, size = sorts_.size(); i < size; ++i) {
+    auto index = sorts_.at(i);
     auto zbIndex = index - 1;
     if (index == 0 || index > numOutputFields) {
       LOG(ERROR) << "sort by column is out of range: " << index;
@@ -243,6 +246,8 @@ std::unique_ptr<ExecutionPlan> Query::compile(QueryContext& qc) noexcept {
     }
 
     zbSorts.push_back(zbIndex);
+    const auto type = i < sortTypes_.size() ? sortTypes_.at(i) : sortType_;
+    descs.push_back(type == SortType::DESC);
   }
 
   // build block level compute phase
@@ -280,7 +285,7 @@ std::unique_ptr<ExecutionPlan> Query::compile(QueryContext& qc) noexcept {
     .keys(std::move(zbKeys))
     .compute(std::move(fields))
     .aggregate(numAggColumns, std::move(aggColumns))
-    .sort(std::move(zbSorts), sortType_ == SortType::DESC)
+    .sort(std::move(zbSorts), std::move(descs))
     .limit(limit_);
 
   // partial aggrgation, keys and agg methods
@@ -104,6 +104,11 @@ static UDFExpression<nebula::surface::eval::UDFType::PCT, double> pct(const T& e
   return UDFExpression<nebula::surface::eval::UDFType::PCT, double>(std::shared_ptr<Expression>(new T(expr)), std::move(percentile));
 }
 
+template <typename T>
+static UDFExpression<nebula::surface::eval::UDFType::CARDINALITY> cardinality(const T& expr) {
+  return UDFExpression<nebula::surface::eval::UDFType::CARDINALITY>(std::shared_ptr<Expression>(new T(expr)));
+}
+
 template <typename T>
 static LikeExpression like(const T& expr, const std::string& pattern, bool caseSensitive = true) {
   // TODO(cao) - model UDAF/UDF with existing expression
@@ -56,6 +56,7 @@ public:
                     groups_{ std::move(q.groups_) },
                     sorts_{ std::move(q.sorts_) },
                     sortType_{ q.sortType_ },
+                    sortTypes_{ std::move(q.sortTypes_) },
                     limit_{ q.limit_ } {}
 
   Query(const Query&) = delete;
@@ -93,6 +94,16 @@ public:
   Query& sortby(std::vector<size_t> sorts, SortType type = SortType::ASC) {
     sorts_ = sorts;
     sortType_ = type;
+    sortTypes_ = std::vector<SortType>(sorts_.size(), type);
+    return *this;
+  }
+
+  // sort by a list of columns, each column has its own sort type
+  Query& sortby(std::vector<size_t> sorts, std::vector<SortType> types) {
+    N_ENSURE_EQ(sorts.size(), types.size(), "every sort column needs a sort type");
+    sorts_ = std::move(sorts);
+    sortTypes_ = std::move(types);
+    sortType_ = sortTypes_.empty() ? SortType::ASC : sortTypes_.front();
     return *this;
   }
 
@@ -121,6 +132,8 @@ public:
   // sorting information
   std::vector<size_t> sorts_;
   SortType sortType_;
+  // sort type of every sort column, sortType_ applies to all if not set
+  std::vector<SortType> sortTypes_;
 
   // limit the results to return
   size_t limit_;
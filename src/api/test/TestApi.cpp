@@ -90,7 +90,7 @@ TEST(ApiTest, TestQueryStructure) {
 
   // pass the query plan to a server to execute - usually it is itself
   folly::CPUThreadPoolExecutor pool{ 8 };
-  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan);
+  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan).get();
 
   // print out result;
   LOG(INFO) << "----------------------------------------------------------------";
@@ -133,7 +133,7 @@ TEST(ApiTest, TestSortingAndTop) {
 
   // pass the query plan to a server to execute - usually it is itself
   folly::CPUThreadPoolExecutor pool{ 8 };
-  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan);
+  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan).get();
 
   // print out result;
   LOG(INFO) << "----------------------------------------------------------------";
@@ -15,6 +15,7 @@
  */
 
 #include <fmt/format.h>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -29,6 +30,7 @@
 #include "common/Folly.h"
 #include "common/Likely.h"
 #include "common/Memory.h"
+#include "execution/BlockManager.h"
 #include "execution/ExecutionPlan.h"
 #include "execution/core/ServerExecutor.h"
 #include "execution/meta/TableService.h"
@@ -37,6 +39,12 @@
 #include "surface/MockSurface.h"
 #include "type/Serde.h"
 
+DECLARE_uint64(MAX_KEY_SLOTS);
+DECLARE_uint64(MORSEL_ROWS);
+DECLARE_uint64(PREAGG_SAMPLE_ROWS);
+DECLARE_double(PREAGG_BYPASS_RATIO);
+DECLARE_bool(THREAD_LOCAL_AGG);
+
 namespace nebula {
 namespace api {
 namespace test {
@@ -44,6 +52,7 @@ namespace test {
 using namespace nebula::api::dsl;
 using nebula::common::Cursor;
 using nebula::common::Evidence;
+using nebula::execution::BlockManager;
 using nebula::execution::core::ServerExecutor;
 using nebula::execution::meta::TableService;
 using nebula::surface::RowData;
@@ -78,7 +87,7 @@ TEST(ApiTest, TestMultipleBlocks) {
   nebula::common::Evidence::Duration tick;
   folly::CPUThreadPoolExecutor pool{ 8 };
   // pass the query plan to a server to execute - usually it is itself
-  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan);
+  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan).get();
 
   // query should have results
   EXPECT_GT(result->size(), 0);
@@ -123,7 +132,7 @@ TEST(ApiTest, TestStringEqEmpty) {
   nebula::common::Evidence::Duration tick;
   // pass the query plan to a server to execute - usually it is itself
   folly::CPUThreadPoolExecutor pool{ 8 };
-  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan);
+  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan).get();
 
   // query should have results
   EXPECT_EQ(result->size(), 1);
@@ -168,7 +177,7 @@ TEST(ApiTest, TestBlockSkipByBloomfilter) {
   nebula::common::Evidence::Duration tick;
   // pass the query plan to a server to execute - usually it is itself
   folly::CPUThreadPoolExecutor pool{ 8 };
-  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan);
+  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan).get();
 
   // query should have results
   EXPECT_EQ(result->size(), 1);
@@ -202,7 +211,7 @@ TEST(ApiTest, TestBlockSkipByPartitionColumn) {
   nebula::common::Evidence::Duration tick;
   // pass the query plan to a server to execute - usually it is itself
   folly::CPUThreadPoolExecutor pool{ 8 };
-  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan);
+  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan).get();
 
   // query should have results
   EXPECT_EQ(result->size(), 1);
@@ -240,7 +249,7 @@ TEST(ApiTest, TestAvgAggregation) {
   nebula::common::Evidence::Duration tick;
   // pass the query plan to a server to execute - usually it is itself
   folly::CPUThreadPoolExecutor pool{ 8 };
-  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan);
+  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan).get();
 
   // query should have results
   EXPECT_EQ(result->size(), 10);
@@ -291,7 +300,7 @@ TEST(ApiTest, TestPercentile) {
   nebula::common::Evidence::Duration tick;
   // pass the query plan to a server to execute - usually it is itself
   folly::CPUThreadPoolExecutor pool{ 8 };
-  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan);
+  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan).get();
 
   // print out result;
   LOG(INFO) << "----------------------------------------------------------------";
@@ -307,6 +316,49 @@ TEST(ApiTest, TestPercentile) {
   }
 }
 
+TEST(ApiTest, TestCardinality) {
+  auto data = genData();
+
+  // query this table
+  auto ms = TableService::singleton();
+  auto tableName = std::get<0>(data);
+  auto start = std::get<1>(data);
+  auto end = std::get<2>(data);
+  auto query = table(tableName, ms)
+                 .where(col("_time_") > start && col("_time_") < end)
+                 .select(
+                   col("event"),
+                   cardinality(col("value")).as("values"),
+                   cardinality(col("tag")).as("tags"),
+                   cardinality(col("id")).as("ids"))
+                 .groupby({ 1 })
+                 .sortby({ 4 }, SortType::DESC)
+                 .limit(10);
+
+  // compile the query into an execution plan
+  QueryContext ctx{ "nebula", { "nebula-users" } };
+  auto plan = query.compile(ctx);
+  plan->setWindow({ start, end });
+
+  // pass the query plan to a server to execute - usually it is itself
+  folly::CPUThreadPoolExecutor pool{ 8 };
+  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan).get();
+
+  // a tinyint column has no more than 256 distinct values, which is counted exactly
+  LOG(INFO) << fmt::format("col: {0:20} | {1:12} | {2:12} | {3:12}", "event", "values", "tags", "ids");
+  while (result->hasNext()) {
+    const auto& row = result->next();
+    LOG(INFO) << fmt::format("row: {0:20} | {1:12} | {2:12} | {3:12}",
+                             row.readString("event"),
+                             row.readLong("values"),
+                             row.readLong("tags"),
+                             row.readLong("ids"));
+    EXPECT_LE(row.readLong("values"), 256);
+    EXPECT_GT(row.readLong("tags"), 0);
+    EXPECT_GT(row.readLong("ids"), 0);
+  }
+}
+
 TEST(ApiTest, TestAccessControl) {
   auto data = genData();
 
@@ -335,7 +387,7 @@ TEST(ApiTest, TestAccessControl) {
   nebula::common::Evidence::Duration tick;
   // pass the query plan to a server to execute - usually it is itself
   folly::CPUThreadPoolExecutor pool{ 8 };
-  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan);
+  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan).get();
 
   // query should have results
   EXPECT_EQ(result->size(), 10);
@@ -357,6 +409,390 @@ TEST(ApiTest, TestAccessControl) {
   }
 }
 
+TEST(ApiTest, TestMetadataAggregation) {
+  auto data = genData();
+
+  auto ms = TableService::singleton();
+  auto tableName = std::get<0>(data);
+  auto start = std::get<1>(data);
+  auto end = std::get<2>(data);
+
+  // run the same aggregation with a given filter and return its only row
+  auto run = [&](auto filter, bool metadata) {
+    auto query = table(tableName, ms)
+                   .where(col("_time_") >= start && col("_time_") <= end && filter)
+                   .select(
+                     count(1).as("count"),
+                     sum(col("value")).as("sum"),
+                     min(col("id")).as("min"),
+                     max(col("weight")).as("max"));
+
+    QueryContext ctx{ "nebula", { "nebula-users" } };
+    auto plan = query.compile(ctx);
+    plan->setWindow({ start, end });
+    plan->display();
+
+    // all fields can be answered by block metadata
+    const auto& block = plan->template fetch<nebula::execution::PhaseType::COMPUTE>();
+    EXPECT_EQ(block.metaFields().empty(), !metadata);
+
+    folly::CPUThreadPoolExecutor pool{ 8 };
+    auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan).get();
+    EXPECT_EQ(result->size(), 1);
+    const auto& row = result->next();
+    return std::make_tuple(row.readLong("count"), row.readLong("sum"), row.readInt("min"), row.readDouble("max"));
+  };
+
+  // the second filter is uncertain on blocks so every row will be scanned
+  auto meta = run(col("_time_") >= start, true);
+  auto scan = run(col("event") != "__never_exists__", true);
+  EXPECT_EQ(std::get<0>(meta), std::get<0>(scan));
+  EXPECT_EQ(std::get<1>(meta), std::get<1>(scan));
+  EXPECT_EQ(std::get<2>(meta), std::get<2>(scan));
+  EXPECT_EQ(std::get<3>(meta), std::get<3>(scan));
+}
+
+TEST(ApiTest, TestKeySlotsAggregation) {
+  auto data = genData();
+
+  auto ms = TableService::singleton();
+  auto tableName = std::get<0>(data);
+  auto start = std::get<1>(data);
+  auto end = std::get<2>(data);
+
+  // run the same group by query and collect result of each group
+  auto run = [&]() {
+    auto query = table(tableName, ms)
+                   .where(col("_time_") > start && col("_time_") < end)
+                   .select(
+                     col("tag"),
+                     col("flag"),
+                     col("value"),
+                     count(1).as("count"),
+                     sum(col("value")).as("sum"))
+                   .groupby({ 1, 2, 3 });
+
+    QueryContext ctx{ "nebula", { "nebula-users" } };
+    auto plan = query.compile(ctx);
+    plan->setWindow({ start, end });
+
+    // all keys are plain columns: partition column, bool and tinyint with small range
+    const auto& block = plan->template fetch<nebula::execution::PhaseType::COMPUTE>();
+    EXPECT_TRUE(block.hasColumnKeys());
+    EXPECT_EQ(block.columnKeys().size(), 3);
+
+    folly::CPUThreadPoolExecutor pool{ 8 };
+    auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan).get();
+    std::map<std::string, std::pair<int64_t, int64_t>> groups;
+    while (result->hasNext()) {
+      const auto& row = result->next();
+      auto key = fmt::format("{0}-{1}-{2}", row.readString("tag"), row.readBool("flag"), row.readByte("value"));
+      groups.emplace(key, std::make_pair(row.readLong("count"), row.readLong("sum")));
+    }
+
+    return groups;
+  };
+
+  // dense key slots vs hashing only
+  auto slots = run();
+  auto slotsLimit = FLAGS_MAX_KEY_SLOTS;
+  FLAGS_MAX_KEY_SLOTS = 0;
+  auto hashing = run();
+  FLAGS_MAX_KEY_SLOTS = slotsLimit;
+
+  EXPECT_TRUE(slots.size() > 0);
+  EXPECT_EQ(slots, hashing);
+}
+
+TEST(ApiTest, TestInlineStateAggregation) {
+  auto data = genData();
+
+  auto ms = TableService::singleton();
+  auto tableName = std::get<0>(data);
+  auto start = std::get<1>(data);
+  auto end = std::get<2>(data);
+
+  // simple aggregations are computed and merged with inline states
+  auto query = table(tableName, ms)
+                 .where(col("_time_") > start && col("_time_") < end)
+                 .select(
+                   col("tag"),
+                   count(1).as("count"),
+                   sum(col("value")).as("sum"),
+                   min(col("value")).as("min"),
+                   max(col("value")).as("max"))
+                 .groupby({ 1 });
+
+  QueryContext ctx{ "nebula", { "nebula-users" } };
+  auto plan = query.compile(ctx);
+  plan->setWindow({ start, end });
+
+  folly::CPUThreadPoolExecutor pool{ 8 };
+  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan).get();
+  EXPECT_TRUE(result->size() > 0);
+
+  int64_t total = 0;
+  while (result->hasNext()) {
+    const auto& row = result->next();
+    auto count = row.readLong("count");
+    auto sum = row.readLong("sum");
+    auto min = row.readByte("min");
+    auto max = row.readByte("max");
+    EXPECT_TRUE(count > 0);
+    EXPECT_TRUE(min <= max);
+    EXPECT_TRUE(sum >= count * min);
+    EXPECT_TRUE(sum <= count * max);
+    total += count;
+  }
+
+  // total count of all groups should be the same as count without groups
+  auto all = table(tableName, ms)
+               .where(col("_time_") > start && col("_time_") < end)
+               .select(count(1).as("count"));
+  auto plan2 = all.compile(ctx);
+  plan2->setWindow({ start, end });
+  auto result2 = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan2).get();
+  EXPECT_EQ(result2->size(), 1);
+  EXPECT_EQ(result2->next().readLong("count"), total);
+}
+
+TEST(ApiTest, TestBypassPreAggregation) {
+  auto data = genData();
+
+  auto ms = TableService::singleton();
+  auto tableName = std::get<0>(data);
+  auto start = std::get<1>(data);
+  auto end = std::get<2>(data);
+
+  // group by a high cardinality key and collect result of each group
+  auto run = [&]() {
+    auto query = table(tableName, ms)
+                   .where(col("_time_") > start && col("_time_") < end)
+                   .select(
+                     col("id"),
+                     count(1).as("count"),
+                     sum(col("value")).as("sum"))
+                   .groupby({ 1 });
+
+    QueryContext ctx{ "nebula", { "nebula-users" } };
+    auto plan = query.compile(ctx);
+    plan->setWindow({ start, end });
+
+    folly::CPUThreadPoolExecutor pool{ 8 };
+    auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan).get();
+    std::map<int32_t, std::pair<int64_t, int64_t>> groups;
+    while (result->hasNext()) {
+      const auto& row = result->next();
+      // every key shows up only once even if blocks emit raw partial rows
+      auto added = groups.emplace(row.readInt("id"), std::make_pair(row.readLong("count"), row.readLong("sum")));
+      EXPECT_TRUE(added.second);
+    }
+
+    return groups;
+  };
+
+  // always bypass vs always pre-aggregate
+  auto sample = FLAGS_PREAGG_SAMPLE_ROWS;
+  auto ratio = FLAGS_PREAGG_BYPASS_RATIO;
+  FLAGS_PREAGG_SAMPLE_ROWS = 1;
+  FLAGS_PREAGG_BYPASS_RATIO = 0;
+  auto bypassed = run();
+  FLAGS_PREAGG_SAMPLE_ROWS = 0;
+  auto aggregated = run();
+  FLAGS_PREAGG_SAMPLE_ROWS = sample;
+  FLAGS_PREAGG_BYPASS_RATIO = ratio;
+
+  EXPECT_TRUE(bypassed.size() > 0);
+  EXPECT_EQ(bypassed, aggregated);
+}
+
+TEST(ApiTest, TestCachedBypassPreAggregation) {
+  auto data = genData();
+
+  auto ms = TableService::singleton();
+  auto tableName = std::get<0>(data);
+
+  // a single sealed block out of the test data window, so that its result is cacheable
+  int64_t start = Evidence::time("2020-01-01", "%Y-%m-%d");
+  int64_t end = Evidence::time("2020-01-02", "%Y-%m-%d");
+  auto bm = BlockManager::init();
+  EXPECT_TRUE(bm->add(nebula::meta::BlockSignature{ tableName, 1000, (size_t)start, (size_t)end }));
+  nebula::execution::io::BatchBlock block = *bm->all().begin();
+  for (const auto& b : bm->all()) {
+    if (b.start() == (size_t)start) {
+      block = b;
+    }
+  }
+
+  EXPECT_EQ(block.start(), (size_t)start);
+  block.data()->seal();
+
+  // group by a high cardinality key of the single block
+  auto run = [&]() {
+    auto query = table(tableName, ms)
+                   .where(col("_time_") >= start && col("_time_") <= end)
+                   .select(
+                     col("id"),
+                     count(1).as("count"))
+                   .groupby({ 1 });
+
+    QueryContext ctx{ "nebula", { "nebula-users" } };
+    auto plan = query.compile(ctx);
+    plan->setWindow({ start, end });
+
+    folly::CPUThreadPoolExecutor pool{ 8 };
+    auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan).get();
+    std::map<int32_t, int64_t> groups;
+    while (result->hasNext()) {
+      const auto& row = result->next();
+      // the only block is bypassed, its raw partial rows still merge into unique keys
+      auto added = groups.emplace(row.readInt("id"), row.readLong("count"));
+      EXPECT_TRUE(added.second);
+    }
+
+    return groups;
+  };
+
+  auto sample = FLAGS_PREAGG_SAMPLE_ROWS;
+  auto ratio = FLAGS_PREAGG_BYPASS_RATIO;
+  FLAGS_PREAGG_SAMPLE_ROWS = 1;
+  FLAGS_PREAGG_BYPASS_RATIO = 0;
+  auto bypassed = run();
+  FLAGS_PREAGG_SAMPLE_ROWS = 0;
+  auto aggregated = run();
+  FLAGS_PREAGG_SAMPLE_ROWS = sample;
+  FLAGS_PREAGG_BYPASS_RATIO = ratio;
+  bm->removeById(block.signature().toString());
+
+  EXPECT_TRUE(bypassed.size() > 0);
+  EXPECT_EQ(bypassed, aggregated);
+}
+
+TEST(ApiTest, TestStreamingQuery) {
+  auto data = genData();
+
+  auto ms = TableService::singleton();
+  auto tableName = std::get<0>(data);
+  auto start = std::get<1>(data);
+  auto end = std::get<2>(data);
+  auto query = table(tableName, ms)
+                 .where(col("_time_") > start && col("_time_") < end)
+                 .select(
+                   col("event"),
+                   count(col("value")).as("total"))
+                 .groupby({ 1 })
+                 .sortby({ 2 }, SortType::DESC);
+
+  QueryContext ctx{ "nebula", { "nebula-users" } };
+  auto plan = query.compile(ctx);
+  plan->setWindow({ start, end });
+
+  folly::CPUThreadPoolExecutor pool{ 8 };
+  ServerExecutor executor(nebula::meta::NNode::local().toString());
+  const auto sum = [](nebula::surface::RowCursorPtr result) {
+    int64_t total = 0;
+    while (result->hasNext()) {
+      total += result->next().readLong("total");
+    }
+    return total;
+  };
+
+  // every report covers more nodes, the last one covers all nodes
+  std::vector<std::pair<size_t, size_t>> coverage;
+  int64_t streamed = 0;
+  executor.stream(pool, *plan, std::make_shared<nebula::execution::core::NodeConnector>(),
+                  [&coverage, &streamed, &sum](nebula::surface::RowCursorPtr result, size_t done, size_t total) {
+                    coverage.emplace_back(done, total);
+                    streamed = sum(result);
+                  })
+    .get();
+
+  EXPECT_EQ(coverage.size(), plan->getNodes().size());
+  EXPECT_EQ(coverage.back().first, coverage.back().second);
+
+  // the final report is the same as the query result
+  auto another = query.compile(ctx);
+  another->setWindow({ start, end });
+  EXPECT_EQ(streamed, sum(executor.execute(pool, *another).get()));
+  EXPECT_GT(streamed, 0);
+}
+
+TEST(ApiTest, TestSamplesLimit) {
+  auto data = genData();
+
+  auto ms = TableService::singleton();
+  auto tableName = std::get<0>(data);
+  auto start = std::get<1>(data);
+  auto end = std::get<2>(data);
+  auto query = table(tableName, ms)
+                 .where(col("_time_") > start && col("_time_") < end)
+                 .select(col("event"), col("id"))
+                 .limit(10);
+
+  QueryContext ctx{ "nebula", { "nebula-users" } };
+  auto plan = query.compile(ctx);
+  plan->setWindow({ start, end });
+
+  // small morsels, most of them are skipped once the limit is met
+  auto morselRows = FLAGS_MORSEL_ROWS;
+  FLAGS_MORSEL_ROWS = 100;
+  folly::CPUThreadPoolExecutor pool{ 8 };
+  auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan).get();
+  FLAGS_MORSEL_ROWS = morselRows;
+
+  EXPECT_EQ(result->size(), 10);
+}
+
+// every block is split into many morsels taken by workers running after the blocks were filtered,
+// build with -DASAN=1 to catch morsels outliving the blocks they point to.
+TEST(ApiTest, TestMultiMorselAggregation) {
+  auto data = genData();
+
+  auto ms = TableService::singleton();
+  auto tableName = std::get<0>(data);
+  auto start = std::get<1>(data);
+  auto end = std::get<2>(data);
+
+  auto run = [&]() {
+    auto query = table(tableName, ms)
+                   .where(col("_time_") > start && col("_time_") < end)
+                   .select(
+                     col("event"),
+                     count(1).as("count"))
+                   .groupby({ 1 });
+
+    QueryContext ctx{ "nebula", { "nebula-users" } };
+    auto plan = query.compile(ctx);
+    plan->setWindow({ start, end });
+
+    folly::CPUThreadPoolExecutor pool{ 8 };
+    auto result = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan).get();
+    std::map<std::string, int64_t> groups;
+    while (result->hasNext()) {
+      const auto& row = result->next();
+      groups.emplace(row.readString("event"), row.readLong("count"));
+    }
+
+    return groups;
+  };
+
+  auto whole = run();
+
+  auto morselRows = FLAGS_MORSEL_ROWS;
+  auto local = FLAGS_THREAD_LOCAL_AGG;
+  FLAGS_MORSEL_ROWS = 100;
+  FLAGS_THREAD_LOCAL_AGG = true;
+  auto locals = run();
+  FLAGS_THREAD_LOCAL_AGG = false;
+  auto morsels = run();
+  FLAGS_MORSEL_ROWS = morselRows;
+  FLAGS_THREAD_LOCAL_AGG = local;
+
+  EXPECT_TRUE(whole.size() > 0);
+  EXPECT_EQ(locals, whole);
+  EXPECT_EQ(morsels, whole);
+}
+
 } // namespace test
 } // namespace api
 } // namespace nebula
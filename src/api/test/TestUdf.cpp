@@ -19,6 +19,7 @@
 
 #include "api/dsl/Expressions.h"
 #include "api/udf/Avg.h"
+#include "api/udf/Cardinality.h"
 #include "api/udf/Count.h"
 #include "api/udf/In.h"
 #include "api/udf/Like.h"
@@ -599,6 +600,123 @@ TEST(UDFTest, TestPct) {
   EXPECT_NEAR(td4, 217, 1);
   auto json = static_cast<CType::Aggregator*>(td1.get())->jsonfy();
   LOG(INFO) << "sketch in json: " << json;
+
+  // serialize and load through a slice
+  nebula::common::ExtendableSlice slice(1024);
+  auto size = td1->serialize(slice, 0);
+  auto td3 = tf.sketch();
+  EXPECT_EQ(td3->load(slice, 0), size);
+  EXPECT_NEAR(td3->finalize(), 217, 1);
+}
+
+TEST(UDFTest, TestPctRelative) {
+  using CType = nebula::api::udf::Pct<nebula::type::Kind::BIGINT>;
+  auto v = std::make_shared<nebula::api::dsl::ConstExpression<int64_t>>(0);
+
+  // latency like values spanning orders of magnitude
+  const auto fill = [](auto& sketch, int64_t from, int64_t to) {
+    for (auto i = from; i < to; ++i) {
+      sketch->merge(i * i);
+    }
+  };
+
+  // sketch type is decided when the UDAF is created
+  FLAGS_PCT_ACCURACY = 0.01;
+  CType dc("dd", v->asEval(), 99);
+  FLAGS_PCT_ACCURACY = 0;
+  CType tc("td", v->asEval(), 99);
+
+  auto d1 = dc.sketch();
+  auto d2 = dc.sketch();
+  fill(d1, 0, 5000);
+  fill(d2, 5000, 10000);
+  d1->mix(*d2);
+
+  // p99 of 10000 squares is about 9900^2, within 1% relative error
+  const int64_t expected = 9900L * 9900L;
+  EXPECT_NEAR(d1->finalize(), expected, expected * 0.01);
+
+  // serialize and load keeps the sketch type
+  nebula::common::ExtendableSlice slice(1024);
+  auto size = d1->serialize(slice, 0);
+  auto d3 = tc.sketch();
+  EXPECT_EQ(d3->load(slice, 0), size);
+  EXPECT_NEAR(d3->finalize(), expected, expected * 0.01);
+
+  // different sketch types can still be mixed
+  auto t1 = tc.sketch();
+  fill(t1, 10000, 10100);
+  d3->mix(*t1);
+  const int64_t mixed = 9998L * 9998L;
+  EXPECT_NEAR(d3->finalize(), mixed, mixed * 0.01);
+}
+
+TEST(UDFTest, TestCardinality) {
+  using LType = nebula::api::udf::Cardinality<nebula::type::Kind::BIGINT>;
+  using SType = nebula::api::udf::Cardinality<nebula::type::Kind::VARCHAR>;
+  auto v = std::make_shared<nebula::api::dsl::ConstExpression<int64_t>>(0);
+  LType lc("c1", v->asEval());
+
+  // small set of integers is counted exactly, duplicates across sketches are not counted twice
+  auto l1 = lc.sketch();
+  auto l2 = lc.sketch();
+  for (int64_t i = 0; i < 1000; ++i) {
+    l1->merge(i);
+    l1->merge(i);
+    l2->merge(i + 500);
+  }
+  l1->mix(*l2);
+  EXPECT_EQ(l1->finalize(), 1500);
+
+  // large set turns into HLL, error should be within a few percent
+  const auto near = [](int64_t estimate, int64_t expected) {
+    EXPECT_NEAR(estimate, expected, expected * 0.03);
+  };
+
+  auto l3 = lc.sketch();
+  for (int64_t i = 0; i < 100000; ++i) {
+    l3->merge(i * 7);
+  }
+  near(l3->finalize(), 100000);
+
+  // mixing exact, sparse and dense sketches
+  l1->mix(*l3);
+  near(l1->finalize(), 100000 + 1500 - 215);
+
+  // serialize and load through a slice
+  nebula::common::ExtendableSlice slice(1024);
+  auto size = l1->serialize(slice, 0);
+  auto l4 = lc.sketch();
+  EXPECT_EQ(l4->load(slice, 0), size);
+  EXPECT_EQ(l4->finalize(), l1->finalize());
+
+  // strings are always hashed
+  auto sv = std::make_shared<nebula::api::dsl::ConstExpression<std::string_view>>("x");
+  SType sc("c2", sv->asEval());
+  auto s1 = sc.sketch();
+  auto s2 = sc.sketch();
+  std::vector<std::string> strs;
+  for (auto i = 0; i < 50000; ++i) {
+    strs.push_back(fmt::format("key-{0}", i));
+  }
+  for (auto i = 0; i < 30000; ++i) {
+    s1->merge(strs.at(i));
+    s2->merge(strs.at(i + 20000));
+  }
+  near(s1->finalize(), 30000);
+
+  auto offset = s2->serialize(slice, size);
+  auto s3 = sc.sketch();
+  EXPECT_EQ(s3->load(slice, size), offset);
+  s1->mix(*s3);
+  near(s1->finalize(), 50000);
+
+  // small string set stays sparse and accurate
+  auto s4 = sc.sketch();
+  for (auto i = 0; i < 100; ++i) {
+    s4->merge(strs.at(i));
+  }
+  EXPECT_NEAR(s4->finalize(), 100, 2);
 }
 
 } // namespace test
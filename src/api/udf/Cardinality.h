@@ -0,0 +1,323 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <roaring64map.hh>
+
+#include "common/Hash.h"
+#include "surface/eval/UDF.h"
+
+/**
+ * Implement UDAF Cardinality to count distinct values through a mergeable HyperLogLog sketch.
+ * The sketch goes through 3 modes as number of distinct values grows:
+ *   EXACT:  integral values are kept in a roaring bitmap while it is small, result is exact.
+ *   SPARSE: list of (register, rank) pairs of hashed values, only touched registers are kept.
+ *   DENSE:  all 2^14 registers, standard error is about 0.8%.
+ * Sketches in different modes can be mixed, result is in the mode of less precision.
+ */
+namespace nebula {
+namespace api {
+namespace udf {
+
+// UDAF - cardinality (approximate count distinct) through HyperLogLog
+template <nebula::type::Kind IK,
+          typename Traits = nebula::surface::eval::UdfTraits<nebula::surface::eval::UDFType::CARDINALITY, IK>,
+          typename BaseType = nebula::surface::eval::UDAF<Traits::Type, IK>>
+class Cardinality : public BaseType {
+public:
+  using InputType = typename BaseType::InputType;
+  using NativeType = typename BaseType::NativeType;
+  using BaseAggregator = typename BaseType::BaseAggregator;
+
+  // exact mode is available for integral values no wider than 64 bits
+  static constexpr bool EXACT_INPUT = std::is_integral_v<InputType> && sizeof(InputType) <= sizeof(int64_t);
+
+public:
+  class Aggregator : public BaseAggregator {
+    // number of registers is 2^P
+    static constexpr uint8_t P = 14;
+    static constexpr size_t M = 1UL << P;
+    // exact mode turns into HLL when it has more distinct values than this
+    static constexpr size_t EXACT_LIMIT = 4096;
+    // sparse entry takes 4 bytes, it turns into dense registers (1 byte each) when it's larger
+    static constexpr size_t SPARSE_LIMIT = M / 4;
+
+    enum class Mode : uint8_t {
+      EXACT = 0,
+      SPARSE = 1,
+      DENSE = 2
+    };
+
+  public:
+    Aggregator() : mode_{ EXACT_INPUT ? Mode::EXACT : Mode::SPARSE }, adds_{ 0 } {}
+    virtual ~Aggregator() = default;
+
+    // aggregate an value in
+    inline virtual void merge(InputType v) override {
+      if constexpr (EXACT_INPUT) {
+        if (mode_ == Mode::EXACT) {
+          exact_.add(static_cast<uint64_t>(static_cast<int64_t>(v)));
+
+          // cardinality of a bitmap is not free, check it periodically
+          if (UNLIKELY((++adds_ & 0xFF) == 0 && exact_.cardinality() > EXACT_LIMIT)) {
+            approximate();
+          }
+          return;
+        }
+      }
+
+      add(hash(v));
+    }
+
+    // aggregate another aggregator
+    inline virtual void mix(const nebula::surface::eval::Sketch& another) override {
+      const auto& right = static_cast<const Aggregator&>(another);
+      if (mode_ == Mode::EXACT && right.mode_ == Mode::EXACT) {
+        exact_ |= right.exact_;
+        if (exact_.cardinality() > EXACT_LIMIT) {
+          approximate();
+        }
+        return;
+      }
+
+      if (mode_ == Mode::EXACT) {
+        approximate();
+      }
+
+      switch (right.mode_) {
+      case Mode::EXACT: {
+        for (auto v : right.exact_) {
+          add(hash(static_cast<int64_t>(v)));
+        }
+        break;
+      }
+      case Mode::SPARSE: {
+        for (auto e : right.sparse_) {
+          update(e >> RANK_BITS, e & RANK_MASK);
+        }
+        break;
+      }
+      case Mode::DENSE: {
+        densify();
+        for (size_t i = 0; i < M; ++i) {
+          dense_[i] = std::max(dense_[i], right.dense_[i]);
+        }
+        break;
+      }
+      }
+    }
+
+    inline virtual NativeType finalize() override {
+      if (mode_ == Mode::EXACT) {
+        return exact_.cardinality();
+      }
+
+      // registers not touched are zeros, linear counting is used when there are many of them
+      double sum = 0;
+      size_t zeros = 0;
+      if (mode_ == Mode::SPARSE) {
+        compact();
+        zeros = M - sparse_.size();
+        sum = zeros;
+        for (auto e : sparse_) {
+          sum += std::ldexp(1.0, -(int)(e & RANK_MASK));
+        }
+      } else {
+        for (auto r : dense_) {
+          zeros += r == 0;
+          sum += std::ldexp(1.0, -(int)r);
+        }
+      }
+
+      const auto alpha = 0.7213 / (1 + 1.079 / M);
+      auto estimate = alpha * M * M / sum;
+      if (estimate <= 2.5 * M && zeros > 0) {
+        estimate = M * std::log((double)M / zeros);
+      }
+
+      return static_cast<NativeType>(std::llround(estimate));
+    }
+
+    // serialize into a buffer: [mode][size][payload]
+    inline virtual size_t serialize(nebula::common::ExtendableSlice& slice, size_t offset) override {
+      size_t origin = offset;
+      offset += slice.write(offset, static_cast<uint8_t>(mode_));
+      switch (mode_) {
+      case Mode::EXACT: {
+        exact_.runOptimize();
+        std::string bytes(exact_.getSizeInBytes(true), 0);
+        exact_.write(bytes.data(), true);
+        offset += slice.write(offset, bytes.size());
+        offset += slice.write(offset, bytes.data(), bytes.size());
+        break;
+      }
+      case Mode::SPARSE: {
+        compact();
+        offset += slice.write(offset, sparse_.size());
+        offset += slice.write(offset, (const char*)sparse_.data(), sparse_.size() * sizeof(uint32_t));
+        break;
+      }
+      case Mode::DENSE: {
+        offset += slice.write(offset, dense_.size());
+        offset += slice.write(offset, (const char*)dense_.data(), dense_.size());
+        break;
+      }
+      }
+
+      return offset - origin;
+    }
+
+    // deserialize from a given buffer
+    inline virtual size_t load(nebula::common::ExtendableSlice& slice, size_t offset) override {
+      size_t origin = offset;
+      mode_ = static_cast<Mode>(slice.read<uint8_t>(offset));
+      offset += sizeof(uint8_t);
+      auto size = slice.read<size_t>(offset);
+      offset += sizeof(size_t);
+      switch (mode_) {
+      case Mode::EXACT: {
+        exact_ = Roaring64Map::read(slice.read(offset, size).data(), true);
+        offset += size;
+        break;
+      }
+      case Mode::SPARSE: {
+        auto bytes = slice.read(offset, size * sizeof(uint32_t));
+        sparse_.resize(size);
+        std::memcpy(sparse_.data(), bytes.data(), bytes.size());
+        offset += bytes.size();
+        break;
+      }
+      case Mode::DENSE: {
+        auto bytes = slice.read(offset, size);
+        dense_.assign(bytes.begin(), bytes.end());
+        offset += size;
+        break;
+      }
+      }
+
+      return offset - origin;
+    }
+
+    // size varies by mode, always store in data buffer
+    inline virtual bool fit(size_t) override {
+      return false;
+    }
+
+  private:
+    // sparse entry is register index in high bits and its rank in low bits
+    static constexpr uint32_t RANK_BITS = 8;
+    static constexpr uint32_t RANK_MASK = (1 << RANK_BITS) - 1;
+
+    template <typename T>
+    static inline uint64_t hash(const T& v) {
+      if constexpr (std::is_same_v<T, std::string_view>) {
+        return nebula::common::Hasher::hashString(v);
+      } else if constexpr (std::is_integral_v<T> && sizeof(T) <= sizeof(int64_t)) {
+        // integral values are widened before hashing so exact values hash the same way
+        const int64_t w = v;
+        return nebula::common::Hasher::hash64(&w, sizeof(w));
+      } else {
+        return nebula::common::Hasher::hash64(&v, sizeof(v));
+      }
+    }
+
+    // add a hashed value into registers
+    inline void add(uint64_t h) {
+      const uint32_t index = h >> (64 - P);
+      // rank is position of the first 1 bit after index bits, guarded by a sentinel bit
+      const uint8_t rank = __builtin_clzll((h << P) | (1UL << (P - 1))) + 1;
+      update(index, rank);
+    }
+
+    inline void update(uint32_t index, uint8_t rank) {
+      if (mode_ == Mode::DENSE) {
+        dense_[index] = std::max(dense_[index], rank);
+        return;
+      }
+
+      // sparse list is compacted when it doubles the limit
+      sparse_.push_back((index << RANK_BITS) | rank);
+      if (UNLIKELY(sparse_.size() >= 2 * SPARSE_LIMIT)) {
+        compact();
+        if (sparse_.size() > SPARSE_LIMIT) {
+          densify();
+        }
+      }
+    }
+
+    // sort sparse entries and keep max rank of every register
+    inline void compact() {
+      // higher rank comes first for the same register, unique keeps the first one
+      std::sort(sparse_.begin(), sparse_.end(), [](uint32_t a, uint32_t b) {
+        return (a >> RANK_BITS) != (b >> RANK_BITS) ? a < b : a > b;
+      });
+      auto last = std::unique(sparse_.begin(), sparse_.end(), [](uint32_t a, uint32_t b) {
+        return (a >> RANK_BITS) == (b >> RANK_BITS);
+      });
+      sparse_.erase(last, sparse_.end());
+    }
+
+    // convert exact values into sparse HLL
+    inline void approximate() {
+      mode_ = Mode::SPARSE;
+      for (auto v : exact_) {
+        add(hash(static_cast<int64_t>(v)));
+      }
+      exact_ = Roaring64Map();
+    }
+
+    // convert sparse entries into dense registers
+    inline void densify() {
+      if (mode_ == Mode::DENSE) {
+        return;
+      }
+
+      dense_.assign(M, 0);
+      for (auto e : sparse_) {
+        const auto index = e >> RANK_BITS;
+        dense_[index] = std::max<uint8_t>(dense_[index], e & RANK_MASK);
+      }
+
+      mode_ = Mode::DENSE;
+      sparse_.clear();
+      sparse_.shrink_to_fit();
+    }
+
+  private:
+    Mode mode_;
+    size_t adds_;
+    Roaring64Map exact_;
+    std::vector<uint32_t> sparse_;
+    std::vector<uint8_t> dense_;
+  };
+
+public:
+  Cardinality(const std::string& name, std::unique_ptr<nebula::surface::eval::ValueEval> expr)
+    : BaseType(name,
+               std::move(expr),
+               []() -> std::shared_ptr<Aggregator> {
+                 return std::make_shared<Aggregator>();
+               }) {}
+  virtual ~Cardinality() = default;
+};
+
+} // namespace udf
+} // namespace api
+} // namespace nebula
@@ -0,0 +1,21 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Pct.h"
+
+// relative accuracy (e.g. 0.01 for 1%) guaranteed for every percentile value through DDSketch.
+// it fits metrics spanning orders of magnitude such as latency, default 0 uses tdigest.
+DEFINE_double(PCT_ACCURACY, 0, "relative accuracy of percentile sketch, 0 to use tdigest");
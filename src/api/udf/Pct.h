@@ -16,29 +16,33 @@
 
 #pragma once
 
-#include <atomic>
-#include <folly/stats/TDigest.h>
+#include <gflags/gflags.h>
+#include <memory>
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 
+#include "common/Quantile.h"
 #include "surface/eval/UDF.h"
 
+DECLARE_double(PCT_ACCURACY);
+
 /**
- * Implement UDAF Pct to get quantiles of target values using folly/tdigest implementation
- * Internally this UDAF maintains a sketch binary stream with all numbers in double type.
+ * Implement UDAF Pct to get quantiles of target values.
+ * By default it uses a merging t-digest, when PCT_ACCURACY is set (e.g. 0.01),
+ * it uses DDSketch which guarantees relative error of estimated values instead.
+ * Internally all numbers are stored in double type, sketches are merged in place and serialized as one block.
  */
 namespace nebula {
 namespace api {
 namespace udf {
 
-// UDAF - percentile value through tdigest
+// UDAF - percentile value through tdigest or ddsketch
 template <nebula::type::Kind IK,
           typename Traits = nebula::surface::eval::UdfTraits<nebula::surface::eval::UDFType::PCT, IK>,
           typename BaseType = nebula::surface::eval::UDAF<Traits::Type, IK>>
 class Pct : public BaseType {
   // most commonly for percentiles
   static constexpr size_t DIGEST_SIZE = 100;
-  static constexpr size_t BUFFER_SIZE = 4 * DIGEST_SIZE;
 
 public:
   using InputType = typename BaseType::InputType;
@@ -48,53 +52,59 @@ public:
 public:
   class Aggregator : public BaseAggregator {
   public:
-    explicit Aggregator(double percentile)
-      : percentile_{ percentile / DIGEST_SIZE },
-        digest_{ DIGEST_SIZE },
-        serde_{} {
-      buffer_.reserve(BUFFER_SIZE);
+    // accuracy > 0 means relative accuracy of ddsketch, otherwise tdigest is used.
+    // only the sketch in use is allocated, every group of a query has its own aggregator.
+    explicit Aggregator(double percentile, double accuracy)
+      : percentile_{ percentile / 100 },
+        relative_{ accuracy > 0 } {
+      if (relative_) {
+        dd_ = std::make_unique<nebula::common::DDSketch>(accuracy);
+      } else {
+        digest_ = std::make_unique<nebula::common::TDigest>(DIGEST_SIZE);
+      }
     }
     virtual ~Aggregator() = default;
-    // aggregate an value in
+
+    // aggregate an value in, values are batched by the sketch
     inline virtual void merge(InputType v) override {
-      if (LIKELY(buffer_.size() < BUFFER_SIZE)) {
-        buffer_.emplace_back(double(v));
+      if (relative_) {
+        dd_->add(double(v));
         return;
       }
 
-      flush();
+      digest_->add(double(v));
     }
 
-    // aggregate another aggregator
-    // TODO(cao): the current merge signature is strange requiring an array incuring copy
-    // We may use our own version of TDigest implementation
-    // with better interface to merge single item by pointer or reference
+    // aggregate another aggregator in place
     inline virtual void mix(const nebula::surface::eval::Sketch& another) override {
-      auto right = static_cast<const Aggregator&>(another);
-
-      // merge buffer
-      auto rightBufferSize = right.buffer_.size();
-      if (rightBufferSize > 0) {
-        if (rightBufferSize > buffer_.size()) {
-          std::swap(buffer_, right.buffer_);
+      const auto& right = static_cast<const Aggregator&>(another);
+      if (right.relative_ == relative_) {
+        if (relative_) {
+          dd_->merge(*right.dd_);
+        } else {
+          digest_->merge(*right.digest_);
         }
+        return;
+      }
 
-        for (auto v : right.buffer_) {
-          buffer_.emplace_back(v);
+      // different sketch types, add weighted points of right side into this one
+      const auto add = [this](double v, double w) {
+        if (relative_) {
+          dd_->add(v, w);
+        } else {
+          digest_->add(v, w);
         }
+      };
 
-        right.buffer_.clear();
-      }
-
-      // only merge object only when it has value
-      if (right.digest_.count() > 0) {
-        digest_ = digest_.merge(std::array<folly::TDigest, 1>{ right.digest_ });
+      if (right.relative_) {
+        right.dd_->forEach(add);
+      } else {
+        right.digest_->forEach(add);
       }
     }
 
     inline virtual NativeType finalize() override {
-      flush();
-      return static_cast<NativeType>(digest_.estimateQuantile(percentile_));
+      return static_cast<NativeType>(relative_ ? dd_->quantile(percentile_) : digest_->quantile(percentile_));
     }
 
     std::string jsonfy() {
@@ -102,27 +112,28 @@ public:
       rapidjson::StringBuffer buffer;
       rapidjson::Writer<rapidjson::StringBuffer> json(buffer);
       json.StartObject();
-#define KV(V, NAME) \
-  json.Key(#NAME);  \
-  json.Double(V.NAME());
-
-      KV(digest_, sum)
-      KV(digest_, count)
-      KV(digest_, max)
-      KV(digest_, min)
-      KV(digest_, maxSize)
+      json.Key("type");
+      json.String(relative_ ? "ddsketch" : "tdigest");
+      json.Key("count");
+      json.Double(relative_ ? dd_->count() : digest_->count());
 
       json.Key("centroids");
       json.StartArray();
-      const auto& centroids = digest_.getCentroids();
-      for (const auto& c : centroids) {
+      const auto point = [&json](double mean, double weight) {
         json.StartObject();
-        KV(c, mean)
-        KV(c, weight)
+        json.Key("mean");
+        json.Double(mean);
+        json.Key("weight");
+        json.Double(weight);
         json.EndObject();
+      };
+
+      if (relative_) {
+        dd_->forEach(point);
+      } else {
+        digest_->forEach(point);
       }
       json.EndArray();
-#undef KV
       json.EndObject();
 
       // TODO(cao) - thinking how to avoid dangling string view
@@ -131,80 +142,43 @@ public:
       return serde_;
     }
 
-    // serialize into a buffer
+    // serialize into a buffer: [type][sketch]
     inline virtual size_t serialize(nebula::common::ExtendableSlice& slice, size_t offset) override {
-      flush();
-
-      // record first offset - final size will be delta of offset
-      size_t origin = offset;
-      // write sum
-      offset += slice.write(offset, digest_.sum());
-      // write count
-      offset += slice.write(offset, digest_.count());
-      // write max
-      offset += slice.write(offset, digest_.max());
-      // write min
-      offset += slice.write(offset, digest_.min());
-      // write max size
-      offset += slice.write(offset, digest_.maxSize());
-      // write all centroids
-      const auto& centroids = digest_.getCentroids();
-      // write count of centroids
-      offset += slice.write(offset, centroids.size());
-      for (const auto& c : centroids) {
-        offset += slice.write(offset, c.mean());
-        offset += slice.write(offset, c.weight());
-      }
-
-      return offset - origin;
+      auto size = slice.write(offset, static_cast<uint8_t>(relative_));
+      return size + (relative_ ? dd_->serialize(slice, offset + size) : digest_->serialize(slice, offset + size));
     }
 
-    // deserialize from a given buffer, and bin size
+    // deserialize from a given buffer, the sketch takes parameters of the serialized one
     inline virtual size_t load(nebula::common::ExtendableSlice& slice, size_t offset) override {
-      static constexpr auto WIDTH = sizeof(double);
-
-      size_t origin = offset;
-#define READ(NAME)                          \
-  double NAME = slice.read<double>(offset); \
-  offset += WIDTH;
-
-      READ(sum)
-      READ(count)
-      READ(max)
-      READ(min)
-
-      size_t maxSize = slice.read<size_t>(offset);
-      offset += WIDTH;
-      size_t numCentroids = slice.read<size_t>(offset);
-      offset += WIDTH;
-      std::vector<folly::TDigest::Centroid> centroids;
-      centroids.reserve(numCentroids);
-      for (size_t i = 0; i < numCentroids; ++i) {
-        READ(mean)
-        READ(weight)
-        centroids.emplace_back(mean, weight);
+      relative_ = slice.read<uint8_t>(offset) != 0;
+      auto size = sizeof(uint8_t);
+      if (relative_) {
+        digest_ = nullptr;
+        if (!dd_) {
+          dd_ = std::make_unique<nebula::common::DDSketch>(0.01);
+        }
+
+        return size + dd_->load(slice, offset + size);
+      }
+
+      dd_ = nullptr;
+      if (!digest_) {
+        digest_ = std::make_unique<nebula::common::TDigest>(DIGEST_SIZE);
       }
-#undef READ
-      digest_ = folly::TDigest(std::move(centroids), sum, count, max, min, maxSize);
-      return offset - origin;
+
+      return size + digest_->load(slice, offset + size);
     }
 
     inline virtual bool fit(size_t) override {
       return false;
     }
 
-  private:
-    inline void flush() {
-      if (buffer_.size() > 0) {
-        digest_ = digest_.merge(buffer_);
-        buffer_.clear();
-      }
-    }
-
   private:
     double percentile_;
-    std::vector<double> buffer_;
-    folly::TDigest digest_;
+    bool relative_;
+    // one of them by relative_
+    std::unique_ptr<nebula::common::TDigest> digest_;
+    std::unique_ptr<nebula::common::DDSketch> dd_;
     std::string serde_;
   };
 
@@ -212,8 +186,8 @@ public:
   Pct(const std::string& name, std::unique_ptr<nebula::surface::eval::ValueEval> expr, double percentile)
     : BaseType(name,
                std::move(expr),
-               [p = percentile]() -> std::shared_ptr<Aggregator> {
-                 return std::make_shared<Aggregator>(p);
+               [p = percentile, a = FLAGS_PCT_ACCURACY]() -> std::shared_ptr<Aggregator> {
+                 return std::make_shared<Aggregator>(p, a);
                }) {}
 
   virtual ~Pct() = default;
@@ -17,6 +17,7 @@
 #pragma once
 
 #include "Avg.h"
+#include "Cardinality.h"
 #include "Count.h"
 #include "In.h"
 #include "Like.h"
@@ -75,6 +76,10 @@ public:
       return std::make_unique<Pct<IK>>(name, expr->asEval(), std::forward<Args>(args)...);
     }
 
+    if constexpr (UKIND == UDFKind::CARDINALITY) {
+      return std::make_unique<Cardinality<IK>>(name, expr->asEval());
+    }
+
     if constexpr (UKIND == UDFKind::LIKE) {
       return std::make_unique<Like>(name, expr->asEval(), std::forward<Args>(args)...);
     }
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <glog/logging.h>
+#include <mutex>
+#include <unordered_map>
+
+#include "Errors.h"
+#include "Folly.h"
+#include "Likely.h"
+
+/**
+ * A cancellation token shared by all parts of a query.
+ * Workers check it between units of work and stop once it is cancelled,
+ * outgoing calls listen on it to cancel themselves on remote side.
+ */
+namespace nebula {
+namespace common {
+
+class Cancellation {
+public:
+  using Callback = std::function<void()>;
+
+  Cancellation() : cancelled_{ false }, next_{ 0 } {}
+  Cancellation(Cancellation&) = delete;
+  Cancellation(Cancellation&&) = delete;
+  virtual ~Cancellation() = default;
+
+public:
+  // cancel once, all listening callbacks run in the calling thread
+  void cancel() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (cancelled_.exchange(true)) {
+      return;
+    }
+
+    for (auto& cb : callbacks_) {
+      cb.second();
+    }
+
+    callbacks_.clear();
+  }
+
+  inline bool cancelled() const noexcept {
+    return cancelled_.load(std::memory_order_relaxed);
+  }
+
+  // throw if cancelled, so that following work of the query is skipped
+  inline void ensure() const {
+    if (UNLIKELY(cancelled())) {
+      throw NException("Query cancelled");
+    }
+  }
+
+  // listen on cancellation, callback runs right away if it is already cancelled.
+  // callbacks run under the lock so a removed callback never runs after remove returns,
+  // they should be short and never touch this token.
+  size_t listen(Callback cb) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (cancelled_) {
+      cb();
+      return 0;
+    }
+
+    const auto id = ++next_;
+    callbacks_.emplace(id, std::move(cb));
+    return id;
+  }
+
+  void remove(size_t id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    callbacks_.erase(id);
+  }
+
+private:
+  std::atomic<bool> cancelled_;
+  size_t next_;
+  std::unordered_map<size_t, Callback> callbacks_;
+  std::mutex mutex_;
+};
+
+using CancellationPtr = std::shared_ptr<Cancellation>;
+
+// wait for the result of a query, the query is cancelled once the caller abandons it (e.g. its rpc is cancelled).
+// the caller is checked every interval while waiting.
+template <typename T>
+T await(folly::Future<T>&& future,
+        Cancellation& cancellation,
+        const std::function<bool()>& abandoned,
+        std::chrono::milliseconds interval = std::chrono::milliseconds(10)) {
+  if (abandoned) {
+    while (!future.isReady()) {
+      if (abandoned()) {
+        LOG(INFO) << "Query abandoned by its caller, cancelling it";
+        cancellation.cancel();
+        break;
+      }
+
+      future.wait(interval);
+    }
+  }
+
+  return std::move(future).get();
+}
+
+} // namespace common
+} // namespace nebula
@@ -0,0 +1,447 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "Errors.h"
+#include "Likely.h"
+#include "Memory.h"
+
+/**
+ * Mergeable quantile sketches used by percentile aggregations.
+ * Both sketches merge another one in place by const reference and serialize as one contiguous block.
+ *
+ * TDigest: merging t-digest, accurate at tails in rank, size bounded by compression.
+ * DDSketch: log-scaled bins, every quantile is within a relative error of its true value.
+ */
+namespace nebula {
+namespace common {
+
+class TDigest {
+public:
+  struct Centroid {
+    double mean;
+    double weight;
+  };
+
+  explicit TDigest(size_t compression)
+    : compression_{ (double)compression },
+      capacity_{ 5 * compression },
+      count_{ 0 },
+      min_{ std::numeric_limits<double>::max() },
+      max_{ std::numeric_limits<double>::lowest() } {}
+  virtual ~TDigest() = default;
+
+  // values are buffered and compressed in batches
+  inline void add(double v, double weight = 1) {
+    buffer_.push_back({ v, weight });
+    count_ += weight;
+    min_ = std::min(min_, v);
+    max_ = std::max(max_, v);
+    if (UNLIKELY(buffer_.size() >= capacity_)) {
+      compress();
+    }
+  }
+
+  // merge another digest without copying it, its centroids go through the same buffer
+  void merge(const TDigest& other) {
+    if (other.count_ == 0) {
+      return;
+    }
+
+    for (const auto* source : { &other.centroids_, &other.buffer_ }) {
+      buffer_.insert(buffer_.end(), source->begin(), source->end());
+    }
+
+    count_ += other.count_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+    if (buffer_.size() >= capacity_) {
+      compress();
+    }
+  }
+
+  // estimate value at quantile q in [0, 1] by interpolating between centroid centers
+  double quantile(double q) {
+    compress();
+    if (centroids_.empty()) {
+      return 0;
+    }
+
+    const auto rank = std::clamp(q, 0.0, 1.0) * count_;
+    const auto& first = centroids_.front();
+    if (rank <= first.weight / 2) {
+      return min_ + (first.mean - min_) * rank / (first.weight / 2);
+    }
+
+    double center = first.weight / 2;
+    for (size_t i = 1; i < centroids_.size(); ++i) {
+      const auto& left = centroids_[i - 1];
+      const auto& right = centroids_[i];
+      const auto next = center + (left.weight + right.weight) / 2;
+      if (rank < next) {
+        return left.mean + (right.mean - left.mean) * (rank - center) / (next - center);
+      }
+      center = next;
+    }
+
+    const auto& last = centroids_.back();
+    const auto tail = count_ - center;
+    return tail > 0 ? last.mean + (max_ - last.mean) * (rank - center) / tail : last.mean;
+  }
+
+  // visit every weighted point of the digest
+  template <typename F>
+  void forEach(F&& f) const {
+    for (const auto* source : { &centroids_, &buffer_ }) {
+      for (const auto& c : *source) {
+        f(c.mean, c.weight);
+      }
+    }
+  }
+
+  inline double count() const {
+    return count_;
+  }
+
+  inline double min() const {
+    return min_;
+  }
+
+  inline double max() const {
+    return max_;
+  }
+
+  // layout: [compression][count][min][max][N][N centroids]
+  size_t serialize(ExtendableSlice& slice, size_t offset) {
+    compress();
+    const auto origin = offset;
+    offset += slice.write(offset, compression_);
+    offset += slice.write(offset, count_);
+    offset += slice.write(offset, min_);
+    offset += slice.write(offset, max_);
+    offset += slice.write(offset, centroids_.size());
+    offset += slice.write(offset, (const char*)centroids_.data(), centroids_.size() * sizeof(Centroid));
+    return offset - origin;
+  }
+
+  size_t load(ExtendableSlice& slice, size_t offset) {
+    const auto origin = offset;
+#define READ(T, NAME)             \
+  NAME = slice.read<T>(offset); \
+  offset += sizeof(T);
+
+    READ(double, compression_)
+    READ(double, count_)
+    READ(double, min_)
+    READ(double, max_)
+    size_t size;
+    READ(size_t, size)
+#undef READ
+
+    capacity_ = 5 * (size_t)compression_;
+    auto bytes = slice.read(offset, size * sizeof(Centroid));
+    centroids_.resize(size);
+    std::memcpy(centroids_.data(), bytes.data(), bytes.size());
+    buffer_.clear();
+    return offset + bytes.size() - origin;
+  }
+
+private:
+  // sort buffered points with existing centroids and merge neighbors while the size bound allows
+  void compress() {
+    if (buffer_.empty()) {
+      return;
+    }
+
+    buffer_.insert(buffer_.end(), centroids_.begin(), centroids_.end());
+    std::sort(buffer_.begin(), buffer_.end(), [](const Centroid& a, const Centroid& b) {
+      return a.mean < b.mean;
+    });
+
+    // k1 scale function: a centroid spans at most 1 in k(q) = compression / (2 * pi) * asin(2q - 1),
+    // so there are about compression / 2 centroids and those at both tails stay small for accurate tail quantiles
+    centroids_.clear();
+    const auto k = [this](double q) {
+      return compression_ / (2 * M_PI) * std::asin(std::clamp(2 * q - 1, -1.0, 1.0));
+    };
+
+    double sofar = 0;
+    auto left = k(0);
+    auto current = buffer_.front();
+    for (size_t i = 1; i < buffer_.size(); ++i) {
+      const auto& next = buffer_[i];
+      const auto proposed = current.weight + next.weight;
+      if (k((sofar + proposed) / count_) - left <= 1) {
+        current.mean += (next.mean - current.mean) * next.weight / proposed;
+        current.weight = proposed;
+        continue;
+      }
+
+      sofar += current.weight;
+      left = k(sofar / count_);
+      centroids_.push_back(current);
+      current = next;
+    }
+
+    centroids_.push_back(current);
+
+    // buffer keeps its capacity for next batch
+    buffer_.clear();
+  }
+
+private:
+  double compression_;
+  size_t capacity_;
+  double count_;
+  double min_;
+  double max_;
+  std::vector<Centroid> centroids_;
+  std::vector<Centroid> buffer_;
+};
+
+class DDSketch {
+  // values smaller than this in magnitude are counted as zeros
+  static constexpr double MIN_VALUE = 1e-9;
+
+  // contiguous bins starting from index offset, bins are collapsed when exceeding max bins
+  struct Bins {
+    int32_t offset = 0;
+    std::vector<double> counts;
+
+    inline void add(int32_t index, double count, size_t maxBins) {
+      if (counts.empty()) {
+        offset = index;
+        counts.push_back(count);
+        return;
+      }
+
+      if (index < offset) {
+        counts.insert(counts.begin(), offset - index, 0);
+        offset = index;
+      } else if (index >= offset + (int32_t)counts.size()) {
+        counts.resize(index - offset + 1, 0);
+      }
+
+      counts[index - offset] += count;
+
+      // collapse lowest bins into one, they are the least significant values for relative error
+      if (UNLIKELY(counts.size() > maxBins)) {
+        const auto extra = counts.size() - maxBins;
+        for (size_t i = 0; i < extra; ++i) {
+          counts[extra] += counts[i];
+        }
+        counts.erase(counts.begin(), counts.begin() + extra);
+        offset += extra;
+      }
+    }
+
+    size_t serialize(ExtendableSlice& slice, size_t offset) const {
+      const auto origin = offset;
+      offset += slice.write(offset, this->offset);
+      offset += slice.write(offset, counts.size());
+      offset += slice.write(offset, (const char*)counts.data(), counts.size() * sizeof(double));
+      return offset - origin;
+    }
+
+    size_t load(ExtendableSlice& slice, size_t offset) {
+      const auto origin = offset;
+      this->offset = slice.read<int32_t>(offset);
+      offset += sizeof(int32_t);
+      const auto size = slice.read<size_t>(offset);
+      offset += sizeof(size_t);
+      auto bytes = slice.read(offset, size * sizeof(double));
+      counts.resize(size);
+      std::memcpy(counts.data(), bytes.data(), bytes.size());
+      return offset + bytes.size() - origin;
+    }
+  };
+
+public:
+  // relative accuracy alpha, e.g. 0.01 means estimated values are within 1% of true values
+  explicit DDSketch(double alpha, size_t maxBins = 2048)
+    : alpha_{ alpha },
+      maxBins_{ maxBins },
+      zeros_{ 0 },
+      count_{ 0 },
+      min_{ std::numeric_limits<double>::max() },
+      max_{ std::numeric_limits<double>::lowest() } {
+    N_ENSURE(alpha > 0 && alpha < 1, "relative accuracy should be in (0, 1)");
+    gamma_ = (1 + alpha) / (1 - alpha);
+    logGamma_ = std::log(gamma_);
+  }
+  virtual ~DDSketch() = default;
+
+  inline void add(double v, double weight = 1) {
+    if (v > MIN_VALUE) {
+      positives_.add(index(v), weight, maxBins_);
+    } else if (v < -MIN_VALUE) {
+      negatives_.add(index(-v), weight, maxBins_);
+    } else {
+      zeros_ += weight;
+    }
+
+    count_ += weight;
+    min_ = std::min(min_, v);
+    max_ = std::max(max_, v);
+  }
+
+  // merge another sketch in place, bins are aligned when both have the same accuracy
+  void merge(const DDSketch& other) {
+    if (other.count_ == 0) {
+      return;
+    }
+
+    if (other.gamma_ != gamma_) {
+      other.forEach([this](double v, double w) { add(v, w); });
+      return;
+    }
+
+    for (auto [to, from] : { std::make_pair(&positives_, &other.positives_),
+                             std::make_pair(&negatives_, &other.negatives_) }) {
+      for (size_t i = 0; i < from->counts.size(); ++i) {
+        if (from->counts[i] > 0) {
+          to->add(from->offset + (int32_t)i, from->counts[i], maxBins_);
+        }
+      }
+    }
+
+    zeros_ += other.zeros_;
+    count_ += other.count_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+  }
+
+  // estimate value at quantile q in [0, 1]
+  double quantile(double q) const {
+    if (count_ == 0) {
+      return 0;
+    }
+
+    const auto rank = std::clamp(q, 0.0, 1.0) * (count_ - 1);
+    double sofar = 0;
+
+    // negative values from the largest magnitude
+    for (size_t i = negatives_.counts.size(); i > 0; --i) {
+      sofar += negatives_.counts[i - 1];
+      if (sofar > rank) {
+        return std::clamp(-value(negatives_.offset + (int32_t)i - 1), min_, max_);
+      }
+    }
+
+    sofar += zeros_;
+    if (sofar > rank) {
+      return 0;
+    }
+
+    for (size_t i = 0; i < positives_.counts.size(); ++i) {
+      sofar += positives_.counts[i];
+      if (sofar > rank) {
+        return std::clamp(value(positives_.offset + (int32_t)i), min_, max_);
+      }
+    }
+
+    return max_;
+  }
+
+  // visit every bin as a weighted point
+  template <typename F>
+  void forEach(F&& f) const {
+    for (size_t i = 0; i < negatives_.counts.size(); ++i) {
+      if (negatives_.counts[i] > 0) {
+        f(-value(negatives_.offset + (int32_t)i), negatives_.counts[i]);
+      }
+    }
+
+    if (zeros_ > 0) {
+      f(0, zeros_);
+    }
+
+    for (size_t i = 0; i < positives_.counts.size(); ++i) {
+      if (positives_.counts[i] > 0) {
+        f(value(positives_.offset + (int32_t)i), positives_.counts[i]);
+      }
+    }
+  }
+
+  inline double count() const {
+    return count_;
+  }
+
+  // layout: [alpha][zeros][count][min][max][positive bins][negative bins]
+  size_t serialize(ExtendableSlice& slice, size_t offset) const {
+    const auto origin = offset;
+    offset += slice.write(offset, alpha_);
+    offset += slice.write(offset, zeros_);
+    offset += slice.write(offset, count_);
+    offset += slice.write(offset, min_);
+    offset += slice.write(offset, max_);
+    offset += positives_.serialize(slice, offset);
+    offset += negatives_.serialize(slice, offset);
+    return offset - origin;
+  }
+
+  size_t load(ExtendableSlice& slice, size_t offset) {
+    const auto origin = offset;
+#define READ(NAME)                     \
+  NAME = slice.read<double>(offset); \
+  offset += sizeof(double);
+
+    READ(alpha_)
+    READ(zeros_)
+    READ(count_)
+    READ(min_)
+    READ(max_)
+#undef READ
+
+    gamma_ = (1 + alpha_) / (1 - alpha_);
+    logGamma_ = std::log(gamma_);
+    offset += positives_.load(slice, offset);
+    offset += negatives_.load(slice, offset);
+    return offset - origin;
+  }
+
+private:
+  inline int32_t index(double v) const {
+    return (int32_t)std::ceil(std::log(v) / logGamma_);
+  }
+
+  // representative value of a bin, its relative error to any value in the bin is at most alpha
+  inline double value(int32_t index) const {
+    return 2 * std::pow(gamma_, index) / (gamma_ + 1);
+  }
+
+private:
+  double alpha_;
+  size_t maxBins_;
+  double gamma_;
+  double logGamma_;
+  double zeros_;
+  double count_;
+  double min_;
+  double max_;
+  Bins positives_;
+  Bins negatives_;
+};
+
+} // namespace common
+} // namespace nebula
@@ -21,6 +21,7 @@
 #include <valarray>
 #include <xxh3.h>
 
+#include "common/Cancellation.h"
 #include "common/Chars.h"
 #include "common/Errors.h"
 #include "common/Evidence.h"
@@ -701,6 +702,40 @@ TEST(CommonTest, TestConstructDestructOrder) {
   s = nullptr;
   LOG(INFO) << "destructor already called";
 }
+
+TEST(CommonTest, TestCancellation) {
+  Cancellation cancellation;
+  EXPECT_FALSE(cancellation.cancelled());
+  EXPECT_NO_THROW(cancellation.ensure());
+
+  // removed callback never runs, others run once
+  auto calls = 0;
+  auto removed = cancellation.listen([&calls]() { calls += 10; });
+  cancellation.listen([&calls]() { calls += 1; });
+  cancellation.remove(removed);
+  cancellation.cancel();
+  cancellation.cancel();
+  EXPECT_EQ(calls, 1);
+  EXPECT_TRUE(cancellation.cancelled());
+  EXPECT_THROW(cancellation.ensure(), NebulaException);
+
+  // listening on a cancelled token runs right away
+  cancellation.listen([&calls]() { calls += 1; });
+  EXPECT_EQ(calls, 2);
+
+  // a ready result is returned without asking its caller
+  Cancellation done;
+  EXPECT_EQ(await(folly::makeFuture(3), done, []() { return true; }), 3);
+  EXPECT_FALSE(done.cancelled());
+
+  // an abandoned wait cancels its query, the query then fails as cancelled and the failure is reported
+  Cancellation waited;
+  folly::Promise<int> pending;
+  waited.listen([&pending]() { pending.setException(NException("Query cancelled")); });
+  EXPECT_THROW(await(pending.getFuture(), waited, []() { return true; }), NebulaException);
+  EXPECT_TRUE(waited.cancelled());
+}
+
 } // namespace test
 } // namespace common
 } // namespace nebula
\ No newline at end of file
@@ -20,9 +20,12 @@
 #include <folly/stats/TDigest.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
+#include <numeric>
+#include <random>
 #include <sstream>
 
 #include "common/Evidence.h"
+#include "common/Quantile.h"
 
 /**
  * Test all stats algorithms provided by folly/stats package
@@ -185,6 +188,63 @@ TEST(StatsTest, TestTDigest) {
   }
 }
 
+TEST(StatsTest, TestQuantileSketches) {
+  // shuffled values from 1 to N split into 4 parts, each part goes to a different sketch
+  constexpr auto N = 100000;
+  std::vector<double> values(N);
+  std::iota(values.begin(), values.end(), 1);
+  std::shuffle(values.begin(), values.end(), std::mt19937(Evidence::unix_timestamp()));
+
+  std::vector<TDigest> digests(4, TDigest(100));
+  std::vector<DDSketch> sketches(4, DDSketch(0.01));
+  for (size_t i = 0; i < values.size(); ++i) {
+    digests[i % 4].add(values[i]);
+    sketches[i % 4].add(values[i]);
+  }
+
+  // merge all of them into the first one in place
+  for (size_t i = 1; i < 4; ++i) {
+    digests[0].merge(digests[i]);
+    sketches[0].merge(sketches[i]);
+  }
+
+  auto& digest = digests[0];
+  auto& sketch = sketches[0];
+  EXPECT_EQ(digest.count(), N);
+  EXPECT_EQ(sketch.count(), N);
+  EXPECT_EQ(digest.min(), 1);
+  EXPECT_EQ(digest.max(), N);
+
+  // tdigest has small rank error especially at tails, ddsketch has bounded relative error
+  for (auto q : { 0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99, 0.999 }) {
+    const auto expected = q * N;
+    EXPECT_NEAR(digest.quantile(q), expected, N * 0.005) << "q=" << q;
+    EXPECT_NEAR(sketch.quantile(q), expected, expected * 0.01) << "q=" << q;
+  }
+
+  // serialize each one as a single block and load back
+  ExtendableSlice slice(1024);
+  auto size1 = digest.serialize(slice, 0);
+  auto size2 = sketch.serialize(slice, size1);
+  TDigest digest2(100);
+  DDSketch sketch2(0.05);
+  EXPECT_EQ(digest2.load(slice, 0), size1);
+  EXPECT_EQ(sketch2.load(slice, size1), size2);
+  for (auto q : { 0.01, 0.5, 0.99 }) {
+    EXPECT_EQ(digest2.quantile(q), digest.quantile(q));
+    EXPECT_EQ(sketch2.quantile(q), sketch.quantile(q));
+  }
+
+  // ddsketch handles negative values and zeros
+  DDSketch signs(0.01);
+  for (auto i = -1000; i <= 1000; ++i) {
+    signs.add(i);
+  }
+  EXPECT_NEAR(signs.quantile(0.1), -800, 8);
+  EXPECT_EQ(signs.quantile(0.5), 0);
+  EXPECT_NEAR(signs.quantile(0.9), 800, 8);
+}
+
 } // namespace test
 } // namespace common
 } // namespace nebula
\ No newline at end of file
@@ -0,0 +1,110 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "BlockCache.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <vector>
+
+DEFINE_uint64(BLOCK_CACHE_MB, 512, "memory budget in MB of cached partial results of blocks on a node, 0 to disable");
+
+/**
+ * Cache partial results of blocks on a node.
+ */
+namespace nebula {
+namespace execution {
+
+BlockCache& BlockCache::singleton() {
+  // never destroyed, blocks released at exit still evict from it
+  static auto cache = new BlockCache(FLAGS_BLOCK_CACHE_MB << 20);
+  return *cache;
+}
+
+std::shared_ptr<const std::string> BlockCache::get(size_t block, size_t fingerprint) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto b = index_.find(block);
+  if (b == index_.end()) {
+    return nullptr;
+  }
+
+  auto found = b->second.find(fingerprint);
+  if (found == b->second.end()) {
+    return nullptr;
+  }
+
+  auto it = found->second;
+  entries_.splice(entries_.begin(), entries_, it);
+  return it->data;
+}
+
+void BlockCache::put(size_t block, size_t fingerprint, std::shared_ptr<const std::string> data) {
+  const auto size = data->size();
+  if (size > capacity_) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& results = index_[block];
+  auto found = results.find(fingerprint);
+  if (found != results.end()) {
+    erase(found->second);
+  }
+
+  entries_.push_front(Entry{ block, fingerprint, std::move(data) });
+  index_[block][fingerprint] = entries_.begin();
+  bytes_ += size;
+
+  while (bytes_ > capacity_) {
+    VLOG(1) << "Evict cached result of block: " << entries_.back().block;
+    erase(std::prev(entries_.end()));
+  }
+}
+
+size_t BlockCache::evict(size_t block) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto b = index_.find(block);
+  if (b == index_.end()) {
+    return 0;
+  }
+
+  // erase entries before the index of the block which they are found by
+  std::vector<Entries::iterator> its;
+  its.reserve(b->second.size());
+  for (auto& r : b->second) {
+    its.push_back(r.second);
+  }
+
+  for (auto it : its) {
+    erase(it);
+  }
+
+  return its.size();
+}
+
+void BlockCache::erase(Entries::iterator it) {
+  bytes_ -= it->data->size();
+  auto b = index_.find(it->block);
+  b->second.erase(it->fingerprint);
+  if (b->second.empty()) {
+    index_.erase(b);
+  }
+
+  entries_.erase(it);
+}
+
+} // namespace execution
+} // namespace nebula
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * Cache partial results of blocks on a node.
+ * A block never changes once it is loaded, so its partial result of a computation is reusable
+ * by any later query of the same computation until the block is removed or expired.
+ */
+namespace nebula {
+namespace execution {
+
+class BlockCache {
+public:
+  // capacity from flag BLOCK_CACHE_MB
+  static BlockCache& singleton();
+
+  // serialized partial results of at most given bytes in total, least recently used ones are evicted first
+  explicit BlockCache(size_t capacity) : capacity_{ capacity }, bytes_{ 0 } {}
+  BlockCache(BlockCache&) = delete;
+  BlockCache(BlockCache&&) = delete;
+  virtual ~BlockCache() = default;
+
+public:
+  // partial result of a block (by its batch id) computed by given fingerprint, nullptr if not cached
+  std::shared_ptr<const std::string> get(size_t, size_t);
+
+  // cache partial result of a block computed by given fingerprint
+  void put(size_t, size_t, std::shared_ptr<const std::string>);
+
+  // drop all partial results of a block, return number of results dropped
+  size_t evict(size_t);
+
+  inline size_t capacity() const {
+    return capacity_;
+  }
+
+  inline size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+  }
+
+  inline size_t bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+  }
+
+private:
+  struct Entry {
+    size_t block;
+    size_t fingerprint;
+    std::shared_ptr<const std::string> data;
+  };
+
+  using Entries = std::list<Entry>;
+
+  void erase(Entries::iterator);
+
+private:
+  const size_t capacity_;
+  size_t bytes_;
+  // most recently used entry is at front
+  Entries entries_;
+  // entries of every block by fingerprint
+  std::unordered_map<size_t, std::unordered_map<size_t, Entries::iterator>> index_;
+  mutable std::mutex mutex_;
+};
+
+} // namespace execution
+} // namespace nebula
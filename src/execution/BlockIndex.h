@@ -0,0 +1,121 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+#include "ExecutionPlan.h"
+#include "io/BlockLoader.h"
+
+/**
+ * Index blocks of a block set by table and time, and by block id.
+ * Blocks of a table are sorted by their start time, with the longest time span of them.
+ * A block overlapping window [s, e] starts in [s - span, e], so finding blocks of a query window
+ * takes O(log n + k) rather than visiting all blocks of all tables.
+ * The index refers to blocks owned by the block set, a block has to be removed from the index first.
+ */
+namespace nebula {
+namespace execution {
+
+class BlockIndex {
+  struct TableBlocks {
+    std::multimap<size_t, const io::BatchBlock*> starts;
+    // longest time span of all blocks ever added, it doesn't shrink when blocks are removed
+    size_t span = 0;
+  };
+
+public:
+  BlockIndex() = default;
+  virtual ~BlockIndex() = default;
+
+public:
+  inline void add(const io::BatchBlock& block) {
+    auto& tb = tables_[block.getTable()];
+    tb.starts.emplace(block.start(), &block);
+    tb.span = std::max(tb.span, block.end() > block.start() ? block.end() - block.start() : 0);
+    ids_[block.signature().toString()] = &block;
+  }
+
+  inline void remove(const io::BatchBlock& block) {
+    ids_.erase(block.signature().toString());
+    auto t = tables_.find(block.getTable());
+    if (t == tables_.end()) {
+      return;
+    }
+
+    auto& starts = t->second.starts;
+    auto range = starts.equal_range(block.start());
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second == &block) {
+        starts.erase(it);
+        break;
+      }
+    }
+
+    if (starts.empty()) {
+      tables_.erase(t);
+    }
+  }
+
+  inline void clear() {
+    tables_.clear();
+    ids_.clear();
+  }
+
+  // block of given id (signature string), nullptr if not found
+  inline const io::BatchBlock* find(const std::string& id) const {
+    auto it = ids_.find(id);
+    return it == ids_.end() ? nullptr : it->second;
+  }
+
+  inline bool has(const std::string& table) const {
+    return tables_.find(table) != tables_.end();
+  }
+
+  // number of blocks of a table
+  inline size_t count(const std::string& table) const {
+    auto t = tables_.find(table);
+    return t == tables_.end() ? 0 : t->second.starts.size();
+  }
+
+  // visit every block of a table overlapping the window
+  template <typename F>
+  void visit(const std::string& table, const QueryWindow& window, F&& f) const {
+    auto t = tables_.find(table);
+    if (t == tables_.end()) {
+      return;
+    }
+
+    const auto& tb = t->second;
+    const auto from = window.first > tb.span ? window.first - tb.span : 0;
+    for (auto it = tb.starts.lower_bound(from), end = tb.starts.upper_bound(window.second); it != end; ++it) {
+      if (it->second->overlap(window)) {
+        f(*it->second);
+      }
+    }
+  }
+
+private:
+  std::unordered_map<std::string, TableBlocks> tables_;
+  std::unordered_map<std::string, const io::BatchBlock*> ids_;
+};
+
+} // namespace execution
+} // namespace nebula
@@ -15,6 +15,8 @@
  */
 
 #include "BlockManager.h"
+#include "BlockCache.h"
+#include "FilterCache.h"
 #include <regex>
 #include "common/Folly.h"
 #include "type/Tree.h"
@@ -50,6 +52,152 @@ std::shared_ptr<BlockManager> BlockManager::init() {
   return inst;
 }
 
+IndexedBlocks::IndexedBlocks(BlockSet blocks) : size_{ blocks.size() } {
+  std::unordered_map<std::string, BlockSet> tables;
+  for (auto& b : blocks) {
+    tables[b.getTable()].insert(b);
+  }
+
+  for (auto& t : tables) {
+    tables_[t.first].push_back(std::make_shared<BlockRun>(std::move(t.second)));
+  }
+}
+
+std::shared_ptr<const IndexedBlocks> IndexedBlocks::add(std::vector<BatchBlock> blocks) const {
+  // new blocks by table, skip the ones already in
+  std::unordered_map<std::string, BlockSet> added;
+  for (auto& b : blocks) {
+    if (find(b.signature().toString()) == nullptr) {
+      added[b.getTable()].insert(std::move(b));
+    }
+  }
+
+  auto next = std::make_shared<IndexedBlocks>(*this);
+  for (auto& t : added) {
+    next->size_ += t.second.size();
+    auto& runs = next->tables_[t.first];
+    auto fresh = std::move(t.second);
+
+    // merge into previous runs not much larger, so runs of a table grow geometrically
+    while (!runs.empty() && runs.back()->blocks().size() <= 2 * fresh.size()) {
+      const auto& last = runs.back()->blocks();
+      fresh.insert(last.begin(), last.end());
+      runs.pop_back();
+    }
+
+    runs.push_back(std::make_shared<BlockRun>(std::move(fresh)));
+  }
+
+  return next;
+}
+
+std::shared_ptr<const IndexedBlocks> IndexedBlocks::remove(
+  const std::function<bool(const BatchBlock&)>& match, std::vector<BatchBlock>& removed) const {
+  auto next = std::make_shared<IndexedBlocks>(*this);
+  for (auto t = next->tables_.begin(); t != next->tables_.end();) {
+    auto& runs = t->second;
+    for (auto r = runs.begin(); r != runs.end();) {
+      // a run is rebuilt only if it has a block to remove
+      BlockSet keep;
+      const auto& blocks = (*r)->blocks();
+      const auto before = removed.size();
+      for (const auto& b : blocks) {
+        if (match(b)) {
+          removed.push_back(b);
+        } else {
+          keep.insert(b);
+        }
+      }
+
+      if (removed.size() == before) {
+        ++r;
+        continue;
+      }
+
+      next->size_ -= removed.size() - before;
+      if (keep.empty()) {
+        r = runs.erase(r);
+        continue;
+      }
+
+      *r = std::make_shared<BlockRun>(std::move(keep));
+      ++r;
+    }
+
+    if (runs.empty()) {
+      t = next->tables_.erase(t);
+      continue;
+    }
+
+    ++t;
+  }
+
+  return next;
+}
+
+std::shared_ptr<const IndexedBlocks> IndexedBlocks::remove(const std::string& id, std::vector<BatchBlock>& removed) const {
+  for (const auto& t : tables_) {
+    for (size_t i = 0; i < t.second.size(); ++i) {
+      const auto block = t.second.at(i)->index().find(id);
+      if (block == nullptr) {
+        continue;
+      }
+
+      // rebuild the only run having the block
+      auto next = std::make_shared<IndexedBlocks>(*this);
+      auto& runs = next->tables_.at(t.first);
+      auto keep = runs.at(i)->blocks();
+      removed.push_back(*block);
+      keep.erase(*block);
+      next->size_ -= 1;
+      if (!keep.empty()) {
+        runs[i] = std::make_shared<BlockRun>(std::move(keep));
+      } else if (runs.size() > 1) {
+        runs.erase(runs.begin() + i);
+      } else {
+        next->tables_.erase(t.first);
+      }
+
+      return next;
+    }
+  }
+
+  return nullptr;
+}
+
+const BatchBlock* IndexedBlocks::find(const std::string& id) const {
+  for (const auto& t : tables_) {
+    for (const auto& run : t.second) {
+      if (auto block = run->index().find(id)) {
+        return block;
+      }
+    }
+  }
+
+  return nullptr;
+}
+
+size_t IndexedBlocks::count(const std::string& table) const {
+  auto t = tables_.find(table);
+  if (t == tables_.end()) {
+    return 0;
+  }
+
+  size_t count = 0;
+  for (const auto& run : t->second) {
+    count += run->blocks().size();
+  }
+
+  return count;
+}
+
+BlockSet IndexedBlocks::blocks() const {
+  BlockSet blocks;
+  blocks.reserve(size_);
+  each([&blocks](const BatchBlock& b) { blocks.insert(b); });
+  return blocks;
+}
+
 void BlockManager::collectBlockMetrics(const io::BatchBlock& meta, TableStates& states) {
   const auto& table = meta.getTable();
   if (states.find(table) == states.end()) {
@@ -78,28 +226,19 @@ std::pair<std::string, std::string> hackColEqValue(std::string_view input) {
   return { "", "" };
 }
 
-bool BlockManager::tableInBlockSet(const std::string& table, const BlockSet& bs) {
-  for (auto& b : bs) {
-    if (table == b.getTable()) {
-      return true;
-    }
-  }
-
-  return false;
-}
-
 // query all nodes that hold data for given table
 const std::vector<NNode> BlockManager::query(const std::string& table) {
+  const auto s = snapshot();
   std::vector<NNode> nodes;
 
   // all blocks in proc
-  if (tableInBlockSet(table, blocks_)) {
+  if (s->blocks->has(table)) {
     nodes.push_back(NNode::inproc());
   }
 
   // go through all nodes's block set
-  for (auto n = remotes_.begin(); n != remotes_.end(); ++n) {
-    if (tableInBlockSet(table, n->second)) {
+  for (auto n = s->remotes.begin(); n != s->remotes.end(); ++n) {
+    if (n->second->has(table)) {
       nodes.push_back(n->first);
     }
   }
@@ -107,8 +246,36 @@ const std::vector<NNode> BlockManager::query(const std::string& table) {
   return nodes;
 }
 
+size_t BlockManager::estimate(const std::string& table, const QueryWindow& window) const {
+  const auto s = snapshot();
+  size_t blocks = 0;
+  const auto count = [&blocks](const BatchBlock&) { ++blocks; };
+  s->blocks->visit(table, window, count);
+  for (const auto& node : s->remotes) {
+    node.second->visit(table, window, count);
+  }
+
+  return blocks;
+}
+
+size_t BlockManager::version(const std::string& table, const QueryWindow& window) const {
+  const auto s = snapshot();
+  // blocks are combined regardless their order, every block is mixed with its rows
+  size_t version = 0;
+  const auto combine = [&version](const BatchBlock& b) {
+    version += (b.hash() ^ (b.state().numRows * 0x9E3779B97F4A7C15UL)) * 0xC6A4A7935BD1E995UL;
+  };
+
+  s->blocks->visit(table, window, combine);
+  for (const auto& node : s->remotes) {
+    node.second->visit(table, window, combine);
+  }
+
+  return version;
+}
+
 static constexpr auto BATCH_SIZE = 100;
-folly::Future<FilteredBlocks> batch(folly::ThreadPoolExecutor& pool,
+folly::Future<FilteredBlocks> batch(folly::Executor& pool,
                                     const nebula::surface::eval::ValueEval& filter,
                                     std::array<Batch*, BATCH_SIZE> input,
                                     size_t size) {
@@ -133,11 +300,15 @@ folly::Future<FilteredBlocks> batch(folly::ThreadPoolExecutor& pool,
   return p->getFuture();
 }
 
-const FilteredBlocks BlockManager::query(const Table& table, const ExecutionPlan& plan, folly::ThreadPoolExecutor& pool) {
+folly::Future<FilteredBlocks> BlockManager::query(const Table& table, const ExecutionPlan& plan, folly::Executor& pool) {
   // 1. a table and a predicate should determined by meta service how many blocks we should query
   // 2. determine how many blocks are not in memory yet, if they are not, load them in
   // 3. fan out the query plan to execute on each block in parallel (not this function but the caller)
-  auto total = 0;
+  // the plan pins the snapshot, so its blocks stay in memory until the plan is done even if they are removed
+  const auto s = snapshot();
+  plan.pin(s);
+  const auto& index = *s->blocks;
+  const auto total = index.count(table.name());
   const auto& window = plan.getWindow();
 
   // check if there are some predicates we can evaluate here
@@ -147,43 +318,41 @@ const FilteredBlocks BlockManager::query(const Table& table, const ExecutionPlan
   std::vector<folly::Future<FilteredBlocks>> futures;
   futures.reserve(1024);
 
-  auto index = 0;
-  for (auto& b : blocks_) {
-    if (b.getTable() == table.name()) {
-      ++total;
-      if (b.overlap(window)) {
-        list[index++] = b.data().get();
-
-        if (index == BATCH_SIZE) {
-          futures.push_back(batch(pool, filter, list, index));
-          index = 0;
-        }
-      }
+  // only blocks of the table overlapping the window are visited
+  size_t size = 0;
+  index.visit(table.name(), window, [&](const BatchBlock& b) {
+    list[size++] = b.data().get();
+    if (size == BATCH_SIZE) {
+      futures.push_back(batch(pool, filter, list, size));
+      size = 0;
     }
-  }
+  });
 
-  if (index > 0) {
-    futures.push_back(batch(pool, filter, list, index));
+  if (size > 0) {
+    futures.push_back(batch(pool, filter, list, size));
   }
 
-  // collect futures
-  FilteredBlocks tableBlocks;
-  tableBlocks.reserve(total);
-  auto x = folly::collectAll(futures).get();
-  for (auto it = x.begin(); it < x.end(); ++it) {
-    // if the result is empty
-    if (!it->hasValue()) {
-      continue;
-    }
+  // collect futures as a continuation, the calling thread never waits for the batches
+  return folly::collectAll(futures)
+    .via(&pool)
+    .thenValue([total, name = table.name(), window](std::vector<folly::Try<FilteredBlocks>> x) {
+      FilteredBlocks tableBlocks;
+      tableBlocks.reserve(total);
+      for (auto it = x.begin(); it < x.end(); ++it) {
+        // if the result is empty
+        if (!it->hasValue()) {
+          continue;
+        }
 
-    for (auto& item : it->value()) {
-      tableBlocks.push_back(item);
-    }
-  }
+        for (auto& item : it->value()) {
+          tableBlocks.push_back(item);
+        }
+      }
 
-  LOG(INFO) << fmt::format("Fetch blcoks {0} / {1} for table {2} in window [{3}, {4}]. ",
-                           tableBlocks.size(), total, table.name(), window.first, window.second);
-  return tableBlocks;
+      LOG(INFO) << fmt::format("Fetch blcoks {0} / {1} for table {2} in window [{3}, {4}]. ",
+                               tableBlocks.size(), total, name, window.first, window.second);
+      return tableBlocks;
+    });
 }
 
 bool BlockManager::add(const BlockSignature& sign) {
@@ -193,33 +362,70 @@ bool BlockManager::add(const BlockSignature& sign) {
   return this->add(block);
 }
 
-bool BlockManager::add(const BatchBlock& block) {
-  // collect metrics anyways.
-  collectBlockMetrics(block, tableStates_);
+void BlockManager::update(const std::function<void(BlockSnapshot&)>& change) {
+  // writers are serialized, readers keep using the snapshot they pinned while a new one is made
+  std::lock_guard<std::mutex> lock(writer_);
+  auto next = std::make_shared<BlockSnapshot>(*snapshot_);
+  next->version += 1;
+  change(*next);
+  std::atomic_store(&snapshot_, BlockSnapshotPtr(std::move(next)));
+}
+
+// snapshots hold in-proc blocks through their own handle of the batch.
+// cached results and filter bitmaps of a block are useless once it's removed, they are evicted
+// when the last snapshot having it is released, so that no query can put them back afterwards.
+static BatchBlock own(const BatchBlock& block) {
+  const auto& batch = block.data();
+  if (batch == nullptr) {
+    return block;
+  }
+
+  std::shared_ptr<Batch> owned(batch.get(), [batch](Batch* b) {
+    BlockCache::singleton().evict(b->getId());
+    FilterCache::singleton().evict(b->getId());
+  });
+
+  return BatchBlock{ block.signature(), std::move(owned), block.state() };
+}
 
+bool BlockManager::add(const BatchBlock& block) {
   const auto& node = block.residence();
-  // ensure the block is not in memory
-  if (node.isInProc()) {
-    blocks_.insert(block);
-  } else {
-
-    // remote blocks
-    N_ENSURE(block.data() == nullptr, "remote block won't have data pointer.");
-
-    auto itr = remotes_.find(node);
-    if (itr != remotes_.end()) {
-      itr->second.insert(block);
-    } else {
-      remotes_[node] = {};
-      remotes_.at(node).insert(block);
+
+  // remote blocks
+  N_ENSURE(node.isInProc() || block.data() == nullptr, "remote block won't have data pointer.");
+
+  update([&block, &node](BlockSnapshot& s) {
+    // collect metrics anyways.
+    collectBlockMetrics(block, s.states);
+
+    // blocks already in are ignored
+    if (node.isInProc()) {
+      if (s.blocks->find(block.signature().toString()) == nullptr) {
+        s.blocks = s.blocks->add({ own(block) });
+      }
+      return;
     }
-  }
+
+    auto& remote = s.remotes[node];
+    remote = remote ? remote->add({ block }) : std::make_shared<IndexedBlocks>(BlockSet{ block });
+  });
 
   return true;
 }
 
 bool BlockManager::add(std::vector<BatchBlock> range) {
-  std::move(range.begin(), range.end(), std::inserter(blocks_, blocks_.begin()));
+  update([&range](BlockSnapshot& s) {
+    std::vector<BatchBlock> blocks;
+    blocks.reserve(range.size());
+    for (const auto& block : range) {
+      if (s.blocks->find(block.signature().toString()) == nullptr) {
+        blocks.push_back(own(block));
+      }
+    }
+
+    s.blocks = s.blocks->add(std::move(blocks));
+  });
+
   return true;
 }
 
@@ -227,76 +433,72 @@ bool BlockManager::remove(const BatchBlock&) {
   throw NException("Not implemeneted yet");
 }
 
-// remove block that share the given ID
-// NOTE: thread-unsafe~!
+// remove block that share the given ID, its memory is released once no query pins a snapshot having it
 size_t BlockManager::removeById(const std::string& id) {
-  //TODO(cao) - perf issue: we should not iterate all
-  // instead, leverage the hash set nature by converting id into a BlockSignature
-  auto itr = blocks_.begin();
-  while (itr != blocks_.end()) {
-    if (itr->signature().toString() == id) {
-      itr = blocks_.erase(itr);
-      return 1;
+  size_t count = 0;
+  update([&id, &count](BlockSnapshot& s) {
+    std::vector<BatchBlock> removed;
+    auto blocks = s.blocks->remove(id, removed);
+    if (blocks == nullptr) {
+      return;
     }
 
-    ++itr;
-  }
+    s.blocks = std::move(blocks);
+    count = 1;
+  });
 
-  return 0;
+  return count;
 }
 
 // swap a new block set for given node
 void BlockManager::set(const NNode& node, BlockSet set) {
-  // just overwrite the existing key
-  remotes_[node] = std::move(set);
+  // index the new set out of the writer lock, then just overwrite the existing key
+  auto blocks = std::make_shared<IndexedBlocks>(std::move(set));
+  update([&node, &blocks](BlockSnapshot& s) {
+    s.remotes[node] = std::move(blocks);
+  });
 }
 
 // remove all blocks that share the given spec
-// NOTE: thread-unsafe~!
 size_t BlockManager::removeSameSpec(const nebula::meta::BlockSignature& bs) {
   size_t count = 0;
-  auto itr = blocks_.begin();
-  while (itr != blocks_.end()) {
-    if (bs.sameSpec(itr->signature())) {
-      itr = blocks_.erase(itr);
-      count++;
-      continue;
+  update([&bs, &count](BlockSnapshot& s) {
+    std::vector<BatchBlock> removed;
+    auto blocks = s.blocks->remove([&bs](const BatchBlock& b) { return bs.sameSpec(b.signature()); }, removed);
+    count = removed.size();
+    if (count > 0) {
+      s.blocks = std::move(blocks);
     }
-
-    ++itr;
-  }
+  });
 
   return count;
 }
 
 void BlockManager::updateTableMetrics() {
-  // remove existing states
-  TableStates states;
-  NodeSpecs specs;
-
-  // go through all blocks and do the aggregation again
-  for (auto i = blocks_.begin(); i != blocks_.end(); ++i) {
-    collectBlockMetrics(*i, states);
-  }
-
-  // go through all nodes's block set
-  for (auto n = remotes_.begin(); n != remotes_.end(); ++n) {
-    std::unordered_set<std::string> specSet;
-    const auto& bs = n->second;
-    for (auto i = bs.begin(); i != bs.end(); ++i) {
-      collectBlockMetrics(*i, states);
-      specSet.emplace(i->spec());
+  update([](BlockSnapshot& s) {
+    // remove existing states
+    TableStates states;
+    NodeSpecs specs;
+
+    // go through all blocks and do the aggregation again
+    s.blocks->each([&states](const BatchBlock& b) { collectBlockMetrics(b, states); });
+
+    // go through all nodes's block set
+    for (auto n = s.remotes.begin(); n != s.remotes.end(); ++n) {
+      std::unordered_set<std::string> specSet;
+      n->second->each([&states, &specSet](const BatchBlock& b) {
+        collectBlockMetrics(b, states);
+        specSet.emplace(b.spec());
+      });
+
+      // set the spec set to the current node
+      specs.emplace(n->first, specSet);
     }
 
-    // set the spec set to the current node
-    specs.emplace(n->first, specSet);
-  }
-
-  // TODO(cao) - update table states_ for those entry changes, otherwise, keep it no change.
-  // do atomic swap?
-  std::swap(states, tableStates_);
-  std::swap(specs, specs_);
+    s.states = std::move(states);
+    s.specs = std::move(specs);
+  });
 }
 
 } // namespace execution
-} // namespace nebula
\ No newline at end of file
+} // namespace nebula
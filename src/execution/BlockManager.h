@@ -16,9 +16,14 @@
 
 #pragma once
 
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <unordered_map>
+#include <vector>
 
+#include "BlockIndex.h"
 #include "ExecutionPlan.h"
 
 #include "common/Folly.h"
@@ -48,11 +53,138 @@ struct Equal {
 
 using BlockSet = std::unordered_set<io::BatchBlock, Hash, Equal>;
 using FilteredBlocks = std::vector<nebula::memory::EvaledBlock>;
+using TableStates = std::unordered_map<std::string, std::tuple<size_t, size_t, size_t, size_t, size_t>>;
+using NodeSpecs = std::unordered_map<nebula::meta::NNode, std::unordered_set<std::string>, nebula::meta::NodeHash, nebula::meta::NodeEqual>;
 
-class BlockManager {
-  using TableStates = std::unordered_map<std::string, std::tuple<size_t, size_t, size_t, size_t, size_t>>;
-  using NodeSpecs = std::unordered_map<nebula::meta::NNode, std::unordered_set<std::string>, nebula::meta::NodeHash, nebula::meta::NodeEqual>;
+// a run of blocks of one table with its index, it never changes once built
+class BlockRun {
+public:
+  explicit BlockRun(BlockSet blocks) : blocks_{ std::move(blocks) } {
+    for (const auto& b : blocks_) {
+      index_.add(b);
+    }
+  }
+  // the index refers to blocks of its own set
+  BlockRun(BlockRun&) = delete;
+  BlockRun(BlockRun&&) = delete;
+  virtual ~BlockRun() = default;
+
+  inline const BlockSet& blocks() const noexcept {
+    return blocks_;
+  }
+
+  inline const BlockIndex& index() const noexcept {
+    return index_;
+  }
+
+private:
+  const BlockSet blocks_;
+  BlockIndex index_;
+};
+
+using BlockRunPtr = std::shared_ptr<const BlockRun>;
+
+// blocks of all tables, it never changes once built.
+// a change makes a new one sharing the runs it doesn't touch, LSM style: new blocks of a table make
+// a new run, which is merged with the previous run unless that one is more than twice its size.
+// so a table of n blocks has O(log n) runs, and a block is re-indexed O(log n) times over all adds.
+// adding k blocks costs O(t + k log n) amortized for t tables, rather than rebuilding all blocks.
+// removing a block rebuilds only the run having it.
+class IndexedBlocks {
+public:
+  IndexedBlocks() = default;
+  explicit IndexedBlocks(BlockSet);
+  virtual ~IndexedBlocks() = default;
+
+  // a new version having given blocks added, blocks already in are ignored
+  std::shared_ptr<const IndexedBlocks> add(std::vector<io::BatchBlock>) const;
+
+  // a new version without blocks matching the predicate, removed blocks are appended to the list
+  std::shared_ptr<const IndexedBlocks> remove(
+    const std::function<bool(const io::BatchBlock&)>&, std::vector<io::BatchBlock>&) const;
+
+  // a new version without the block of given id (signature string), nullptr if not found
+  std::shared_ptr<const IndexedBlocks> remove(const std::string&, std::vector<io::BatchBlock>&) const;
+
+  // block of given id (signature string), nullptr if not found
+  const io::BatchBlock* find(const std::string&) const;
+
+  inline bool has(const std::string& table) const {
+    return tables_.find(table) != tables_.end();
+  }
+
+  // number of blocks of a table
+  size_t count(const std::string&) const;
+
+  // number of all blocks
+  inline size_t size() const noexcept {
+    return size_;
+  }
+
+  // visit every block of a table overlapping the window
+  template <typename F>
+  void visit(const std::string& table, const QueryWindow& window, F&& f) const {
+    auto t = tables_.find(table);
+    if (t == tables_.end()) {
+      return;
+    }
+
+    for (const auto& run : t->second) {
+      run->index().visit(table, window, f);
+    }
+  }
+
+  // visit every block
+  template <typename F>
+  void each(F&& f) const {
+    for (const auto& t : tables_) {
+      for (const auto& run : t.second) {
+        for (const auto& b : run->blocks()) {
+          f(b);
+        }
+      }
+    }
+  }
+
+  // a copy of all blocks
+  BlockSet blocks() const;
+
+private:
+  // runs of every table, the oldest and largest first
+  std::unordered_map<std::string, std::vector<BlockRunPtr>> tables_;
+  size_t size_ = 0;
+};
+
+using IndexedBlocksPtr = std::shared_ptr<const IndexedBlocks>;
+
+// a version of all blocks known to this process, it never changes once published.
+// a change publishes a new version, block sets not changed are shared by both versions.
+struct BlockSnapshot {
+  size_t version = 0;
+
+  // in-proc blocks
+  IndexedBlocksPtr blocks = std::make_shared<IndexedBlocks>();
+
+  // meta data for remote blocks
+  std::unordered_map<nebula::meta::NNode, IndexedBlocksPtr, nebula::meta::NodeHash, nebula::meta::NodeEqual> remotes;
+
+  // table: <block count, row count, raw size, min time, max time>
+  TableStates states;
+
+  // node to spec set (by spec signature) mapping, updated by udpate table metrics
+  NodeSpecs specs;
+};
 
+using BlockSnapshotPtr = std::shared_ptr<const BlockSnapshot>;
+
+/**
+ * Blocks are published as immutable snapshots, RCU style.
+ * Readers pin current snapshot by an atomic load and never wait for writers,
+ * writers (ingestion, expiration, node sync) are serialized to copy current snapshot, change and publish it.
+ * A removed block stays in memory until no pinned snapshot refers to it, a query pins the snapshot in its plan.
+ * Cached results of a removed block are evicted at that point too.
+ */
+class BlockManager {
 public:
   BlockManager(BlockManager&) = delete;
   BlockManager(BlockManager&&) = delete;
@@ -61,11 +193,25 @@ public:
   static std::shared_ptr<BlockManager> init();
 
 public:
-  const FilteredBlocks query(const nebula::meta::Table&, const ExecutionPlan&, folly::ThreadPoolExecutor&);
+  // pin current snapshot of all blocks
+  inline BlockSnapshotPtr snapshot() const {
+    return std::atomic_load(&snapshot_);
+  }
+
+  // filter blocks of a table for the plan in the executor, the plan has to outlive the returned future.
+  // the plan pins the snapshot its blocks come from.
+  folly::Future<FilteredBlocks> query(const nebula::meta::Table&, const ExecutionPlan&, folly::Executor&);
 
   // query all nodes that hold data for given table
   const std::vector<nebula::meta::NNode> query(const std::string&);
 
+  // estimate cost of a query by number of blocks of a table in its window across all nodes
+  size_t estimate(const std::string&, const QueryWindow&) const;
+
+  // version of data of a table in a window across all nodes, it changes once any block in the window
+  // is added, removed or changed in rows. 0 if no block in the window.
+  size_t version(const std::string&, const QueryWindow&) const;
+
   // add a block into the system - the data may be loaded internal
   bool add(const nebula::meta::BlockSignature&);
 
@@ -84,26 +230,32 @@ public:
   void set(const nebula::meta::NNode&, BlockSet);
 
   std::tuple<size_t, size_t, size_t, size_t, size_t> getTableMetrics(const std::string& table) const {
-    if (tableStates_.find(table) == tableStates_.end()) {
+    const auto s = snapshot();
+    auto found = s->states.find(table);
+    if (found == s->states.end()) {
       return { 0, 0, 0, 0, 0 };
     }
 
-    return tableStates_.at(table);
+    return found->second;
   }
 
-  const BlockSet& all(const nebula::meta::NNode& node = nebula::meta::NNode::inproc()) {
+  // a copy of all blocks of given node in current snapshot
+  BlockSet all(const nebula::meta::NNode& node = nebula::meta::NNode::inproc()) const {
+    const auto s = snapshot();
     if (node.isInProc()) {
-      return blocks_;
+      return s->blocks->blocks();
     }
 
     // it may reutrn empty result if the node is not in
-    return remotes_[node];
+    auto found = s->remotes.find(node);
+    return found == s->remotes.end() ? BlockSet{} : found->second->blocks();
   }
 
   std::vector<std::string> getTables(const size_t limit) const noexcept {
+    const auto s = snapshot();
     std::vector<std::string> tables;
     tables.reserve(limit);
-    for (auto& item : tableStates_) {
+    for (auto& item : s->states) {
       tables.push_back(item.first);
       if (tables.size() >= limit) {
         break;
@@ -120,9 +272,10 @@ public:
   size_t removeSameSpec(const nebula::meta::BlockSignature&);
 
   // has spec in node
-  bool hasSpec(const nebula::meta::NNode& node, const std::string& spec) {
-    auto entry = specs_.find(node);
-    if (entry != specs_.end()) {
+  bool hasSpec(const nebula::meta::NNode& node, const std::string& spec) const {
+    const auto s = snapshot();
+    auto entry = s->specs.find(node);
+    if (entry != s->specs.end()) {
       auto& set = entry->second;
       auto item = set.find(spec);
       return item != set.end();
@@ -132,25 +285,19 @@ public:
   }
 
 private:
-  // table: <block count, row count, raw size, min time, max time>
-  TableStates tableStates_;
-
-  // in-proc blocks
-  BlockSet blocks_;
+  // change a copy of current snapshot and publish it, changes are serialized
+  void update(const std::function<void(BlockSnapshot&)>&);
 
-  // meta data for remote blocks
-  std::unordered_map<nebula::meta::NNode, BlockSet, nebula::meta::NodeHash, nebula::meta::NodeEqual> remotes_;
-
-  // node to spec set (by spec signature) mapping, updated by udpate table metrics
-  NodeSpecs specs_;
+private:
+  BlockSnapshotPtr snapshot_;
+  std::mutex writer_;
 
 private:
   static std::mutex smux;
   static std::shared_ptr<BlockManager> inst;
-  BlockManager() {}
+  BlockManager() : snapshot_{ std::make_shared<BlockSnapshot>() } {}
 
   static void collectBlockMetrics(const io::BatchBlock&, TableStates&);
-  static bool tableInBlockSet(const std::string&, const BlockSet&);
 };
 
 } // namespace execution
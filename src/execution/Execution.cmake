@@ -7,15 +7,20 @@ add_library(${NEBULA_EXEC} STATIC
     ${NEBULA_SRC}/execution/core/BlockExecutor.cpp    
     ${NEBULA_SRC}/execution/core/ComputedRow.cpp    
     ${NEBULA_SRC}/execution/core/Finalize.cpp    
+    ${NEBULA_SRC}/execution/core/KeySlots.cpp    
     ${NEBULA_SRC}/execution/core/NodeClient.cpp    
     ${NEBULA_SRC}/execution/core/NodeExecutor.cpp    
+    ${NEBULA_SRC}/execution/core/Scheduler.cpp    
     ${NEBULA_SRC}/execution/core/ServerExecutor.cpp    
+    ${NEBULA_SRC}/execution/core/TopK.cpp    
     ${NEBULA_SRC}/execution/io/BlockLoader.cpp
     ${NEBULA_SRC}/execution/meta/TableService.cpp
     ${NEBULA_SRC}/execution/op/Operator.cpp
     ${NEBULA_SRC}/execution/serde/RowCursorSerde.cpp
+    ${NEBULA_SRC}/execution/BlockCache.cpp
     ${NEBULA_SRC}/execution/BlockManager.cpp
-    ${NEBULA_SRC}/execution/ExecutionPlan.cpp)
+    ${NEBULA_SRC}/execution/ExecutionPlan.cpp
+    ${NEBULA_SRC}/execution/FilterCache.cpp)
 
 target_link_libraries(${NEBULA_EXEC}
     PUBLIC ${NEBULA_COMMON}
@@ -15,9 +15,12 @@
  */
 
 #include "ExecutionPlan.h"
+#include <atomic>
 #include <fmt/format.h>
+#include <random>
 #include <glog/logging.h>
 #include "common/Likely.h"
+#include "surface/eval/UDF.h"
 #include "type/Serde.h"
 
 /**
@@ -29,14 +32,24 @@ namespace execution {
 using nebula::common::Cursor;
 using nebula::meta::NNode;
 using nebula::surface::RowData;
+using nebula::surface::eval::ExpressionType;
+using nebula::surface::eval::UDFType;
+using nebula::surface::eval::UdfTraits;
 using nebula::type::Schema;
 using nebula::type::TypeSerializer;
 
+// plan ids are unique across processes by a random prefix of the process
+static std::string nextId() {
+  static const auto prefix = std::random_device{}();
+  static std::atomic<size_t> id{ 0 };
+  return fmt::format("{0:08x}-{1}", prefix, ++id);
+}
+
 ExecutionPlan::ExecutionPlan(
   std::unique_ptr<ExecutionPhase> plan,
   std::vector<NNode> nodes,
   Schema output)
-  : uuid_{ "<uuid>" },
+  : uuid_{ nextId() },
     plan_{ std::move(plan) },
     nodes_{ std::move(nodes) },
     output_{ output } {}
@@ -83,6 +96,99 @@ const FinalPhase& ExecutionPlan::fetch<PhaseType::GLOBAL>() const {
   return dynamic_cast<const FinalPhase&>(fetch(PhaseType::GLOBAL));
 }
 
+// read referenced column name from a column signature "F:{column}"
+static std::string_view columnOf(std::string_view sign) {
+  static constexpr std::string_view COLUMN = "F:";
+  if (sign.size() > COLUMN.size() && sign.substr(0, COLUMN.size()) == COLUMN) {
+    return sign.substr(COLUMN.size());
+  }
+
+  return {};
+}
+
+void Phase<PhaseType::COMPUTE>::planMetadata() noexcept {
+  metaFields_.clear();
+
+  // only aggregation query without expression keys is possible to be answered by metadata
+  const auto size = fields_.size();
+  if (numAggregates_ == 0 || size != aggregateMap_.size()) {
+    return;
+  }
+
+  std::vector<MetaField> metaFields;
+  metaFields.reserve(size);
+  for (size_t i = 0; i < size; ++i) {
+    const auto& f = fields_.at(i);
+    const auto sign = f->signature();
+
+    // keys have to be plain columns
+    if (!aggregateMap_.at(i)) {
+      auto column = columnOf(sign);
+      if (f->expressionType() != ExpressionType::COLUMN || column.empty()) {
+        return;
+      }
+
+      metaFields.emplace_back(MetaOp::KEY, std::string(column));
+      continue;
+    }
+
+    // UDAF has signature as "{NAME}({inner signature})"
+    auto lp = sign.find('(');
+    if (lp == std::string_view::npos || sign.back() != ')') {
+      return;
+    }
+
+    auto name = sign.substr(0, lp);
+    auto column = columnOf(sign.substr(lp + 1, sign.size() - lp - 2));
+
+    // count takes every row regardless of its inner expression
+    if (name == UdfTraits<UDFType::COUNT>::Name) {
+      metaFields.emplace_back(MetaOp::COUNT, std::string(column));
+      continue;
+    }
+
+    if (column.empty()) {
+      return;
+    }
+
+    if (name == UdfTraits<UDFType::SUM>::Name) {
+      metaFields.emplace_back(MetaOp::SUM, std::string(column));
+    } else if (name == UdfTraits<UDFType::MIN>::Name) {
+      metaFields.emplace_back(MetaOp::MIN, std::string(column));
+    } else if (name == UdfTraits<UDFType::MAX>::Name) {
+      metaFields.emplace_back(MetaOp::MAX, std::string(column));
+    } else {
+      return;
+    }
+  }
+
+  metaFields_ = std::move(metaFields);
+}
+
+void Phase<PhaseType::COMPUTE>::planKeys() noexcept {
+  columnKeys_.reset();
+  if (numAggregates_ == 0) {
+    return;
+  }
+
+  std::vector<ColumnKey> keys;
+  for (size_t i = 0, size = fields_.size(); i < size; ++i) {
+    if (aggregateMap_.at(i)) {
+      continue;
+    }
+
+    const auto& f = fields_.at(i);
+    auto column = columnOf(f->signature());
+    if (f->expressionType() != ExpressionType::COLUMN || column.empty()) {
+      return;
+    }
+
+    keys.emplace_back(i, std::string(column));
+  }
+
+  columnKeys_ = std::move(keys);
+}
+
 void Phase<PhaseType::COMPUTE>::display() const {
   // display current phase type
   LOG(INFO) << "PHASE: " << PhaseTraits<PhaseType::COMPUTE>::name;
@@ -95,6 +201,8 @@ void Phase<PhaseType::COMPUTE>::display() const {
   if (LIKELY(hasAgg)) {
     LOG(INFO) << indent4 << indent4 << "KEYS: " << join(keys_);
   }
+  LOG(INFO) << indent4 << "METADATA: " << bliteral(!metaFields_.empty());
+  LOG(INFO) << indent4 << "COLUMN KEYS: " << bliteral(columnKeys_.has_value());
 }
 
 void Phase<PhaseType::PARTIAL>::display() const {
@@ -16,9 +16,12 @@
 
 #pragma once
 
+#include <memory>
 #include <numeric>
+#include <optional>
 #include <unordered_set>
 
+#include "common/Cancellation.h"
 #include "common/Cursor.h"
 #include "meta/NNode.h"
 #include "surface/DataSurface.h"
@@ -63,6 +66,52 @@ class Phase {};
 
 // define query window type
 using QueryWindow = std::pair<size_t, size_t>;
+
+// define how a block phase field can be answered from block metadata only
+// KEY:   a plain column key, answered by partition value if block has single value for it
+// COUNT: number of rows of the block
+// SUM/MIN/MAX: answered by the histogram of the referenced column
+enum class MetaOp {
+  KEY,
+  COUNT,
+  SUM,
+  MIN,
+  MAX
+};
+
+// a field in block phase which can be answered by metadata
+struct MetaField {
+  explicit MetaField(MetaOp o, std::string c) : op{ o }, column{ std::move(c) } {}
+  MetaOp op;
+  std::string column;
+};
+
+// a group key of block phase which is a plain column
+// it can be mapped into a dense slot if the column has small value domain in a block
+struct ColumnKey {
+  explicit ColumnKey(size_t i, std::string c) : index{ i }, column{ std::move(c) } {}
+  size_t index;
+  std::string column;
+};
+
+// a round of exact distributed top K protocol (TPUT) that a node is asked to execute
+// NONE:      return all aggregated rows of the node (may be truncated by TOP_SORT_SCALE)
+// TOP:       return local top K rows by the sort column, plus the row having lowest score
+// THRESHOLD: return all rows whose local score is no less than the threshold
+// KEYS:      return rows of the given encoded group keys
+enum class TopType : int8_t {
+  NONE = 0,
+  TOP = 1,
+  THRESHOLD = 2,
+  KEYS = 3
+};
+
+struct TopRound {
+  TopType type = TopType::NONE;
+  double threshold = 0;
+  std::vector<std::string> keys;
+};
+
 using BlockPhase = Phase<PhaseType::COMPUTE>;
 using NodePhase = Phase<PhaseType::PARTIAL>;
 using FinalPhase = Phase<PhaseType::GLOBAL>;
@@ -90,6 +139,11 @@ public:
     return uuid_;
   }
 
+  // a plan on a node takes the id of the query plan it's from
+  inline void setId(const std::string& id) {
+    uuid_ = id;
+  }
+
   nebula::type::Schema getOutputSchema() const {
     return output_;
   }
@@ -103,15 +157,65 @@ public:
     return window_;
   }
 
+  // weight of the query to share pool threads with other queries, given by its resource group
+  inline void setWeight(size_t weight) noexcept {
+    weight_ = weight;
+  }
+
+  inline size_t getWeight() const noexcept {
+    return weight_;
+  }
+
+  // fingerprints of block computation: its fields and keys, and its filter.
+  // plans of the same fingerprints have the same partial result on a block, 0 means unknown.
+  inline void setFingerprint(size_t compute, size_t filter) noexcept {
+    compute_ = compute;
+    filter_ = filter;
+  }
+
+  // fingerprint of the computation on a block, the filter is ignored if the block passes it as a whole
+  inline size_t fingerprint(bool filtered) const noexcept {
+    if (compute_ == 0 || !filtered) {
+      return compute_;
+    }
+
+    return compute_ ^ (filter_ + 0x9E3779B97F4A7C15 + (compute_ << 6) + (compute_ >> 2));
+  }
+
+  // fingerprint of the filter alone, rows of a block passing the same filter are the same, 0 means unknown
+  inline size_t filterFingerprint() const noexcept {
+    return filter_;
+  }
+
+  // cancellation of the query, checked by its workers and calls to stop their work
+  inline nebula::common::Cancellation& cancellation() const noexcept {
+    return *cancellation_;
+  }
+
+  // shared cancellation of the query, for callers that may outlive the plan
+  inline const nebula::common::CancellationPtr& cancellationPtr() const noexcept {
+    return cancellation_;
+  }
+
+  // keep data the plan runs on (such as a block snapshot) alive as long as the plan
+  inline void pin(std::shared_ptr<const void> data) const noexcept {
+    pinned_ = std::move(data);
+  }
+
 private:
   const ExecutionPhase& fetch(PhaseType type) const;
 
 private:
-  const std::string uuid_;
+  std::string uuid_;
   std::unique_ptr<ExecutionPhase> plan_;
   std::vector<nebula::meta::NNode> nodes_;
   nebula::type::Schema output_;
   QueryWindow window_;
+  size_t weight_ = 1;
+  size_t compute_ = 0;
+  size_t filter_ = 0;
+  std::shared_ptr<nebula::common::Cancellation> cancellation_ = std::make_shared<nebula::common::Cancellation>();
+  mutable std::shared_ptr<const void> pinned_;
 };
 
 // base execution phase definition - templated lambda - looking for C++ 20?
@@ -190,16 +294,27 @@ public:
     return *this;
   }
 
+  // NOTE: fields need to be set by compute before this
   Phase& aggregate(size_t numAggregates, std::vector<bool> aggregateMap) {
     numAggregates_ = numAggregates;
     aggregateMap_ = std::move(aggregateMap);
     // cross check if the keys is expected based on aggCols - changed plan?
+    planMetadata();
+    planKeys();
     return *this;
   }
 
   Phase& sort(std::vector<size_t> sorts, bool desc) {
+    descs_ = std::vector<bool>(sorts.size(), desc);
     sorts_ = std::move(sorts);
-    desc_ = desc;
+    return *this;
+  }
+
+  // sort by multiple columns, each column has its own direction
+  Phase& sort(std::vector<size_t> sorts, std::vector<bool> descs) {
+    N_ENSURE_EQ(sorts.size(), descs.size(), "every sort column needs a direction");
+    sorts_ = std::move(sorts);
+    descs_ = std::move(descs);
     return *this;
   }
 
@@ -238,8 +353,14 @@ public:
     return sorts_;
   }
 
+  // direction of the first sort column
   inline bool isDesc() const {
-    return desc_;
+    return !descs_.empty() && descs_.front();
+  }
+
+  // direction of the i-th sort column
+  inline bool isDesc(size_t i) const {
+    return descs_.at(i);
   }
 
   inline size_t top() const {
@@ -259,6 +380,29 @@ public:
     return numAggregates_ > 0;
   }
 
+  // fields recipes to answer a fully qualified block from its metadata
+  // empty if any field of this phase can not be answered by metadata
+  inline const std::vector<MetaField>& metaFields() const {
+    return metaFields_;
+  }
+
+  // whether all group keys are plain columns, in which case the group keys
+  // can be indexed by value domain of their columns rather than hashing
+  inline bool hasColumnKeys() const {
+    return columnKeys_.has_value();
+  }
+
+  inline const std::vector<ColumnKey>& columnKeys() const {
+    return columnKeys_.value();
+  }
+
+private:
+  // plan if all fields can be answered by block metadata
+  void planMetadata() noexcept;
+
+  // plan if all keys are plain columns
+  void planKeys() noexcept;
+
 private:
   nebula::type::Schema input_;
   nebula::type::Schema output_;
@@ -274,11 +418,17 @@ private:
 
   // sorting properties
   std::vector<size_t> sorts_;
-  // TODO(cao) - every sort column may have different order, single direction now
-  bool desc_;
+  // direction of every sort column
+  std::vector<bool> descs_;
 
   // results limitation
   size_t limit_;
+
+  // metadata answer recipes of all fields
+  std::vector<MetaField> metaFields_;
+
+  // group keys as plain columns, no value if any key is an expression
+  std::optional<std::vector<ColumnKey>> columnKeys_;
 };
 
 template <>
@@ -324,6 +474,10 @@ public:
     return static_cast<const BlockPhase&>(*upstream_).isDesc();
   }
 
+  inline bool isDesc(size_t i) const {
+    return static_cast<const BlockPhase&>(*upstream_).isDesc(i);
+  }
+
   inline size_t top() const {
     return static_cast<const BlockPhase&>(*upstream_).top();
   }
@@ -357,6 +511,10 @@ public:
     return static_cast<const NodePhase&>(*upstream_).isDesc();
   }
 
+  inline bool isDesc(size_t i) const {
+    return static_cast<const NodePhase&>(*upstream_).isDesc(i);
+  }
+
   inline bool hasAggregation() const {
     return static_cast<const NodePhase&>(*upstream_).hasAggregation();
   }
@@ -0,0 +1,120 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "FilterCache.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <vector>
+
+DEFINE_uint64(FILTER_CACHE_MB, 256, "memory budget in MB of cached filter bitmaps of blocks on a node, 0 to disable");
+
+/**
+ * Cache rows of a block passing a filter on a node.
+ */
+namespace nebula {
+namespace execution {
+
+FilterCache& FilterCache::singleton() {
+  // never destroyed, blocks released at exit still evict from it
+  static auto cache = new FilterCache(FLAGS_FILTER_CACHE_MB << 20);
+  return *cache;
+}
+
+std::shared_ptr<const Roaring> FilterCache::get(size_t block, size_t fingerprint) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto b = index_.find(block);
+  if (b == index_.end()) {
+    return nullptr;
+  }
+
+  auto found = b->second.find(fingerprint);
+  if (found == b->second.end() || !found->second->complete) {
+    return nullptr;
+  }
+
+  auto it = found->second;
+  entries_.splice(entries_.begin(), entries_, it);
+  return it->matches;
+}
+
+void FilterCache::add(
+  size_t block, size_t fingerprint, size_t rows, size_t begin, size_t end, const Roaring& matches) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& results = index_[block];
+  auto found = results.find(fingerprint);
+  if (found == results.end()) {
+    entries_.push_front(Entry{ block, fingerprint, rows, std::make_shared<Roaring>(), Roaring(), false, 0 });
+    found = results.emplace(fingerprint, entries_.begin()).first;
+  }
+
+  // ranges evaluated by concurrent queries may overlap, they have the same result
+  auto it = found->second;
+  if (!it->complete) {
+    *it->matches |= matches;
+    it->covered.addRange(begin, end);
+    if (it->covered.cardinality() >= it->rows) {
+      it->complete = true;
+      it->matches->runOptimize();
+      it->covered = Roaring();
+    }
+
+    bytes_ -= it->bytes;
+    it->bytes = it->matches->getSizeInBytes() + it->covered.getSizeInBytes();
+    bytes_ += it->bytes;
+  }
+
+  entries_.splice(entries_.begin(), entries_, it);
+  while (bytes_ > capacity_ && !entries_.empty()) {
+    VLOG(1) << "Evict filter bitmap of block: " << entries_.back().block;
+    erase(std::prev(entries_.end()));
+  }
+}
+
+size_t FilterCache::evict(size_t block) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto b = index_.find(block);
+  if (b == index_.end()) {
+    return 0;
+  }
+
+  // erase entries before the index of the block which they are found by
+  std::vector<Entries::iterator> its;
+  its.reserve(b->second.size());
+  for (auto& r : b->second) {
+    its.push_back(r.second);
+  }
+
+  for (auto it : its) {
+    erase(it);
+  }
+
+  return its.size();
+}
+
+void FilterCache::erase(Entries::iterator it) {
+  bytes_ -= it->bytes;
+  auto b = index_.find(it->block);
+  b->second.erase(it->fingerprint);
+  if (b->second.empty()) {
+    index_.erase(b);
+  }
+
+  entries_.erase(it);
+}
+
+} // namespace execution
+} // namespace nebula
@@ -0,0 +1,98 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <roaring.hh>
+#include <unordered_map>
+
+/**
+ * Cache rows of a block passing a filter on a node.
+ * Different queries (such as panels of a dashboard) often share the same filter but compute different fields,
+ * rows passing the filter are recorded in a bitmap once, later queries of the same filter only visit those rows.
+ * A bitmap is built by morsels of a block, it is ready to use once all rows of the block are evaluated.
+ */
+namespace nebula {
+namespace execution {
+
+class FilterCache {
+public:
+  // capacity from flag FILTER_CACHE_MB
+  static FilterCache& singleton();
+
+  // bitmaps of at most given bytes in total, least recently used ones are evicted first
+  explicit FilterCache(size_t capacity) : capacity_{ capacity }, bytes_{ 0 } {}
+  FilterCache(FilterCache&) = delete;
+  FilterCache(FilterCache&&) = delete;
+  virtual ~FilterCache() = default;
+
+public:
+  // rows of a block (by its batch id) passing a filter (by its fingerprint),
+  // nullptr if not all rows of the block are evaluated yet
+  std::shared_ptr<const Roaring> get(size_t, size_t);
+
+  // record rows passing a filter in range [begin, end) of a block of given number of rows
+  void add(size_t, size_t, size_t rows, size_t begin, size_t end, const Roaring&);
+
+  // drop all bitmaps of a block, return number of bitmaps dropped
+  size_t evict(size_t);
+
+  inline size_t capacity() const {
+    return capacity_;
+  }
+
+  inline size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+  }
+
+  inline size_t bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+  }
+
+private:
+  struct Entry {
+    size_t block;
+    size_t fingerprint;
+    size_t rows;
+    // rows passing the filter, it never changes once all rows are covered
+    std::shared_ptr<Roaring> matches;
+    // rows evaluated so far
+    Roaring covered;
+    bool complete;
+    size_t bytes;
+  };
+
+  using Entries = std::list<Entry>;
+
+  void erase(Entries::iterator);
+
+private:
+  const size_t capacity_;
+  size_t bytes_;
+  // most recently used entry is at front
+  Entries entries_;
+  // entries of every block by fingerprint
+  std::unordered_map<size_t, std::unordered_map<size_t, Entries::iterator>> index_;
+  mutable std::mutex mutex_;
+};
+
+} // namespace execution
+} // namespace nebula
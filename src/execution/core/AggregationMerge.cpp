@@ -19,17 +19,29 @@
 #include <fmt/format.h>
 #include <gflags/gflags.h>
 
-#include "common/Fold.h"
 #include "execution/serde/RowCursorSerde.h"
 #include "memory/keyed/FlatRowCursor.h"
 #include "memory/keyed/HashFlat.h"
+#include "memory/keyed/SpillFlat.h"
 #include "surface/eval/UDF.h"
 
-DEFINE_uint64(MULTI_FOLD_WIDTH, 1,
-              "defines if we want fixed width for multi-fold passes."
-              "0: use pool size to calculate width = total / size"
-              "1: use current thread, not using pool"
-              "2+: use this width to do folding parallel");
+DEFINE_uint64(MERGE_PARTITIONS, 0,
+              "number of hash partitions to merge aggregation results in parallel."
+              "0: use pool size rounded up to power of 2"
+              "1: merge all in current thread"
+              "2+: rounded up to power of 2, each partition merged by a pool thread");
+
+DEFINE_uint64(MERGE_PARTITION_MIN_ROWS, 8192,
+              "partitioned merge kicks in only when total rows to merge reach this number");
+
+DEFINE_uint64(MERGE_MEMORY_BUDGET, 4UL << 30,
+              "max bytes of hash tables a merge can hold while aggregating, shared by all its partitions."
+              "states over budget are spilled to temp files and merged later, the merged result is not bounded by it."
+              " 0: no limit");
+
+DEFINE_uint64(SPILL_PARTITIONS, 16, "number of partitions (power of 2) a spilled hash table is split into");
+
+DEFINE_string(SPILL_DIR, "/tmp", "local directory to write spill files");
 
 /**
  * A logic wrapper to merge aggregation results shared by aggregators (Node Executor or Server Executor)
@@ -39,8 +51,10 @@ namespace execution {
 namespace core {
 
 using nebula::common::CompositeCursor;
+using nebula::memory::keyed::FlatBuffer;
 using nebula::memory::keyed::FlatRowCursor;
 using nebula::memory::keyed::HashFlat;
+using nebula::memory::keyed::SpillFlat;
 using nebula::surface::EmptyRowCursor;
 using nebula::surface::RowCursorPtr;
 using nebula::surface::RowData;
@@ -48,8 +62,162 @@ using nebula::surface::eval::ValueEval;
 using nebula::type::Kind;
 using nebula::type::Schema;
 
-RowCursorPtr merge(
-  folly::ThreadPoolExecutor&,
+using FlatBufferPtr = std::unique_ptr<FlatBuffer>;
+using RowIds = std::vector<size_t>;
+
+// run a task in the pool and return its future, an exception of the task fails the future
+template <typename T, typename F>
+static folly::Future<T> run(folly::ThreadPoolExecutor& pool, F&& task) {
+  return folly::via(&pool, std::forward<F>(task));
+}
+
+// number of partitions, always power of 2 so that partition is picked by hash bits
+static size_t partitions(folly::ThreadPoolExecutor& pool, size_t rows) {
+  if (rows < FLAGS_MERGE_PARTITION_MIN_ROWS) {
+    return 1;
+  }
+
+  const size_t width = FLAGS_MERGE_PARTITIONS == 0 ? pool.numThreads() : FLAGS_MERGE_PARTITIONS;
+  size_t p = 1;
+  while (p < width) {
+    p <<= 1;
+  }
+
+  return p;
+}
+
+// partition of a key hash, bits mixed differently from hash table of each partition
+// so that rows in the same partition still spread well in its own table
+static inline size_t partition(size_t hash, size_t bits) {
+  return ((hash ^ (hash >> 32)) * 0xD6E8FEB86659FD93UL) >> (64 - bits);
+}
+
+// state of a partitioned merge shared by all its tasks
+struct MergeState {
+  std::vector<FlatBufferPtr> flats;
+  std::vector<folly::Try<std::vector<RowIds>>> scattered;
+};
+
+// merge aggregation results by partitions:
+// 1. scatter rows of every source into partitions by their key hash bits in parallel.
+// 2. each partition merges its rows from all sources into its own hash flat in parallel.
+// A key only lands in one partition, so the final result is simply concatenation of all partitions.
+// Every step is a continuation of the previous one, no pool thread waits for other tasks.
+static folly::Future<RowCursorPtr> mergeAggregation(
+  folly::ThreadPoolExecutor& pool,
+  const Schema schema,
+  const std::vector<std::unique_ptr<ValueEval>>& fields,
+  const std::vector<folly::Try<RowCursorPtr>>& sources) {
+  // take flat buffers out of all valid sources
+  auto state = std::make_shared<MergeState>();
+  auto& flats = state->flats;
+  flats.reserve(sources.size());
+  size_t rows = 0;
+  for (auto it = sources.begin(); it < sources.end(); ++it) {
+    // if the result is empty
+    if (!it->hasValue() || !it->value()) {
+      continue;
+    }
+
+    auto flat = nebula::execution::serde::asBuffer(*it->value(), schema, fields);
+    if (flat && flat->getRows() > 0) {
+      rows += flat->getRows();
+      flats.push_back(std::move(flat));
+    }
+  }
+
+  const auto numParts = partitions(pool, rows);
+
+  // every partition aggregates in a spill flat with its share of memory budget
+  const auto budget = FLAGS_MERGE_MEMORY_BUDGET / numParts;
+  const auto makeSpill = [schema, &fields, budget]() {
+    return std::make_unique<SpillFlat>(schema, fields, budget, FLAGS_SPILL_PARTITIONS, FLAGS_SPILL_DIR);
+  };
+
+  // concatenate all aggregated flats
+  const auto concat = [](std::vector<FlatBufferPtr> results) -> RowCursorPtr {
+    if (results.size() == 1) {
+      return std::make_shared<FlatRowCursor>(std::move(results.front()));
+    }
+
+    auto composite = std::make_shared<CompositeCursor<RowData>>();
+    for (auto& flat : results) {
+      composite->combine(std::make_shared<FlatRowCursor>(std::move(flat)));
+    }
+
+    return composite;
+  };
+
+  if (numParts == 1) {
+    auto sf = makeSpill();
+    for (const auto& flat : flats) {
+      for (size_t r = 0, size = flat->getRows(); r < size; ++r) {
+        sf->update(flat->access(r));
+      }
+    }
+
+    // release inputs before loading spilled partitions
+    flats.clear();
+    return folly::makeFuture(concat(sf->finish()));
+  }
+
+  const size_t bits = __builtin_ctzl(numParts);
+  LOG(INFO) << fmt::format("Merge {0} rows from {1} flats in {2} partitions", rows, flats.size(), numParts);
+
+  // scatter: row ids of each source in every partition
+  std::vector<folly::Future<std::vector<RowIds>>> scatters;
+  scatters.reserve(flats.size());
+  for (const auto& flat : flats) {
+    scatters.push_back(run<std::vector<RowIds>>(pool, [flat = flat.get(), numParts, bits]() {
+      std::vector<RowIds> parts(numParts);
+      for (size_t r = 0, size = flat->getRows(); r < size; ++r) {
+        parts[partition(flat->hash(r), bits)].push_back(r);
+      }
+
+      return parts;
+    }));
+  }
+
+  // merge: every partition has its own hash flat, no contention among them
+  return folly::collectAll(scatters)
+    .via(&pool)
+    .thenValue([&pool, state, makeSpill, numParts](std::vector<folly::Try<std::vector<RowIds>>> scattered) {
+      state->scattered = std::move(scattered);
+      std::vector<folly::Future<std::vector<FlatBufferPtr>>> merges;
+      merges.reserve(numParts);
+      for (size_t p = 0; p < numParts; ++p) {
+        merges.push_back(run<std::vector<FlatBufferPtr>>(pool, [state, makeSpill, p]() {
+          auto sf = makeSpill();
+          for (size_t i = 0, size = state->flats.size(); i < size; ++i) {
+            const auto& flat = state->flats.at(i);
+            for (auto r : state->scattered.at(i).value().at(p)) {
+              sf->update(flat->access(r));
+            }
+          }
+
+          return sf->finish();
+        }));
+      }
+
+      return folly::collectAll(merges).via(&pool);
+    })
+    .thenValue([state, concat](std::vector<folly::Try<std::vector<FlatBufferPtr>>> merged) {
+      // release inputs once all partitions are merged
+      state->flats.clear();
+
+      std::vector<FlatBufferPtr> results;
+      for (auto& part : merged) {
+        for (auto& flat : part.value()) {
+          results.push_back(std::move(flat));
+        }
+      }
+
+      return concat(std::move(results));
+    });
+}
+
+folly::Future<RowCursorPtr> merge(
+  folly::ThreadPoolExecutor& pool,
   const Schema schema,
   const std::vector<std::unique_ptr<ValueEval>>& fields,
   const bool hasAggregation,
@@ -58,72 +226,13 @@ RowCursorPtr merge(
   LOG(INFO) << fmt::format("Merge sources: {0} with aggregation: {1}", size, hasAggregation);
   if (size == 0) {
     LOG(INFO) << "Received an empty result set.";
-    return EmptyRowCursor::instance();
+    return folly::makeFuture<RowCursorPtr>(EmptyRowCursor::instance());
   }
 
   if (hasAggregation) {
-    // if it is aggregation, we're sure the data cursor will be hash flat.
-    // So that we can do this multi-fold pass
-    // transform folly tries into HashFlat
-    // std::vector<std::unique_ptr<HashFlat>> blocks;
-    // blocks.reserve(size);
-    auto hf = std::make_unique<HashFlat>(schema, fields);
-    for (auto it = sources.begin(); it < sources.end(); ++it) {
-      // if the result is empty
-      if (!it->hasValue()) {
-        continue;
-      }
-
-      auto blockResult = it->value();
-      while (blockResult->hasNext()) {
-        const auto& row = blockResult->next();
-        hf->update(row);
-      }
-    }
-
-    return std::make_shared<FlatRowCursor>(std::move(hf));
+    return mergeAggregation(pool, schema, fields, sources);
   }
 
-  // TODO(cao) - I'm seeing multi-fold problems and even worse performance
-  // Need more time to work on this, most likely caused by the manipulation on the pointers/casting/moving
-  //   // convert to flat buffer pointer, we do not need schema used for new instance
-  //   auto buffer = nebula::execution::serde::asBuffer(*it->value(), nullptr);
-  //   N_ENSURE_NOT_NULL(buffer, "invalid buffer in merge path");
-  //   // this buffer could be HashFlat if it is from local aggregation
-  //   // or plain flat buffer which is searialized through boundary
-  //   auto origin = buffer.release();
-  //   auto flat = dynamic_cast<HashFlat*>(origin);
-  //   if (flat) {
-  //     blocks.push_back(std::unique_ptr<HashFlat>{ flat });
-  //   } else {
-  //     blocks.push_back(std::make_unique<HashFlat>(origin, keys));
-  //   }
-  // }
-
-  // if (blocks.size() == 0) {
-  //   LOG(INFO) << "no valid block to merge.";
-  //   return EmptyRowCursor::instance();
-  // }
-
-  // fold blocks if there are more than one
-  // if (blocks.size() > 1) {
-  //   nebula::common::fold<std::unique_ptr<HashFlat>>(
-  //     pool, blocks, [&update](std::unique_ptr<HashFlat>& from, std::unique_ptr<HashFlat>& to) {
-  //       // do the in-place merge
-  //       // iterate the block result and partial aggregate it in hash flat
-  //       FlatRowCursor cursor(std::move(from));
-  //       auto i = 0;
-  //       while (cursor.hasNext()) {
-  //         const auto& row = cursor.next();
-  //         to->update(row, update);
-  //       }
-  //     },
-  //     FLAGS_MULTI_FOLD_WIDTH);
-  // }
-
-  // // after fold, all data aggregated at position 0
-  // return std::make_shared<FlatRowCursor>(std::move(blocks.at(0)));
-
   auto composite = std::make_shared<CompositeCursor<RowData>>();
   auto failures = 0;
   for (auto it = sources.begin(); it < sources.end(); ++it) {
@@ -143,7 +252,7 @@ RowCursorPtr merge(
     LOG(INFO) << "Error or timeout nodes: " << failures;
   }
 
-  return composite;
+  return folly::makeFuture<RowCursorPtr>(composite);
 }
 
 } // namespace core
@@ -28,7 +28,9 @@ namespace nebula {
 namespace execution {
 namespace core {
 
-nebula::surface::RowCursorPtr merge(
+// merge results of all sources into one row cursor, the merge runs in the pool without blocking any pool thread.
+// fields are referenced by the merge tasks, they have to outlive the returned future.
+folly::Future<nebula::surface::RowCursorPtr> merge(
   folly::ThreadPoolExecutor&,
   const nebula::type::Schema,
   const nebula::surface::eval::Fields&,
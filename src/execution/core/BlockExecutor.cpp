@@ -16,12 +16,22 @@
 
 #include "BlockExecutor.h"
 
+#include <any>
+#include <gflags/gflags.h>
 #include <unordered_set>
 
 #include "AggregationMerge.h"
+#include "KeySlots.h"
+#include "execution/FilterCache.h"
 #include "memory/keyed/HashFlat.h"
+#include "surface/SchemaRow.h"
 #include "surface/eval/UDF.h"
 
+DEFINE_uint64(PREAGG_SAMPLE_ROWS, 4096,
+              "number of rows aggregated in a block before checking its reduction, 0 to always pre-aggregate");
+DEFINE_double(PREAGG_BYPASS_RATIO, 0.9,
+              "stop pre-aggregating a block if its groups / sampled rows is over this ratio");
+
 /**
  * Nebula runtime / online meta data.
  */
@@ -29,24 +39,115 @@ namespace nebula {
 namespace execution {
 namespace core {
 
+using nebula::common::ExtendableSlice;
+using nebula::execution::FilterCache;
 using nebula::memory::EvaledBlock;
 using nebula::memory::keyed::HashFlat;
+using nebula::surface::IndexType;
 using nebula::surface::RowCursorPtr;
+using nebula::surface::SchemaRow;
 using nebula::surface::eval::BlockEval;
 using nebula::surface::eval::EvalContext;
+using nebula::surface::eval::IntHistogram;
+using nebula::surface::eval::RealHistogram;
 using nebula::type::Kind;
+using nebula::type::TypeTraits;
+
+// every state is fixed width scalar, reserve 8 bytes for each field
+static constexpr size_t STATE_WIDTH = 8;
+
+// a single row built from block metadata.
+// keys are read from partition values while aggregated columns carry their states
+// which are taken by inline state columns or loaded into the sketches directly.
+class MetaRow : public SchemaRow {
+public:
+  MetaRow(const nebula::type::Schema& schema, std::vector<std::any> values, ExtendableSlice& states)
+    : SchemaRow(schema), values_{ std::move(values) }, states_{ states } {}
+  virtual ~MetaRow() = default;
+
+  bool isNull(IndexType) const override {
+    return false;
+  }
+
+  // aggregated columns have no value for key
+  bool readState(IndexType index, int64_t& state) const override {
+    if (values_.at(index).has_value()) {
+      return false;
+    }
+
+    state = states_.read<int64_t>(index * STATE_WIDTH);
+    return true;
+  }
+
+#define READ_META_VALUE(TYPE, NAME)                          \
+  TYPE NAME(IndexType index) const override {                \
+    const auto& v = values_.at(index);                       \
+    return v.has_value() ? std::any_cast<TYPE>(v) : TYPE(0); \
+  }
+
+  READ_META_VALUE(bool, readBool)
+  READ_META_VALUE(int8_t, readByte)
+  READ_META_VALUE(int16_t, readShort)
+  READ_META_VALUE(int32_t, readInt)
+  READ_META_VALUE(int64_t, readLong)
+  READ_META_VALUE(float, readFloat)
+  READ_META_VALUE(double, readDouble)
+  READ_META_VALUE(int128_t, readInt128)
 
-RowCursorPtr compute(const EvaledBlock& data, const nebula::execution::BlockPhase& plan) {
+#undef READ_META_VALUE
+
+  std::string_view readString(IndexType index) const override {
+    const auto& v = values_.at(index);
+    if (v.has_value()) {
+      return std::any_cast<const std::string&>(v);
+    }
+
+    return {};
+  }
+
+  std::unique_ptr<nebula::surface::ListData> readList(IndexType) const override {
+    throw NException("Not implemented yet");
+  }
+
+  std::unique_ptr<nebula::surface::MapData> readMap(IndexType) const override {
+    throw NException("Not implemented yet");
+  }
+
+private:
+  std::vector<std::any> values_;
+  ExtendableSlice& states_;
+};
+
+RowCursorPtr compute(const Morsel& morsel, const nebula::execution::BlockPhase& plan, size_t filter) {
   if (plan.hasAggregation()) {
-    return std::make_shared<BlockExecutor>(data, plan);
+    return std::make_shared<BlockExecutor>(morsel, plan, filter);
   }
 
-  return std::make_shared<SamplesExecutor>(data, plan);
+  return std::make_shared<SamplesExecutor>(morsel, plan);
 }
 
-void BlockExecutor::compute() {
+void BlockExecutor::add(const Morsel& morsel) {
+  // a fully qualified block may be answered by its metadata directly
+  if (!computeByMetadata(morsel)) {
+    compute(morsel);
+  }
+
+  // after the compute flat should contain all the data we need.
+  index_ = 0;
+  size_ = result_->getRows();
+}
+
+void BlockExecutor::add(const MorselSource& source) {
+  // all morsels are aggregated into the same table
+  for (auto morsel = source(); morsel != nullptr; morsel = source()) {
+    add(*morsel);
+  }
+}
+
+void BlockExecutor::compute(const Morsel& morsel) {
   // process every single row and put result in HashFlat
-  auto accessor = data_.first->makeAccessor();
+  const auto& data = *morsel.block;
+  auto accessor = data.first->makeAccessor();
   const auto& fields = plan_.fields();
   const auto& filter = plan_.filter();
 
@@ -54,13 +155,33 @@ void BlockExecutor::compute() {
   EvalContext ctx(plan_.cacheEval());
 
   // predicate pushdown evaluation on block metadata
-  auto result = data_.second;
+  auto result = data.second;
 
   // if all rows needed, we don't need to evaluate row by row
   bool scanAll = result == BlockEval::ALL;
 
+  // rows of a sealed block passing the filter are evaluated once for all queries of the same filter.
+  // once cached, only those rows are visited, otherwise rows passing the filter are recorded into the cache.
+  auto& filterCache = FilterCache::singleton();
+  const auto& block = *data.first;
+  const auto cacheFilter = !scanAll && filter_ != 0 && filterCache.capacity() > 0 && block.sealed();
+  auto matches = cacheFilter ? filterCache.get(block.getId(), filter_) : nullptr;
+  Roaring passed;
+
   ComputedRow cr(plan_.outputSchema(), ctx, fields);
-  result_ = std::make_unique<HashFlat>(plan_.outputSchema(), fields);
+
+  // group keys with small value domain in this block are indexed by slot rather than hashing
+  // slots are specific to the block, rows of previous slots are resolved again by key
+  auto slots = KeySlots::make(*data.first, plan_);
+  result_->resetSlots();
+
+  // keys with high cardinality barely reduce rows while paying for hashing and a large table.
+  // we sample the reduction over the first rows, if nearly every row is a new group,
+  // remaining rows are appended as raw partial rows and left for node merge to aggregate.
+  // dense slots mean small key domain, so they always pre-aggregate.
+  size_t sample = slots ? 0 : FLAGS_PREAGG_SAMPLE_ROWS;
+  size_t rows = 0;
+  const auto base = result_->getRows();
 
   // we want to evaluate here for the whole block before we go to iterations of computing
   // by leveraging its metadata including histogram, bloom filter, dictionary etc.
@@ -73,7 +194,47 @@ void BlockExecutor::compute() {
   // and these methods will be used in each individual ValueEval and give result like above.
   // So we need an special operator to be implemented to have this function
 
-  for (size_t i = 0, size = data_.first->getRows(); i < size; ++i) {
+  // aggregate a row passing the filter into the result
+  const auto aggregate = [&]() {
+    // flat compute every new value of each field and set to corresponding column in flat
+    if (slots) {
+      auto slot = slots->slot(cr);
+      if (slot != KeySlots::NONE) {
+        result_->update(cr, slot);
+        return;
+      }
+    }
+
+    if (bypassed_) {
+      result_->append(cr);
+      return;
+    }
+
+    result_->update(cr);
+
+    // new groups added by sampled rows of this morsel, following morsels are bypassed as well once bypassed
+    if (UNLIKELY(++rows == sample)) {
+      const auto groups = result_->getRows() - base;
+      bypassed_ = groups > rows * FLAGS_PREAGG_BYPASS_RATIO;
+      if (bypassed_) {
+        LOG(INFO) << "Bypass pre-aggregation with groups " << groups << " in sampled rows " << rows;
+      }
+    }
+  };
+
+  // only rows passing the cached filter are visited
+  if (matches) {
+    auto it = matches->begin();
+    it.equalorlarger(morsel.begin);
+    for (const auto end = matches->end(); it != end && *it < morsel.end; ++it) {
+      ctx.reset(accessor->seek(*it));
+      aggregate();
+    }
+
+    return;
+  }
+
+  for (size_t i = morsel.begin; i < morsel.end; ++i) {
     ctx.reset(accessor->seek(i));
 
     // if not fullfil the condition
@@ -84,20 +245,141 @@ void BlockExecutor::compute() {
       continue;
     }
 
-    // flat compute every new value of each field and set to corresponding column in flat
-    result_->update(cr);
+    if (cacheFilter) {
+      passed.add(i);
+    }
+
+    aggregate();
   }
 
-  // after the compute flat should contain all the data we need.
-  index_ = 0;
-  size_ = result_->getRows();
+  if (cacheFilter) {
+    filterCache.add(block.getId(), filter_, block.getRows(), morsel.begin, morsel.end, passed);
+  }
+}
+
+bool BlockExecutor::computeByMetadata(const Morsel& morsel) {
+  // only a morsel of the whole block can be answered by block metadata
+  const auto& metaFields = plan_.metaFields();
+  if (morsel.block->second != BlockEval::ALL || metaFields.empty() || !morsel.whole()) {
+    return false;
+  }
+
+  const auto& block = *morsel.block->first;
+  const auto rows = block.getRows();
+  if (rows == 0) {
+    return false;
+  }
+
+  // write a state value into the slice as the native type of the aggregator
+  const auto& fields = plan_.fields();
+  const auto numFields = metaFields.size();
+  ExtendableSlice states{ numFields * STATE_WIDTH };
+  const auto writeState = [&states](size_t offset, Kind kind, auto value) -> bool {
+#define WRITE_STATE_KIND(KIND)                                                   \
+  case Kind::KIND: {                                                             \
+    states.write(offset, static_cast<TypeTraits<Kind::KIND>::CppType>(value)); \
+    return true;                                                                 \
+  }
+
+    switch (kind) {
+      WRITE_STATE_KIND(TINYINT)
+      WRITE_STATE_KIND(SMALLINT)
+      WRITE_STATE_KIND(INTEGER)
+      WRITE_STATE_KIND(BIGINT)
+      WRITE_STATE_KIND(REAL)
+      WRITE_STATE_KIND(DOUBLE)
+    default:
+      return false;
+    }
+
+#undef WRITE_STATE_KIND
+  };
+
+  std::vector<std::any> keys(numFields);
+  for (size_t i = 0; i < numFields; ++i) {
+    const auto& mf = metaFields.at(i);
+    const auto offset = i * STATE_WIDTH;
+    const auto kind = fields.at(i)->outputType();
+
+    // key has to be a partition column with single value in this block
+    if (mf.op == MetaOp::KEY) {
+      auto values = block.partitionValues(mf.column);
+      if (values.size() != 1) {
+        return false;
+      }
+
+      keys[i] = values.front();
+      continue;
+    }
+
+    // count covers all rows regardless null values, consistent with row scan
+    if (mf.op == MetaOp::COUNT) {
+      if (!writeState(offset, kind, (int64_t)rows)) {
+        return false;
+      }
+
+      continue;
+    }
+
+    // partition column has no histogram, its value stored in bess
+    if (!block.partitionValues(mf.column).empty()) {
+      return false;
+    }
+
+    // min/max requires no null values, otherwise row scan merges default values
+    const auto answer = [&mf, rows, offset, kind, &writeState](const auto& h) -> bool {
+      switch (mf.op) {
+      case MetaOp::SUM: return writeState(offset, kind, h.sum());
+      case MetaOp::MIN: return h.count == rows && writeState(offset, kind, h.min());
+      case MetaOp::MAX: return h.count == rows && writeState(offset, kind, h.max());
+      default: return false;
+      }
+    };
+
+    switch (block.columnType(mf.column)->k()) {
+    case Kind::TINYINT:
+    case Kind::SMALLINT:
+    case Kind::INTEGER:
+    case Kind::BIGINT: {
+      if (!answer(block.histogram<IntHistogram>(mf.column))) {
+        return false;
+      }
+      break;
+    }
+    case Kind::REAL:
+    case Kind::DOUBLE: {
+      if (!answer(block.histogram<RealHistogram>(mf.column))) {
+        return false;
+      }
+      break;
+    }
+    default:
+      return false;
+    }
+  }
+
+  // build the only row, inline state columns take the states from the row
+  // others load the states into their sketches
+  const auto& schema = plan_.outputSchema();
+  HashFlat meta(schema, fields);
+  meta.update(MetaRow(schema, std::move(keys), states));
+  const auto& row = meta.row(0);
+  for (size_t i = 0; i < numFields; ++i) {
+    if (metaFields.at(i).op != MetaOp::KEY && !meta.isInline(i)) {
+      row.getAggregator(i)->load(states, i * STATE_WIDTH);
+    }
+  }
+
+  // the row carries its states and sketches, merge it into the result
+  result_->update(row);
+  return true;
 }
 
 void SamplesExecutor::compute() {
   // build context and computed row associated with this context
   samples_ = std::make_unique<ReferenceRows>(plan_, *data_.first);
 
-  for (size_t i = 0, size = data_.first->getRows(); i < size; ++i) {
+  for (size_t i = morsel_.begin; i < morsel_.end; ++i) {
     // if we have enough samples, just return
     if (samples_->check(i) >= plan_.top()) {
       break;
@@ -16,6 +16,9 @@
 
 #pragma once
 
+#include <functional>
+#include <utility>
+
 #include "ComputedRow.h"
 #include "ReferenceRows.h"
 #include "execution/ExecutionPlan.h"
@@ -30,6 +33,33 @@
 namespace nebula {
 namespace execution {
 namespace core {
+
+// a range of rows [begin, end) in a block, it is the unit of work scheduled on worker threads.
+// blocks of different sizes are split into similar sized morsels to keep all workers busy.
+struct Morsel {
+  explicit Morsel(const nebula::memory::EvaledBlock& b, size_t s, size_t e)
+    : block{ &b }, begin{ s }, end{ e } {}
+
+  // a morsel of all rows in a block
+  explicit Morsel(const nebula::memory::EvaledBlock& b)
+    : Morsel(b, 0, b.first->getRows()) {}
+
+  inline size_t size() const {
+    return end - begin;
+  }
+
+  inline bool whole() const {
+    return begin == 0 && end == block->first->getRows();
+  }
+
+  const nebula::memory::EvaledBlock* block;
+  size_t begin;
+  size_t end;
+};
+
+// a source of morsels for one executor, it returns nullptr when there is no more morsel
+using MorselSource = std::function<const Morsel*()>;
+
 /**
  * Block executor defines the smallest compute unit and itself is a row data cursor
  * TODO(cao): consider merging FlatRowCursor here for module reuse.
@@ -38,13 +68,35 @@ namespace core {
 class BlockExecutor : public nebula::surface::RowCursor {
 
 public:
-  BlockExecutor(const nebula::memory::EvaledBlock& data, const nebula::execution::BlockPhase& plan)
-    : nebula::surface::RowCursor(0), data_{ data }, plan_{ plan } {
+  // filter is fingerprint of the plan filter to cache rows passing it, 0 to never cache them
+  BlockExecutor(const Morsel& morsel, const nebula::execution::BlockPhase& plan, size_t filter = 0)
+    : BlockExecutor([&morsel, taken = false]() mutable -> const Morsel* {
+                      return std::exchange(taken, true) ? nullptr : &morsel;
+                    },
+                    plan,
+                    filter) {}
+
+  // aggregate all morsels taken from the source into one table, such as all morsels computed by a worker thread
+  BlockExecutor(const MorselSource& source, const nebula::execution::BlockPhase& plan, size_t filter = 0)
+    : BlockExecutor(plan, filter) {
     // compute will finish the compute and fill the data state in
-    this->compute();
+    this->add(source);
   }
+
+  // an empty table, morsels are aggregated in by add
+  explicit BlockExecutor(const nebula::execution::BlockPhase& plan, size_t filter = 0)
+    : nebula::surface::RowCursor(0),
+      plan_{ plan },
+      filter_{ filter },
+      result_{ std::make_unique<nebula::memory::keyed::HashFlat>(plan.outputSchema(), plan.fields()) } {}
   virtual ~BlockExecutor() = default;
 
+  // aggregate a morsel into the table
+  void add(const Morsel&);
+
+  // aggregate all morsels taken from the source into the table
+  void add(const MorselSource&);
+
   inline virtual const nebula::surface::RowData& next() override {
     return result_->row(index_++);
   }
@@ -59,19 +111,31 @@ public:
     return temp;
   }
 
+  // true if pre-aggregation was given up for high cardinality keys,
+  // the result may have duplicate keys and requires a merge
+  inline bool bypassed() const {
+    return bypassed_;
+  }
+
 private:
-  void compute();
+  // scan rows of a morsel and aggregate them into the result table
+  void compute(const Morsel&);
+
+  // answer the block by its metadata (histogram, partition values) without scanning rows
+  // return false if the block is not qualified for it
+  bool computeByMetadata(const Morsel&);
 
 private:
-  const nebula::memory::EvaledBlock& data_;
   const nebula::execution::BlockPhase& plan_;
+  const size_t filter_;
   std::unique_ptr<nebula::memory::keyed::HashFlat> result_;
+  bool bypassed_ = false;
 };
 
 class SamplesExecutor : public nebula::surface::RowCursor {
 public:
-  SamplesExecutor(const nebula::memory::EvaledBlock& data, const nebula::execution::BlockPhase& plan)
-    : nebula::surface::RowCursor(0), data_{ data }, plan_{ plan } {
+  SamplesExecutor(const Morsel& morsel, const nebula::execution::BlockPhase& plan)
+    : nebula::surface::RowCursor(0), data_{ *morsel.block }, morsel_{ morsel }, plan_{ plan } {
     // compute will finish the compute and fill the data state in
     this->compute();
   }
@@ -91,11 +155,18 @@ private:
 
 private:
   const nebula::memory::EvaledBlock& data_;
+  const Morsel morsel_;
   const nebula::execution::BlockPhase& plan_;
   std::unique_ptr<ReferenceRows> samples_;
 };
 
-nebula::surface::RowCursorPtr compute(const nebula::memory::EvaledBlock&, const nebula::execution::BlockPhase&);
+nebula::surface::RowCursorPtr compute(const Morsel&, const nebula::execution::BlockPhase&, size_t filter = 0);
+
+// compute all rows of a block
+inline nebula::surface::RowCursorPtr compute(const nebula::memory::EvaledBlock& block,
+                                             const nebula::execution::BlockPhase& plan) {
+  return compute(Morsel(block), plan);
+}
 
 } // namespace core
 } // namespace execution
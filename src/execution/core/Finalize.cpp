@@ -15,6 +15,7 @@
  */
 
 #include "Finalize.h"
+#include <cstring>
 #include <gflags/gflags.h>
 
 #include "memory/FlatRow.h"
@@ -177,6 +178,13 @@ private:
   case Kind::I: {                                                                \
     transformers_[i] = [i](const RowData* r, void* t) {                          \
       using OutputType = TypeTraits<Kind::O>::CppType;                           \
+      if constexpr (std::is_arithmetic_v<OutputType>) {                          \
+        int64_t state;                                                           \
+        if (r->readState(i, state)) {                                            \
+          std::memcpy(t, &state, sizeof(OutputType));                            \
+          return;                                                                \
+        }                                                                        \
+      }                                                                          \
       auto sketch = r->getAggregator(i);                                         \
       N_ENSURE_NOT_NULL(sketch, "transformer only built on sketch type");        \
       auto agg = std::static_pointer_cast<Aggregator<Kind::O, Kind::I>>(sketch); \
@@ -0,0 +1,208 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "KeySlots.h"
+
+#include <algorithm>
+#include <gflags/gflags.h>
+
+#include "surface/eval/Histogram.h"
+
+DEFINE_uint64(MAX_KEY_SLOTS, 4096, "max number of dense key slots to aggregate a block without hashing");
+
+/**
+ * Nebula runtime / dense key slots.
+ */
+namespace nebula {
+namespace execution {
+namespace core {
+
+using nebula::execution::BlockPhase;
+using nebula::execution::ColumnKey;
+using nebula::memory::Batch;
+using nebula::surface::RowData;
+using nebula::surface::eval::IntHistogram;
+using nebula::type::Kind;
+
+std::unique_ptr<KeySlots> KeySlots::make(const Batch& block, const BlockPhase& plan) {
+  if (!plan.hasAggregation() || !plan.hasColumnKeys()) {
+    return nullptr;
+  }
+
+  std::unique_ptr<KeySlots> slots{ new KeySlots() };
+  for (const auto& key : plan.columnKeys()) {
+    if (!slots->add(block, key)) {
+      return nullptr;
+    }
+  }
+
+  return slots;
+}
+
+bool KeySlots::add(const Batch& block, const ColumnKey& key) {
+  Domain domain{ key.index, block.columnType(key.column)->k(), 0, 0, {}, {} };
+
+  // partition column has its values listed by the pod for this block
+  auto values = block.partitionValues(key.column);
+  if (!values.empty()) {
+    switch (domain.kind) {
+    case Kind::BOOLEAN: {
+      for (const auto& v : values) {
+        domain.ints.push_back(std::any_cast<bool>(v));
+      }
+      break;
+    }
+#define PARTITION_INTS(KIND)                                                                \
+  case Kind::KIND: {                                                                        \
+    for (const auto& v : values) {                                                          \
+      domain.ints.push_back(std::any_cast<nebula::type::TypeTraits<Kind::KIND>::CppType>(v)); \
+    }                                                                                       \
+    break;                                                                                  \
+  }
+      PARTITION_INTS(TINYINT)
+      PARTITION_INTS(SMALLINT)
+      PARTITION_INTS(INTEGER)
+      PARTITION_INTS(BIGINT)
+#undef PARTITION_INTS
+    case Kind::VARCHAR: {
+      for (const auto& v : values) {
+        const auto& str = values_.emplace_back(std::any_cast<std::string>(v));
+        domain.strings.emplace(str, domain.strings.size());
+      }
+      break;
+    }
+    default:
+      return false;
+    }
+
+    domain.size = values.size();
+  } else {
+    switch (domain.kind) {
+    case Kind::BOOLEAN: {
+      domain.size = 2;
+      break;
+    }
+    case Kind::TINYINT:
+    case Kind::SMALLINT:
+    case Kind::INTEGER:
+    case Kind::BIGINT: {
+      // histogram range of the column in this block
+      auto h = block.histogram<IntHistogram>(key.column);
+      if (h.count == 0) {
+        return false;
+      }
+
+      const auto range = static_cast<uint64_t>(h.max()) - static_cast<uint64_t>(h.min());
+      if (range >= FLAGS_MAX_KEY_SLOTS) {
+        return false;
+      }
+
+      domain.base = h.min();
+      domain.size = range + 1;
+      break;
+    }
+    case Kind::VARCHAR: {
+      // dictionary index as slot, all distinct values are in the dictionary
+      const auto items = block.dictSize(key.column);
+      if (items == 0 || items > FLAGS_MAX_KEY_SLOTS) {
+        return false;
+      }
+
+      domain.strings.reserve(items);
+      for (size_t i = 0; i < items; ++i) {
+        domain.strings.emplace(block.dictItem(key.column, i), i);
+      }
+
+      domain.size = items;
+      break;
+    }
+    default:
+      return false;
+    }
+  }
+
+  // combined slots of all keys should be small enough
+  if (domain.size == 0 || size_ * domain.size > FLAGS_MAX_KEY_SLOTS) {
+    return false;
+  }
+
+  size_ *= domain.size;
+  domains_.push_back(std::move(domain));
+  return true;
+}
+
+size_t KeySlots::slot(const RowData& row) const {
+  size_t index = 0;
+  for (const auto& domain : domains_) {
+    auto s = slot(domain, row);
+    if (s == NONE) {
+      return NONE;
+    }
+
+    index = index * domain.size + s;
+  }
+
+  return index;
+}
+
+size_t KeySlots::slot(const Domain& domain, const RowData& row) const {
+  if (row.isNull(domain.index)) {
+    return NONE;
+  }
+
+  int64_t value = 0;
+  switch (domain.kind) {
+  case Kind::BOOLEAN: {
+    value = row.readBool(domain.index);
+    break;
+  }
+  case Kind::TINYINT: {
+    value = row.readByte(domain.index);
+    break;
+  }
+  case Kind::SMALLINT: {
+    value = row.readShort(domain.index);
+    break;
+  }
+  case Kind::INTEGER: {
+    value = row.readInt(domain.index);
+    break;
+  }
+  case Kind::BIGINT: {
+    value = row.readLong(domain.index);
+    break;
+  }
+  case Kind::VARCHAR: {
+    auto it = domain.strings.find(row.readString(domain.index));
+    return it == domain.strings.end() ? NONE : it->second;
+  }
+  default:
+    return NONE;
+  }
+
+  // partition values are a short list
+  if (!domain.ints.empty()) {
+    auto it = std::find(domain.ints.begin(), domain.ints.end(), value);
+    return it == domain.ints.end() ? NONE : std::distance(domain.ints.begin(), it);
+  }
+
+  const auto s = static_cast<uint64_t>(value) - static_cast<uint64_t>(domain.base);
+  return s < domain.size ? s : NONE;
+}
+
+} // namespace core
+} // namespace execution
+} // namespace nebula
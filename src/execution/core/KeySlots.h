@@ -0,0 +1,89 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <deque>
+#include <limits>
+#include <string_view>
+#include <unordered_map>
+
+#include "execution/ExecutionPlan.h"
+#include "memory/Batch.h"
+#include "surface/DataSurface.h"
+
+/**
+ * Key slots map group keys of a block into a dense array index.
+ * When every group key is a plain column with small value domain in the block,
+ * known from block metadata (histogram range, dictionary, partition values),
+ * a group can be addressed by the combined slot of its keys directly.
+ * So that aggregation on such block skips key hashing and comparison.
+ */
+namespace nebula {
+namespace execution {
+namespace core {
+
+class KeySlots {
+  // value domain of a single key column in current block
+  struct Domain {
+    size_t index;
+    nebula::type::Kind kind;
+    // number of slots of this key
+    size_t size;
+    // slot = value - base for integer range
+    int64_t base;
+    // slot of every known value if domain is a value list (partition values)
+    std::vector<int64_t> ints;
+    // slot of every string value (dictionary items or partition values)
+    std::unordered_map<std::string_view, size_t> strings;
+  };
+
+public:
+  // a key value out of its domain has no slot
+  static constexpr size_t NONE = std::numeric_limits<size_t>::max();
+
+  // build key slots for given block and block phase
+  // return nullptr if any key domain is unknown or all keys have too many slots
+  static std::unique_ptr<KeySlots> make(const nebula::memory::Batch&, const nebula::execution::BlockPhase&);
+
+  // get slot of given row, NONE if any key value is out of its domain
+  size_t slot(const nebula::surface::RowData&) const;
+
+  // total number of slots
+  inline size_t size() const {
+    return size_;
+  }
+
+private:
+  KeySlots() : size_{ 1 } {}
+
+  // build domain of a key column, return false if not supported
+  bool add(const nebula::memory::Batch&, const nebula::execution::ColumnKey&);
+
+  // slot of the key in its own domain
+  size_t slot(const Domain&, const nebula::surface::RowData&) const;
+
+private:
+  std::vector<Domain> domains_;
+  size_t size_;
+
+  // owned partition values referenced by string domains
+  std::deque<std::string> values_;
+};
+
+} // namespace core
+} // namespace execution
+} // namespace nebula
@@ -28,16 +28,12 @@ using nebula::common::Cursor;
 using nebula::surface::RowCursorPtr;
 using nebula::surface::RowData;
 
-folly::Future<RowCursorPtr> NodeClient::execute(const ExecutionPlan& plan) {
-  auto p = std::make_shared<folly::Promise<RowCursorPtr>>();
-
-  // start to full fill the future
-  pool_.add([&plan, &pool = pool_, p]() {
+folly::Future<RowCursorPtr> NodeClient::execute(const ExecutionPlan& plan, const TopRound& round) {
+  // start in the pool and chain the node execution, no pool thread waits for it
+  return folly::via(&pool_, [&plan, round, &pool = pool_]() {
     NodeExecutor nodeExec(BlockManager::init(), true);
-    p->setValue(nodeExec.execute(pool, plan));
+    return nodeExec.execute(pool, plan, round);
   });
-
-  return p->getFuture();
 }
 
 } // namespace core
@@ -36,7 +36,8 @@ public:
     : node_{ node }, pool_{ pool } {}
   virtual ~NodeClient() = default;
 
-  virtual folly::Future<nebula::surface::RowCursorPtr> execute(const ExecutionPlan& plan);
+  // execute the plan on the node for given round of exact top K protocol
+  virtual folly::Future<nebula::surface::RowCursorPtr> execute(const ExecutionPlan& plan, const TopRound& round);
 
   // state is used to pull state of a node - do nothing for inproc node client
   virtual void state() {}
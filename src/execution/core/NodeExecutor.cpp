@@ -16,12 +16,21 @@
 
 #include "NodeExecutor.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
 #include <gflags/gflags.h>
 
 #include "AggregationMerge.h"
 #include "BlockExecutor.h"
+#include "TopK.h"
 #include "TopSort.h"
+#include "common/Memory.h"
+#include "execution/BlockCache.h"
 #include "execution/meta/TableService.h"
+#include "execution/serde/RowCursorSerde.h"
+#include "memory/keyed/FlatRowCursor.h"
 #include "surface/eval/UDF.h"
 
 DEFINE_uint64(TOP_SORT_SCALE,
@@ -34,6 +43,16 @@ DEFINE_uint64(NODE_TIMEOUT,
               30000,
               "maximum time nebula can torelate for each query in miliseconds");
 
+DEFINE_uint64(MORSEL_ROWS,
+              0,
+              "number of rows in a morsel scheduled on a worker, 0 to size morsels by total rows and worker threads");
+
+DEFINE_bool(THREAD_LOCAL_AGG,
+            true,
+            "every worker aggregates all morsels it takes into its own table, so node merges one table per worker");
+
+DECLARE_uint64(EXACT_TOP_TTL_MS);
+
 /**
  * Nebula runtime / online meta data.
  */
@@ -41,8 +60,13 @@ namespace nebula {
 namespace execution {
 namespace core {
 
+using nebula::common::Cancellation;
+using nebula::common::Pool;
 using nebula::execution::meta::TableService;
 using nebula::memory::Batch;
+using nebula::memory::EvaledBlock;
+using nebula::memory::keyed::FlatBuffer;
+using nebula::memory::keyed::FlatRowCursor;
 using nebula::surface::EmptyRowCursor;
 using nebula::surface::RowCursorPtr;
 using nebula::surface::eval::BlockEval;
@@ -50,65 +74,395 @@ using nebula::surface::eval::BlockEval;
 // set 10 seconds for now as max time to complete a query
 static const auto NODE_TIMEOUT = std::chrono::milliseconds(FLAGS_NODE_TIMEOUT);
 
-// distribute the compute task into a promise
-folly::Future<RowCursorPtr> dist(
-  folly::ThreadPoolExecutor& pool,
-  const nebula::memory::EvaledBlock& block,
-  const BlockPhase& phase) {
-  auto p = std::make_shared<folly::Promise<RowCursorPtr>>();
-  pool.addWithPriority(
-    [&block, &phase, p]() {
-      // compute phase on block and return the result
-      p->setValue(nebula::execution::core::compute(block, phase));
+// smallest morsel when sizing morsels automatically, smaller ones cost more in scheduling and merging than compute
+static constexpr size_t MIN_MORSEL_ROWS = 16384;
+// number of morsels every worker expects to take, so a slow morsel can be balanced by others
+static constexpr size_t MORSELS_PER_WORKER = 4;
+
+// cache key of partial result of a block computed by the plan, 0 if it's not cached.
+// only sealed blocks of aggregation plans are cached, a block possibly answered by its metadata is cheap already.
+static size_t cacheKey(const EvaledBlock& block, const ExecutionPlan& plan) {
+  const auto& phase = plan.fetch<PhaseType::COMPUTE>();
+  if (BlockCache::singleton().capacity() == 0 || !phase.hasAggregation() || !block.first->sealed()) {
+    return 0;
+  }
+
+  const auto all = block.second == BlockEval::ALL;
+  if (all && !phase.metaFields().empty()) {
+    return 0;
+  }
+
+  return plan.fingerprint(!all);
+}
+
+// take out blocks of cached results, their results are copied out of the cache.
+// keys of the remaining blocks are returned, a block of non-zero key is cached once it's computed.
+static std::vector<size_t> lookup(FilteredBlocks& blocks, const ExecutionPlan& plan, std::vector<RowCursorPtr>& hits) {
+  const auto& phase = plan.fetch<PhaseType::COMPUTE>();
+  auto& cache = BlockCache::singleton();
+  std::vector<size_t> keys;
+  keys.reserve(blocks.size());
+  auto last = std::remove_if(blocks.begin(), blocks.end(), [&](const EvaledBlock& block) {
+    const auto key = cacheKey(block, plan);
+    if (key != 0) {
+      if (auto bytes = cache.get(block.first->getId(), key)) {
+        auto data = static_cast<NByte*>(Pool::getDefault().allocate(bytes->size()));
+        std::memcpy(data, bytes->data(), bytes->size());
+        hits.push_back(std::make_shared<FlatRowCursor>(
+          std::make_unique<FlatBuffer>(phase.outputSchema(), phase.fields(), data)));
+        return true;
+      }
+    }
+
+    keys.push_back(key);
+    return false;
+  });
+
+  blocks.erase(last, blocks.end());
+  return keys;
+}
+
+// compute a whole block into its own result and cache it.
+// a bypassed result is not cached, it has to be merged and it is too large to be worth it.
+static RowCursorPtr computeToCache(const Morsel& morsel, const BlockPhase& phase, size_t filter, size_t key) {
+  auto executor = std::make_shared<BlockExecutor>(morsel, phase, filter);
+  // a bypassed result is not cached, it is returned as the executor to tell it still needs a merge
+  if (executor->bypassed()) {
+    return executor;
+  }
+
+  auto flat = executor->takeResult();
+  auto bytes = std::make_shared<std::string>(flat->prepareSerde(), 0);
+  flat->serialize(reinterpret_cast<NByte*>(bytes->data()));
+  BlockCache::singleton().put(morsel.block->first->getId(), key, std::move(bytes));
+  return std::make_shared<FlatRowCursor>(std::move(flat));
+}
+
+// split all blocks into row ranges of similar size.
+// a block possibly answered by its metadata is never split, it takes no scan at all.
+// a block to cache (of non-zero key) is not split either, its result is cached as a whole.
+static std::vector<Morsel> split(
+  const FilteredBlocks& blocks, const std::vector<size_t>& keys, const BlockPhase& phase, size_t workers,
+  std::vector<size_t>& morselKeys) {
+  size_t total = 0;
+  for (const auto& block : blocks) {
+    total += block.first->getRows();
+  }
+
+  auto rows = FLAGS_MORSEL_ROWS;
+  if (rows == 0) {
+    rows = std::max(MIN_MORSEL_ROWS, total / std::max<size_t>(1, workers * MORSELS_PER_WORKER));
+  }
+
+  std::vector<Morsel> morsels;
+  morsels.reserve(blocks.size() + total / rows);
+  morselKeys.reserve(morsels.capacity());
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    const auto& block = blocks.at(i);
+    const auto size = block.first->getRows();
+    const auto key = keys.at(i);
+    if (key != 0 || (block.second == BlockEval::ALL && !phase.metaFields().empty())) {
+      morsels.emplace_back(block);
+      morselKeys.push_back(key);
+      continue;
+    }
+
+    for (size_t begin = 0; begin < size; begin += rows) {
+      morsels.emplace_back(block, begin, std::min(size, begin + rows));
+      morselKeys.push_back(0);
+    }
+  }
+
+  return morsels;
+}
+
+// morsels shared by all workers, every worker keeps taking the next morsel until all are taken.
+// a worker done with its work takes over remaining morsels, no worker idles while others have a long tail.
+// results of local workers come first, then result of every morsel computed on its own.
+// the queue owns the blocks its morsels point to, so they outlive every worker.
+struct MorselQueue {
+  explicit MorselQueue(FilteredBlocks b, const std::vector<size_t>& blockKeys, const BlockPhase& phase,
+                       size_t threads, bool local, int64_t limit)
+    : blocks{ std::move(b) },
+      keys{},
+      morsels{ split(blocks, blockKeys, phase, threads, keys) },
+      locals{ local ? std::min(threads, morsels.size()) : 0 },
+      next{ 0 },
+      budget{ limit },
+      finished{ false },
+      results(locals + morsels.size()) {}
+
+  // take next morsel, nullptr if all morsels are taken
+  inline const Morsel* take() {
+    const auto i = next++;
+    return i < morsels.size() ? &morsels[i] : nullptr;
+  }
+
+  const FilteredBlocks blocks;
+  // cache key of every morsel, non-zero for a whole block to cache, only filled by splitting blocks
+  std::vector<size_t> keys;
+  const std::vector<Morsel> morsels;
+  // number of local workers
+  const size_t locals;
+  std::atomic<size_t> next;
+  // rows still needed by a samples query with a limit, morsels not started are skipped once it runs out
+  std::atomic<int64_t> budget;
+  // all workers are done
+  std::atomic<bool> finished;
+  std::vector<folly::Try<RowCursorPtr>> results;
+};
+
+// samples without sorting need any first rows up to the limit, a query with no limit needs all rows
+static int64_t budget(const BlockPhase& phase) {
+  if (phase.hasAggregation() || phase.top() == 0 || !phase.sorts().empty()) {
+    return std::numeric_limits<int64_t>::max();
+  }
+
+  return phase.top();
+}
+
+// a worker computes morsels one at a time until all morsels are taken
+struct Worker {
+  explicit Worker(const std::shared_ptr<MorselQueue>& q, const BlockPhase& p, size_t f, Cancellation& c, size_t i,
+                  bool l, const std::shared_ptr<folly::Executor>& e)
+    : queue{ q },
+      phase{ p },
+      filter{ f },
+      cancellation{ c },
+      index{ i },
+      local{ l },
+      table{ l ? std::make_shared<BlockExecutor>(p, f) : nullptr },
+      lane{ e } {}
+
+  const std::shared_ptr<MorselQueue> queue;
+  const BlockPhase& phase;
+  // fingerprint of the filter to cache rows passing it
+  const size_t filter;
+  // a cancelled query stops its workers before their next morsel
+  Cancellation& cancellation;
+  const size_t index;
+  const bool local;
+  // the only table a local worker aggregates all its morsels into
+  const std::shared_ptr<BlockExecutor> table;
+  // lane of the query if it runs in a fair scheduler, kept alive until the worker finishes
+  const std::shared_ptr<folly::Executor> lane;
+  folly::Promise<folly::Unit> done;
+};
+
+// every step of a worker computes one morsel as a separate task of the executor,
+// so that workers of concurrent queries take turns on pool threads between morsels.
+static void step(folly::Executor& executor, const std::shared_ptr<Worker>& worker) {
+  executor.addWithPriority(
+    [&executor, w = worker]() {
+      // results of a cancelled query are dropped, no need to fill them
+      if (w->cancellation.cancelled()) {
+        w->done.setValue();
+        return;
+      }
+
+      auto& queue = *w->queue;
+      const auto i = queue.next++;
+      if (i >= queue.morsels.size()) {
+        if (w->local) {
+          queue.results[w->index] = folly::Try<RowCursorPtr>(w->table);
+        }
+
+        w->done.setValue();
+        return;
+      }
+
+      const auto& morsel = queue.morsels[i];
+      const auto key = queue.keys[i];
+      if (key != 0) {
+        queue.results[queue.locals + i] = folly::makeTryWith([&]() { return computeToCache(morsel, w->phase, w->filter, key); });
+        return step(executor, w);
+      }
+
+      if (!w->local) {
+        if (queue.budget.load(std::memory_order_relaxed) <= 0) {
+          w->done.setValue();
+          return;
+        }
+
+        auto& result = queue.results[queue.locals + i];
+        result = folly::makeTryWith([&]() {
+          return nebula::execution::core::compute(morsel, w->phase, w->filter);
+        });
+
+        if (result.hasValue()) {
+          queue.budget -= result.value()->size();
+        }
+
+        return step(executor, w);
+      }
+
+      // a failed local worker fails its only result and stops taking morsels
+      auto added = folly::makeTryWith([&]() -> RowCursorPtr {
+        w->table->add(morsel);
+        return w->table;
+      });
+
+      if (added.hasException()) {
+        queue.results[w->index] = std::move(added);
+        w->done.setValue();
+        return;
+      }
+
+      step(executor, w);
     },
     folly::Executor::HI_PRI);
+}
 
-  return p->getFuture();
+// distribute a worker into a promise.
+// a local worker aggregates all morsels it takes into one table as its only result,
+// otherwise every morsel has its own result.
+folly::Future<folly::Unit> dist(
+  folly::ThreadPoolExecutor& pool,
+  const std::shared_ptr<folly::Executor>& lane,
+  const std::shared_ptr<MorselQueue>& queue,
+  const BlockPhase& phase,
+  size_t filter,
+  Cancellation& cancellation,
+  size_t worker,
+  bool local) {
+  auto w = std::make_shared<Worker>(queue, phase, filter, cancellation, worker, local, lane);
+  auto future = w->done.getFuture();
+  step(lane ? *lane : static_cast<folly::Executor&>(pool), w);
+  return future;
 }
 
 /**
  * Execute a plan on a node level.
- * 
- * TODO(cao) - 
- * This will fanout to multiple blocks in a executor pool before return.
- * So the interfaces will be changed as async interfaces using future and promise.
+ * Filtering blocks, computing morsels, merging and top sorting are chained as continuations in the pool,
+ * no pool thread blocks on another pool task, the caller decides if and where to wait for the result.
+ * With a fair scheduler, block tasks of the query run in its own lane weighted by the plan.
+ * Once the plan is cancelled, workers stop before their next morsel and the result fails as cancelled.
  */
-RowCursorPtr NodeExecutor::execute(folly::ThreadPoolExecutor& pool, const ExecutionPlan& plan) {
+folly::Future<RowCursorPtr> NodeExecutor::execute(
+  folly::ThreadPoolExecutor& pool, const ExecutionPlan& plan, const TopRound& round) {
+  // later rounds of exact top select from the merged result kept by the first round
+  if (round.type == TopType::THRESHOLD || round.type == TopType::KEYS) {
+    if (auto bytes = TopPartials::singleton().get(plan.id(), round.type == TopType::KEYS)) {
+      return folly::makeFuture().via(&pool).thenValue([&plan, round, bytes](folly::Unit) -> RowCursorPtr {
+        const NodePhase& phase = plan.fetch<PhaseType::PARTIAL>();
+        auto data = static_cast<NByte*>(Pool::getDefault().allocate(bytes->size()));
+        std::memcpy(data, bytes->data(), bytes->size());
+        auto merged = std::make_shared<FlatRowCursor>(
+          std::make_unique<FlatBuffer>(phase.outputSchema(), phase.fields(), data));
+        return topRound(merged, phase, round);
+      });
+    }
+  }
+
   const BlockPhase& blockPhase = plan.fetch<PhaseType::COMPUTE>();
+  std::shared_ptr<folly::Executor> lane = nullptr;
+  if (scheduler_) {
+    lane = scheduler_->lane(plan.getWeight());
+  }
+
   // query total number of blocks to  executor on and
   // launch block executor on each in parallel
   // TODO(cao): this table service instance potentially can be carried by a query context on each node
   auto ts = TableService::singleton();
-  const FilteredBlocks blocks = blockManager_->query(*ts->query(blockPhase.table()), plan, pool);
-
-  LOG(INFO) << "Processing total blocks: " << blocks.size();
-  std::vector<folly::Future<RowCursorPtr>> results;
-  results.reserve(blocks.size());
-  std::transform(blocks.begin(), blocks.end(), std::back_inserter(results),
-                 [&blockPhase, &pool](const auto& block) {
-                   return dist(pool, block, blockPhase);
-                 });
-
-  // compile the results into a single row cursor
-  auto x = folly::collectAll(results).get(NODE_TIMEOUT);
-
-  // single response optimization
-  if (x.size() == 1) {
-    return x.at(0).value();
-  }
+  return blockManager_->query(*ts->query(blockPhase.table()), plan, lane ? *lane : static_cast<folly::Executor&>(pool))
+    .thenValue([&pool, &plan, &blockPhase, lane](FilteredBlocks blocks) {
+      auto& cancellation = plan.cancellation();
+      cancellation.ensure();
 
-  // depends on the query plan, if there is no aggregation
-  // the results set from different block exeuction can be simply composite together
-  // but the query needs to aggregate on keys, then we have to merge the results based on partial aggregatin plan
-  const NodePhase& phase = plan.fetch<PhaseType::PARTIAL>();
-  auto merged = merge(pool, phase.outputSchema(), phase.fields(), phase.hasAggregation(), x);
+      // blocks of cached results take no scan
+      std::vector<RowCursorPtr> hits;
+      const auto keys = lookup(blocks, plan, hits);
 
-  // if scale is 0 or this query has no limit on it
-  if (local_ || FLAGS_TOP_SORT_SCALE == 0 || phase.top() == 0) {
-    return merged;
-  }
+      // one worker per thread at most, workers pull morsels until all morsels are computed.
+      // blocks move into the queue before splitting, morsels point into the queue shared by workers.
+      const auto local = FLAGS_THREAD_LOCAL_AGG && blockPhase.hasAggregation();
+      auto queue = std::make_shared<MorselQueue>(
+        std::move(blocks), keys, blockPhase, pool.numThreads(), local, budget(blockPhase));
+      const auto workers = std::min(pool.numThreads(), queue->morsels.size());
+      LOG(INFO) << "Processing total blocks: " << queue->blocks.size() << " in morsels: " << queue->morsels.size()
+                << " by workers: " << workers << (local ? " with thread local aggregation" : "")
+                << ", cached blocks: " << hits.size();
+
+      std::vector<folly::Future<folly::Unit>> tasks;
+      tasks.reserve(workers);
+      for (size_t i = 0; i < workers; ++i) {
+        tasks.push_back(dist(pool, lane, queue, blockPhase, plan.filterFingerprint(), cancellation, i, local));
+      }
+
+      // workers still running at timeout are cancelled, the timer only holds the cancellation
+      // since it may fire after the plan is gone.
+      folly::futures::sleep(NODE_TIMEOUT)
+        .via(&pool)
+        .thenValue([c = plan.cancellationPtr(), queue](folly::Unit) {
+          if (!queue->finished) {
+            LOG(WARNING) << "Node timeout: " << FLAGS_NODE_TIMEOUT;
+            c->cancel();
+          }
+        });
+
+      // results are ready once all workers are done, including the ones cancelled at timeout.
+      // workers refer to the plan, so the result never completes while any of them is still running.
+      return folly::collectAll(tasks)
+        .via(&pool)
+        .thenValue([queue, &cancellation, hits = std::move(hits)](std::vector<folly::Try<folly::Unit>>) {
+          queue->finished = true;
+          cancellation.ensure();
+
+          // morsels skipped after the limit was met or taken by local workers have no results
+          auto& results = queue->results;
+          results.erase(
+            std::remove_if(results.begin(), results.end(), [](const folly::Try<RowCursorPtr>& r) {
+              return !r.hasValue() && !r.hasException();
+            }),
+            results.end());
+
+          for (const auto& hit : hits) {
+            results.emplace_back(hit);
+          }
+
+          return std::move(results);
+        });
+    })
+    .thenValue([&pool, &plan](std::vector<folly::Try<RowCursorPtr>> x) {
+      // single response optimization, unless its pre-aggregation was bypassed and it needs a merge
+      const NodePhase& phase = plan.fetch<PhaseType::PARTIAL>();
+      if (x.size() == 1) {
+        const auto& single = x.at(0).value();
+        auto b = dynamic_cast<BlockExecutor*>(single.get());
+        if (b == nullptr || !b->bypassed()) {
+          return folly::makeFuture(single);
+        }
+      }
+
+      // depends on the query plan, if there is no aggregation
+      // the results set from different block exeuction can be simply composite together
+      // but the query needs to aggregate on keys, then we have to merge the results based on partial aggregatin plan
+      return merge(pool, phase.outputSchema(), phase.fields(), phase.hasAggregation(), x);
+    })
+    .thenValue([&plan, round, local = local_](RowCursorPtr merged) -> RowCursorPtr {
+      const NodePhase& phase = plan.fetch<PhaseType::PARTIAL>();
+
+      // server asks for a round of exact top protocol, no truncation by scale.
+      // the merged result is kept for later rounds of the query, they don't compute blocks again.
+      if (round.type != TopType::NONE) {
+        if (round.type == TopType::TOP && FLAGS_EXACT_TOP_TTL_MS > 0) {
+          auto flat = nebula::execution::serde::asBuffer(*merged, phase.outputSchema(), phase.fields());
+          auto bytes = std::make_shared<std::string>(flat->prepareSerde(), 0);
+          flat->serialize(reinterpret_cast<NByte*>(bytes->data()));
+          TopPartials::singleton().put(plan.id(), std::move(bytes));
+          merged = std::make_shared<FlatRowCursor>(std::move(flat));
+        }
+
+        return topRound(merged, phase, round);
+      }
+
+      // if scale is 0 or this query has no limit on it
+      if (local || FLAGS_TOP_SORT_SCALE == 0 || phase.top() == 0) {
+        return merged;
+      }
 
-  return topSort<>(merged, phase, FLAGS_TOP_SORT_SCALE);
+      return topSort<>(merged, phase, FLAGS_TOP_SORT_SCALE);
+    });
 }
 
 } // namespace core
@@ -19,6 +19,7 @@
 #include <glog/logging.h>
 #include <thread>
 
+#include "Scheduler.h"
 #include "common/Folly.h"
 #include "execution/BlockManager.h"
 #include "execution/ExecutionPlan.h"
@@ -34,17 +35,22 @@ namespace core {
 // This will sit behind the service interface and do the real work.
 class NodeExecutor {
 public:
-  NodeExecutor(const std::shared_ptr<BlockManager> blockManager, bool local = false)
-    : blockManager_{ blockManager }, local_{ local } {}
+  // block tasks are scheduled fairly among queries if a scheduler is given, otherwise they go to the pool directly
+  NodeExecutor(const std::shared_ptr<BlockManager> blockManager, bool local = false, FairScheduler* scheduler = nullptr)
+    : blockManager_{ blockManager }, local_{ local }, scheduler_{ scheduler } {}
 
 public:
-  nebula::surface::RowCursorPtr execute(folly::ThreadPoolExecutor&, const ExecutionPlan&);
+  // execute the plan in the pool and return the future of its result, the plan has to outlive the future
+  folly::Future<nebula::surface::RowCursorPtr> execute(
+    folly::ThreadPoolExecutor&, const ExecutionPlan&, const TopRound& = {});
 
 private:
   const std::shared_ptr<BlockManager> blockManager_;
 
   // indicate current node executor is executing the plan with local memory (same process as server)
   const bool local_;
+
+  FairScheduler* const scheduler_;
 };
 } // namespace core
 } // namespace execution
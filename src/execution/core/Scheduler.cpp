@@ -0,0 +1,282 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "Scheduler.h"
+
+#include <algorithm>
+#include <fmt/format.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "common/Errors.h"
+
+DEFINE_string(RESOURCE_GROUPS,
+              "default:16:64:1:0",
+              "query resource groups as name:concurrency:queue:weight:maxBlocks separated by comma, "
+              "the first one is the default group. maxBlocks of 0 means no limit on query cost");
+
+/**
+ * Resource control of queries sharing one process.
+ */
+namespace nebula {
+namespace execution {
+namespace core {
+
+Admission& Admission::singleton() {
+  static Admission admission{ parse(FLAGS_RESOURCE_GROUPS) };
+  return admission;
+}
+
+// split a string by delimiter in order, empty items are skipped
+static std::vector<std::string> split(const std::string& str, char delimiter) {
+  std::vector<std::string> items;
+  size_t start = 0;
+  while (start < str.size()) {
+    auto end = str.find(delimiter, start);
+    if (end == std::string::npos) {
+      end = str.size();
+    }
+
+    if (end > start) {
+      items.push_back(str.substr(start, end - start));
+    }
+
+    start = end + 1;
+  }
+
+  return items;
+}
+
+std::vector<ResourceGroup> Admission::parse(const std::string& spec) {
+  std::vector<ResourceGroup> groups;
+  for (const auto& item : split(spec, ',')) {
+    const auto fields = split(item, ':');
+    N_ENSURE_EQ(fields.size(), 5, "resource group spec is name:concurrency:queue:weight:maxBlocks");
+    groups.push_back({ fields.at(0),
+                       std::max<size_t>(1, std::stoul(fields.at(1))),
+                       std::stoul(fields.at(2)),
+                       std::max<size_t>(1, std::stoul(fields.at(3))),
+                       std::stoul(fields.at(4)) });
+  }
+
+  return groups;
+}
+
+Admission::Admission(std::vector<ResourceGroup> groups) : groups_{ std::move(groups) } {
+  N_ENSURE(!groups_.empty(), "requires at least one resource group");
+  for (const auto& g : groups_) {
+    states_[g.name];
+  }
+}
+
+const ResourceGroup& Admission::group(const std::string& name) const {
+  for (const auto& g : groups_) {
+    if (g.name == name) {
+      return g;
+    }
+  }
+
+  return groups_.front();
+}
+
+const ResourceGroup& Admission::group(const std::unordered_set<std::string>& names) const {
+  for (const auto& g : groups_) {
+    if (names.count(g.name) > 0) {
+      return g;
+    }
+  }
+
+  return groups_.front();
+}
+
+folly::Future<Admission::TicketPtr> Admission::admit(
+  const std::string& name, size_t blocks, nebula::common::CancellationPtr cancellation) {
+  const auto& g = group(name);
+  if (g.maxBlocks > 0 && blocks > g.maxBlocks) {
+    throw NException(fmt::format("Query to scan {0} blocks is over limit {1} of group {2}", blocks, g.maxBlocks, g.name));
+  }
+
+  auto waiter = std::make_shared<Waiter>();
+  auto future = waiter->promise.getFuture();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& state = states_.at(g.name);
+    if (state.running < g.concurrency) {
+      ++state.running;
+      return folly::makeFuture(std::make_shared<Ticket>(*this, g));
+    }
+
+    if (state.waiting.size() >= g.queue) {
+      throw NException(fmt::format("Query queue of group {0} is full: {1}", g.name, state.waiting.size()));
+    }
+
+    VLOG(1) << "Query queued in group " << g.name << " behind " << state.waiting.size() << " queries";
+    waiter->cancellation = cancellation;
+    state.waiting.push_back(waiter);
+  }
+
+  // listen out of the lock, a cancellation takes its lock before calling back into this.
+  // the callback may run right away if the query is cancelled already.
+  if (cancellation) {
+    waiter->listener = cancellation->listen([this, name = g.name, w = std::weak_ptr<Waiter>(waiter)]() {
+      withdraw(name, w);
+    });
+  }
+
+  return future;
+}
+
+Admission::TicketPtr Admission::tryAdmit(const std::string& name, size_t blocks) {
+  const auto& g = group(name);
+  if (g.maxBlocks > 0 && blocks > g.maxBlocks) {
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& state = states_.at(g.name);
+  if (state.running >= g.concurrency || !state.waiting.empty()) {
+    return nullptr;
+  }
+
+  ++state.running;
+  return std::make_shared<Ticket>(*this, g);
+}
+
+void Admission::withdraw(const std::string& name, const std::weak_ptr<Waiter>& w) {
+  auto waiter = w.lock();
+  if (!waiter) {
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& waiting = states_.at(name).waiting;
+    auto it = std::find(waiting.begin(), waiting.end(), waiter);
+    // it got a slot already
+    if (it == waiting.end()) {
+      return;
+    }
+
+    waiting.erase(it);
+  }
+
+  VLOG(1) << "Query cancelled while queued in group " << name;
+  waiter->promise.setException(NException("Query cancelled while queued"));
+}
+
+void Admission::release(const std::string& name) {
+  const auto& g = group(name);
+  std::shared_ptr<Waiter> next;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& state = states_.at(g.name);
+    if (state.waiting.empty()) {
+      --state.running;
+      return;
+    }
+
+    // the slot passes to the first waiting query directly
+    next = std::move(state.waiting.front());
+    state.waiting.pop_front();
+  }
+
+  // continuations of the waiting query may run inline, fulfill it out of the lock
+  if (next->cancellation) {
+    next->cancellation->remove(next->listener);
+  }
+
+  next->promise.setValue(std::make_shared<Ticket>(*this, g));
+}
+
+std::pair<size_t, size_t> Admission::load(const std::string& name) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto& state = states_.at(group(name).name);
+  return { state.running, state.waiting.size() };
+}
+
+void FairScheduler::add(LanePtr lane, folly::Func func) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (lane->tasks_.empty()) {
+      lane->pass_ = std::max(lane->pass_, vtime_);
+      active_.push_back(lane);
+    }
+
+    lane->tasks_.push_back(std::move(func));
+  }
+
+  // every task posts one dispatch to the pool, the dispatch runs whichever task is fairest by then
+  const auto priority = lane->priority_;
+  pool_.addWithPriority([this, priority]() { dispatch(priority); }, priority);
+}
+
+void FairScheduler::dispatch(int8_t priority) {
+  LanePtr lane;
+  folly::Func task;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto next = active_.end();
+    for (auto it = active_.begin(); it != active_.end(); ++it) {
+      const auto& l = *it;
+      if (l->priority_ == priority && (l->cap_ == 0 || l->running_ < l->cap_)
+          && (next == active_.end() || l->pass_ < (*next)->pass_)) {
+        next = it;
+      }
+    }
+
+    // all lanes of the priority with tasks are capped, one of their running tasks dispatches again when it's done
+    if (next == active_.end()) {
+      ++owed_[priority];
+      return;
+    }
+
+    lane = *next;
+    task = std::move(lane->tasks_.front());
+    lane->tasks_.pop_front();
+    ++lane->running_;
+    vtime_ = lane->pass_;
+    lane->pass_ += lane->stride_;
+    if (lane->tasks_.empty()) {
+      std::swap(*next, active_.back());
+      active_.pop_back();
+    }
+  }
+
+  try {
+    task();
+  } catch (const std::exception& ex) {
+    LOG(ERROR) << "Scheduled task failed: " << ex.what();
+  }
+
+  bool redispatch = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    --lane->running_;
+    auto& owed = owed_[priority];
+    if (lane->cap_ > 0 && owed > 0 && !lane->tasks_.empty()) {
+      --owed;
+      redispatch = true;
+    }
+  }
+
+  if (redispatch) {
+    pool_.addWithPriority([this, priority]() { dispatch(priority); }, priority);
+  }
+}
+
+} // namespace core
+} // namespace execution
+} // namespace nebula
@@ -0,0 +1,213 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "common/Cancellation.h"
+#include "common/Folly.h"
+
+/**
+ * Resource control of queries sharing one process.
+ *
+ * Admission: every query runs in a resource group, a group limits number of its running queries,
+ * more queries wait in its queue until a running one finishes. A query is rejected if the queue is full
+ * or its estimated cost (number of blocks to scan) is over the limit of the group.
+ *
+ * Fair scheduling: every query (or ingestion) gets a lane of a fair scheduler wrapping the shared pool.
+ * Tasks of all lanes are picked by stride scheduling, so lanes share pool threads by their weights
+ * regardless how many tasks each of them submits. A lane can also cap number of its running tasks.
+ */
+namespace nebula {
+namespace execution {
+namespace core {
+
+// a resource group of queries
+struct ResourceGroup {
+  std::string name;
+  // max number of running queries
+  size_t concurrency;
+  // max number of queries waiting for a slot
+  size_t queue;
+  // share of pool threads of every query in the group
+  size_t weight;
+  // max number of blocks a query can scan, 0 means no limit
+  size_t maxBlocks;
+};
+
+class Admission {
+public:
+  // an admitted query holds its ticket while running, releasing the ticket admits next waiting query
+  class Ticket {
+  public:
+    Ticket(Admission& admission, const ResourceGroup& group) : admission_{ admission }, group_{ group } {}
+    ~Ticket() {
+      admission_.release(group_.name);
+    }
+
+    inline const ResourceGroup& group() const noexcept {
+      return group_;
+    }
+
+  private:
+    Admission& admission_;
+    const ResourceGroup& group_;
+  };
+
+  using TicketPtr = std::shared_ptr<Ticket>;
+
+public:
+  // groups from flag RESOURCE_GROUPS
+  static Admission& singleton();
+
+  // the first group is the default one for queries asking for no known group
+  explicit Admission(std::vector<ResourceGroup>);
+  Admission(Admission&) = delete;
+  Admission(Admission&&) = delete;
+  virtual ~Admission() = default;
+
+public:
+  // resource group of given name, default group if not found
+  const ResourceGroup& group(const std::string&) const;
+
+  // resource group of the first name found in given names, default group if none found
+  const ResourceGroup& group(const std::unordered_set<std::string>&) const;
+
+  // admit a query estimated to scan given number of blocks into a group.
+  // the future completes once the query gets a slot, it throws NException if the query is rejected.
+  // a waiting query leaves the queue once it's cancelled, its future throws NException then.
+  folly::Future<TicketPtr> admit(const std::string&, size_t, nebula::common::CancellationPtr = nullptr);
+
+  // admit a query only if a slot of the group is free and no query is waiting for one, nullptr otherwise.
+  // a running query takes more slots by it for work it can also do later, so it never waits on its own group.
+  TicketPtr tryAdmit(const std::string&, size_t);
+
+  // number of running and waiting queries of a group
+  std::pair<size_t, size_t> load(const std::string&) const;
+
+  // parse groups from spec "name:concurrency:queue:weight:maxBlocks,..."
+  static std::vector<ResourceGroup> parse(const std::string&);
+
+private:
+  // a query waiting for a slot, whoever takes it out of the queue fulfills its promise
+  struct Waiter {
+    folly::Promise<TicketPtr> promise;
+    nebula::common::CancellationPtr cancellation;
+    std::atomic<size_t> listener{ 0 };
+  };
+
+  void release(const std::string&);
+
+  // take a cancelled query out of the queue
+  void withdraw(const std::string&, const std::weak_ptr<Waiter>&);
+
+private:
+  struct State {
+    size_t running = 0;
+    std::deque<std::shared_ptr<Waiter>> waiting;
+  };
+
+  std::vector<ResourceGroup> groups_;
+  std::unordered_map<std::string, State> states_;
+  mutable std::mutex mutex_;
+};
+
+class FairScheduler {
+  // stride of a lane with weight 1, lane of weight w advances its pass by STRIDE / w every task
+  static constexpr uint64_t STRIDE = 1UL << 20;
+
+public:
+  class Lane : public folly::Executor, public std::enable_shared_from_this<Lane> {
+  public:
+    Lane(FairScheduler& scheduler, size_t weight, size_t cap, int8_t priority)
+      : scheduler_{ scheduler },
+        stride_{ STRIDE / std::max<size_t>(1, weight) },
+        cap_{ cap },
+        priority_{ priority },
+        pass_{ 0 },
+        running_{ 0 } {}
+    virtual ~Lane() = default;
+
+    virtual void add(folly::Func func) override {
+      scheduler_.add(shared_from_this(), std::move(func));
+    }
+
+    // tasks of a lane are always dispatched in the lane priority
+    virtual void addWithPriority(folly::Func func, int8_t) override {
+      add(std::move(func));
+    }
+
+  private:
+    friend class FairScheduler;
+    FairScheduler& scheduler_;
+    const uint64_t stride_;
+    // max running tasks, 0 means no cap
+    const size_t cap_;
+    // pool priority to dispatch tasks of this lane
+    const int8_t priority_;
+    // virtual time of the lane, the lane with lowest pass runs next
+    uint64_t pass_;
+    size_t running_;
+    std::deque<folly::Func> tasks_;
+  };
+
+  using LanePtr = std::shared_ptr<Lane>;
+
+public:
+  explicit FairScheduler(folly::ThreadPoolExecutor& pool) : pool_{ pool }, vtime_{ 0 } {}
+  FairScheduler(FairScheduler&) = delete;
+  FairScheduler(FairScheduler&&) = delete;
+  virtual ~FairScheduler() = default;
+
+public:
+  // a lane sharing pool threads by its weight, with at most cap tasks running at the same time if cap > 0.
+  // its tasks are dispatched to the pool in given priority, lanes of lower priority yield to the others.
+  LanePtr lane(size_t weight, size_t cap = 0, int8_t priority = folly::Executor::HI_PRI) {
+    return std::make_shared<Lane>(*this, weight, cap, priority);
+  }
+
+  inline folly::ThreadPoolExecutor& pool() const noexcept {
+    return pool_;
+  }
+
+private:
+  void add(LanePtr, folly::Func);
+
+  // run the task of the lane with lowest pass among lanes of given priority
+  void dispatch(int8_t);
+
+private:
+  folly::ThreadPoolExecutor& pool_;
+  // pass of last dispatched task, a lane becoming active starts from here so it can't claim time it was idle
+  uint64_t vtime_;
+  // dispatches skipped by priority since all lanes of the priority with tasks reached their caps
+  std::unordered_map<int8_t, size_t> owed_;
+  // lanes with waiting tasks, they are kept alive until all their tasks are dispatched
+  std::vector<LanePtr> active_;
+  std::mutex mutex_;
+};
+
+} // namespace core
+} // namespace execution
+} // namespace nebula
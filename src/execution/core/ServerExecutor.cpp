@@ -15,11 +15,18 @@
  */
 
 #include "ServerExecutor.h"
+
+#include <atomic>
+
 #include "AggregationMerge.h"
 #include "Finalize.h"
 #include "NodeConnector.h"
+#include "TopK.h"
 #include "TopSort.h"
 #include "common/Folly.h"
+#include "execution/serde/RowCursorSerde.h"
+#include "memory/keyed/FlatRowCursor.h"
+#include "memory/keyed/HashFlat.h"
 #include "surface/eval/UDF.h"
 
 // maximum timeout in ms a query can best do
@@ -34,49 +41,224 @@ namespace nebula {
 namespace execution {
 namespace core {
 
+using nebula::common::CompositeCursor;
+using nebula::memory::keyed::FlatBuffer;
+using nebula::memory::keyed::FlatViewCursor;
+using nebula::memory::keyed::HashFlat;
 using nebula::meta::NNode;
 using nebula::surface::EmptyRowCursor;
 using nebula::surface::RowCursorPtr;
+using nebula::surface::RowData;
 
 // set 10 seconds for now as max time to complete a query
 static const auto RPC_TIMEOUT = std::chrono::milliseconds(FLAGS_RPC_TIMEOUT);
 
-RowCursorPtr ServerExecutor::execute(
+// the query is given up at timeout, cancel it so that nodes stop computing it.
+// a cancelled node call completes right away and fails its result, so callers still wait for all calls
+// rather than leaving any of them referring to the plan. the timer only holds the shared cancellation,
+// it may fire after the plan is gone. the returned flag tells the timer that all calls are done.
+static std::shared_ptr<std::atomic<bool>> expire(folly::Executor& pool, const ExecutionPlan& plan) {
+  auto done = std::make_shared<std::atomic<bool>>(false);
+  folly::futures::sleep(RPC_TIMEOUT)
+    .via(&pool)
+    .thenValue([c = plan.cancellationPtr(), done](folly::Unit) {
+      if (!*done) {
+        LOG(WARNING) << "RPC Timeout: " << FLAGS_RPC_TIMEOUT;
+        c->cancel();
+      }
+    });
+
+  return done;
+}
+
+folly::Future<RowCursorPtr> ServerExecutor::execute(
+  folly::ThreadPoolExecutor& pool,
+  const ExecutionPlan& plan,
+  const std::shared_ptr<NodeConnector> connector) {
+  return run(pool, plan, connector, true);
+}
+
+folly::Future<RowCursorPtr> ServerExecutor::partial(
   folly::ThreadPoolExecutor& pool,
   const ExecutionPlan& plan,
   const std::shared_ptr<NodeConnector> connector) {
-  std::vector<folly::Future<RowCursorPtr>> results;
+  return run(pool, plan, connector, false);
+}
+
+folly::Future<RowCursorPtr> ServerExecutor::run(
+  folly::ThreadPoolExecutor& pool,
+  const ExecutionPlan& plan,
+  const std::shared_ptr<NodeConnector> connector,
+  bool final) {
+  // clients are shared by all rounds of fan out
+  auto clients = std::make_shared<std::vector<std::unique_ptr<NodeClient>>>();
   for (const NNode& node : plan.getNodes()) {
-    auto c = connector->makeClient(node, pool);
-    auto f = c->execute(plan)
-               // set time out handling
-               // TODO(cao) - add error handling too via thenError
-               .onTimeout(RPC_TIMEOUT, [&]() -> RowCursorPtr { 
-                 LOG(WARNING) << "RPC Timeout: " << FLAGS_RPC_TIMEOUT;
-                 return EmptyRowCursor::instance(); });
-
-    results.push_back(std::move(f));
+    clients->push_back(connector->makeClient(node, pool));
   }
 
-  // collect all returns and turn it into a future
-  auto x = folly::collectAll(results).get();
-
-  // only one result - don't need any aggregation or composite
+  // samples without sorting need any first rows up to the limit from all nodes.
+  // once nodes responded with enough rows, the query is cancelled so that other nodes stop and respond right away.
   const auto& phase = plan.fetch<PhaseType::GLOBAL>();
-  if (x.size() == 1) {
-    const auto& op = x.at(0);
-    if (op.hasException() || !op.hasValue()) {
-      return EmptyRowCursor::instance();
+  const auto limit = !phase.hasAggregation() && phase.top() > 0 && phase.sorts().empty() ? phase.top() : 0;
+  auto rows = std::make_shared<std::atomic<size_t>>(0);
+
+  // send the plan to all nodes for given round of exact top protocol
+  const auto fanout = [&pool, &plan, clients, limit, rows](const TopRound& round) {
+    auto done = expire(pool, plan);
+    std::vector<folly::Future<RowCursorPtr>> results;
+    for (auto& c : *clients) {
+      // a timed out node fails its result as any other node failure
+      auto f = c->execute(plan, round);
+
+      if (limit > 0) {
+        f = std::move(f).thenValue([&plan, limit, rows](RowCursorPtr result) {
+          if (result && (*rows += result->size()) >= limit) {
+            VLOG(1) << "Samples limit " << limit << " met, cancel nodes still running";
+            plan.cancellation().cancel();
+          }
+
+          return result;
+        });
+      }
+
+      results.push_back(std::move(f));
     }
 
-    return topSort(finalize(op.value(), phase), phase);
+    // collect all returns and turn it into a future
+    return folly::collectAll(results).via(&pool).thenValue([done](std::vector<folly::Try<RowCursorPtr>> x) {
+      *done = true;
+      return x;
+    });
+  };
+
+  // top K by a metric across nodes is answered exactly without shipping all rows
+  if (final && isExactTop(plan)) {
+    return exactTop(pool, plan, fanout).thenValue([&phase](RowCursorPtr result) {
+      return topSort(finalize(result, phase), phase);
+    });
   }
 
-  // multiple results using input schema as output schema used by finalize only
-  auto result = merge(pool, phase.inputSchema(), phase.fields(), phase.hasAggregation(), x);
+  auto merged = fanout(TopRound{})
+    .thenValue([&pool, &phase, final](std::vector<folly::Try<RowCursorPtr>> x) {
+      // a partial result may be kept, such as cached, it is only complete with results of all nodes
+      if (!final) {
+        for (const auto& r : x) {
+          r.throwIfFailed();
+        }
+      }
+
+      // only one result - don't need any aggregation or composite
+      if (x.size() == 1) {
+        const auto& op = x.at(0);
+        if (op.hasException() || !op.hasValue()) {
+          return folly::makeFuture<RowCursorPtr>(EmptyRowCursor::instance());
+        }
+
+        return folly::makeFuture(op.value());
+      }
+
+      // multiple results using input schema as output schema used by finalize only
+      return merge(pool, phase.inputSchema(), phase.fields(), phase.hasAggregation(), x);
+    });
+
+  if (!final) {
+    return merged;
+  }
+
+  return std::move(merged).thenValue([&phase](RowCursorPtr result) {
+    // apply sorting and limit if available
+    return topSort(finalize(result, phase), phase);
+  });
+}
+
+// merged results of nodes done so far, a snapshot of them is reported every time a node responds
+class Progressive {
+public:
+  Progressive(const FinalPhase& phase, size_t total)
+    : phase_{ phase },
+      total_{ total },
+      done_{ 0 },
+      merged_{ phase.hasAggregation() ? std::make_unique<HashFlat>(phase.inputSchema(), phase.fields()) : nullptr } {}
+
+  // merge a node result in and report all results so far, a failed node counts as done with no result
+  void add(const folly::Try<RowCursorPtr>& result, const ServerExecutor::Progress& progress) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (result.hasValue() && result.value()) {
+      auto flat = nebula::execution::serde::asBuffer(*result.value(), phase_.inputSchema(), phase_.fields());
+      if (flat && flat->getRows() > 0) {
+        if (merged_) {
+          for (size_t r = 0, size = flat->getRows(); r < size; ++r) {
+            merged_->update(flat->access(r));
+          }
+        } else {
+          flats_.push_back(std::move(flat));
+        }
+      }
+    } else if (result.hasException()) {
+      LOG(WARNING) << "Node failure in streaming query: " << result.exception().what();
+    }
+
+    ++done_;
+    progress(topSort(finalize(snapshot(), phase_), phase_), done_, total_);
+  }
+
+private:
+  // a view of all results so far, merged results keep accumulating after it is reported
+  RowCursorPtr snapshot() {
+    if (merged_) {
+      return std::make_shared<FlatViewCursor>(*merged_);
+    }
+
+    auto composite = std::make_shared<CompositeCursor<RowData>>();
+    for (auto& flat : flats_) {
+      composite->combine(std::make_shared<FlatViewCursor>(*flat));
+    }
+
+    return composite;
+  }
+
+private:
+  const FinalPhase& phase_;
+  const size_t total_;
+  size_t done_;
+  // aggregated results of all nodes, or all rows of nodes for non-aggregation queries
+  std::unique_ptr<HashFlat> merged_;
+  std::vector<std::unique_ptr<FlatBuffer>> flats_;
+  std::mutex mutex_;
+};
+
+folly::Future<folly::Unit> ServerExecutor::stream(
+  folly::ThreadPoolExecutor& pool,
+  const ExecutionPlan& plan,
+  const std::shared_ptr<NodeConnector> connector,
+  Progress progress) {
+  const auto& phase = plan.fetch<PhaseType::GLOBAL>();
+  const auto total = plan.getNodes().size();
+  if (isExactTop(plan) || total == 0) {
+    return execute(pool, plan, connector).thenValue([progress, total](RowCursorPtr result) {
+      progress(result, total, total);
+    });
+  }
+
+  // every node merges its result in as soon as it responds, in the order they arrive
+  auto progressive = std::make_shared<Progressive>(phase, total);
+  auto done = expire(pool, plan);
+  std::vector<folly::Future<folly::Unit>> reports;
+  reports.reserve(total);
+  for (const NNode& node : plan.getNodes()) {
+    // the client is kept alive until its node responds
+    std::shared_ptr<NodeClient> client = connector->makeClient(node, pool);
+    auto f = client->execute(plan, TopRound{})
+               .via(&pool)
+               .thenTry([progressive, progress, client](folly::Try<RowCursorPtr> result) {
+                 progressive->add(result, progress);
+               });
+    reports.push_back(std::move(f));
+  }
 
-  // apply sorting and limit if available
-  return topSort(finalize(result, phase), phase);
+  return folly::collectAll(reports).via(&pool).thenValue([progressive, done](std::vector<folly::Try<folly::Unit>>) {
+    *done = true;
+  });
 }
 
 } // namespace core
@@ -16,6 +16,7 @@
 
 #pragma once
 
+#include <functional>
 #include <glog/logging.h>
 
 #include "NodeClient.h"
@@ -42,12 +43,41 @@ public:
   ServerExecutor(const std::string& server)
     : server_{ server } {}
 
-  // execute the query plan to get a data set
-  nebula::surface::RowCursorPtr execute(
+  // execute the query plan to get a data set.
+  // node results are collected and merged as continuations in the pool, the plan has to outlive the returned future.
+  folly::Future<nebula::surface::RowCursorPtr> execute(
     folly::ThreadPoolExecutor&,
     const ExecutionPlan&,
     const std::shared_ptr<NodeConnector> = inproc());
 
+  // execute the query plan to get merged partial results of all nodes, before they are finalized and sorted.
+  // partial results of the same query in different time windows can be merged again, such as cached ones.
+  // it fails if any node fails or times out, rather than missing the results of the node.
+  folly::Future<nebula::surface::RowCursorPtr> partial(
+    folly::ThreadPoolExecutor&,
+    const ExecutionPlan&,
+    const std::shared_ptr<NodeConnector>);
+
+  // report final result of all nodes done so far, number of nodes done and total number of nodes.
+  // the result is only valid during the call.
+  using Progress = std::function<void(nebula::surface::RowCursorPtr, size_t, size_t)>;
+
+  // execute the query plan and report merged result every time a node responds,
+  // the last report with all nodes done is the final result. reports of a query never run concurrently.
+  // exact top queries take multiple rounds across nodes, they only report the final result.
+  folly::Future<folly::Unit> stream(
+    folly::ThreadPoolExecutor&,
+    const ExecutionPlan&,
+    const std::shared_ptr<NodeConnector>,
+    Progress);
+
+private:
+  folly::Future<nebula::surface::RowCursorPtr> run(
+    folly::ThreadPoolExecutor&,
+    const ExecutionPlan&,
+    const std::shared_ptr<NodeConnector>,
+    bool);
+
 private:
   const std::string server_;
 };
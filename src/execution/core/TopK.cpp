@@ -0,0 +1,419 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TopK.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <gflags/gflags.h>
+#include <limits>
+#include <optional>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "AggregationMerge.h"
+#include "execution/serde/RowCursorSerde.h"
+#include "memory/keyed/FlatRowCursor.h"
+#include "surface/eval/UDF.h"
+
+DEFINE_bool(EXACT_TOP, true, "use exact top K protocol for multi-node queries sorted by a SUM or COUNT metric");
+DEFINE_uint64(EXACT_TOP_TTL_MS,
+              60000,
+              "milliseconds a node keeps its merged result of an exact top query between rounds, 0 to compute every round");
+
+/**
+ * Nebula runtime / exact distributed top K.
+ */
+namespace nebula {
+namespace execution {
+namespace core {
+
+using nebula::memory::keyed::FlatBuffer;
+using nebula::memory::keyed::FlatRowCursor;
+using nebula::memory::keyed::InlineState;
+using nebula::surface::RowCursorPtr;
+using nebula::surface::RowData;
+using nebula::surface::eval::UDFType;
+using nebula::surface::eval::UdfTraits;
+using nebula::type::Kind;
+using nebula::type::Schema;
+using nebula::type::TypeTraits;
+
+static constexpr auto LOWEST = std::numeric_limits<double>::lowest();
+
+// score of a row by the sort column, higher score ranks first
+static double score(const RowData& row, size_t col, Kind kind, bool desc) {
+  double value = 0;
+  int64_t state = 0;
+  if (row.readState(col, state)) {
+    switch (kind) {
+#define STATE_SCORE(KIND)               \
+  case Kind::KIND: {                    \
+    TypeTraits<Kind::KIND>::CppType v;  \
+    std::memcpy(&v, &state, sizeof(v)); \
+    value = static_cast<double>(v);     \
+    break;                              \
+  }
+
+      STATE_SCORE(TINYINT)
+      STATE_SCORE(SMALLINT)
+      STATE_SCORE(INTEGER)
+      STATE_SCORE(BIGINT)
+      STATE_SCORE(REAL)
+      STATE_SCORE(DOUBLE)
+#undef STATE_SCORE
+    default:
+      break;
+    }
+  } else if (!row.isNull(col)) {
+    switch (kind) {
+    case Kind::TINYINT: value = row.readByte(col); break;
+    case Kind::SMALLINT: value = row.readShort(col); break;
+    case Kind::INTEGER: value = row.readInt(col); break;
+    case Kind::BIGINT: value = row.readLong(col); break;
+    case Kind::REAL: value = row.readFloat(col); break;
+    case Kind::DOUBLE: value = row.readDouble(col); break;
+    default: break;
+    }
+  }
+
+  return desc ? value : -value;
+}
+
+// encode all group keys of a row into a string which identifies the group across nodes
+static std::string encode(const RowData& row, const std::vector<size_t>& keys, const Schema& schema) {
+  std::string key;
+  const auto append = [&key](const auto& value) {
+    key.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  };
+
+  for (auto i : keys) {
+    if (row.isNull(i)) {
+      key.push_back(0);
+      continue;
+    }
+
+    key.push_back(1);
+    switch (schema->childType(i)->k()) {
+    case Kind::BOOLEAN: append(row.readBool(i)); break;
+    case Kind::TINYINT: append(row.readByte(i)); break;
+    case Kind::SMALLINT: append(row.readShort(i)); break;
+    case Kind::INTEGER: append(row.readInt(i)); break;
+    case Kind::BIGINT: append(row.readLong(i)); break;
+    case Kind::REAL: append(row.readFloat(i)); break;
+    case Kind::DOUBLE: append(row.readDouble(i)); break;
+    case Kind::INT128: append(row.readInt128(i)); break;
+    case Kind::VARCHAR: {
+      auto str = row.readString(i);
+      append(str.size());
+      key.append(str.data(), str.size());
+      break;
+    }
+    default:
+      throw NException("Not supported group key type in exact top");
+    }
+  }
+
+  return key;
+}
+
+// K-th highest value, lowest double if less than K values
+static double kth(std::vector<double> values, size_t k) {
+  if (values.size() < k) {
+    return LOWEST;
+  }
+
+  std::nth_element(values.begin(), values.begin() + (k - 1), values.end(), std::greater<double>());
+  return values.at(k - 1);
+}
+
+bool isExactTop(const ExecutionPlan& plan) {
+  if (!FLAGS_EXACT_TOP || plan.getNodes().size() < 2) {
+    return false;
+  }
+
+  const auto& phase = plan.fetch<PhaseType::PARTIAL>();
+  if (!phase.hasAggregation() || phase.top() == 0 || phase.sorts().size() != 1) {
+    return false;
+  }
+
+  // sort column has to be a SUM or COUNT carried as inline state
+  const auto col = phase.sorts().front();
+  if (!phase.isAggregateColumn(col)) {
+    return false;
+  }
+
+  const auto& f = phase.fields().at(col);
+  if (!InlineState::supports(f->outputType()) || !InlineState::supports(f->inputType())) {
+    return false;
+  }
+
+  const auto sign = f->signature();
+  const auto name = sign.substr(0, sign.find('('));
+  return name == UdfTraits<UDFType::SUM>::Name || name == UdfTraits<UDFType::COUNT>::Name;
+}
+
+// partial scores of all seen keys across rounds of the protocol, shared by continuations of all rounds
+class TopBounds {
+public:
+  TopBounds(const Schema& schema, const ExecutionPlan& plan)
+    : schema_{ schema },
+      col_{ plan.fetch<PhaseType::GLOBAL>().sorts().front() },
+      kind_{ schema->childType(col_)->k() },
+      desc_{ plan.fetch<PhaseType::GLOBAL>().isDesc() },
+      n_{ plan.getNodes().size() },
+      lows{ std::vector<double>(n_, 0) } {}
+
+  // collect partial scores of returned rows from every node
+  void collect(const FinalPhase& phase, const std::vector<folly::Try<RowCursorPtr>>& results, bool lowest) {
+    for (size_t i = 0; i < n_ && i < results.size(); ++i) {
+      const auto& result = results.at(i);
+      if (!result.hasValue() || !result.value()) {
+        continue;
+      }
+
+      auto flat = nebula::execution::serde::asBuffer(*result.value(), schema_, phase.fields());
+      for (size_t r = 0, size = flat->getRows(); r < size; ++r) {
+        const auto row = flat->access(r);
+        const auto s = score(row, col_, kind_, desc_);
+        auto& scores = partials[encode(row, phase.keys(), schema_)];
+        scores.resize(n_);
+        scores[i] = s;
+        if (lowest) {
+          lows[i] = std::min(lows[i], s);
+        }
+      }
+    }
+  }
+
+  // bounds of total score of a key: known partials plus bounds of missing ones
+  double bound(const std::vector<std::optional<double>>& scores, const std::vector<double>& missing) const {
+    double total = 0;
+    for (size_t i = 0; i < n_; ++i) {
+      total += scores[i].has_value() ? scores[i].value() : missing[i];
+    }
+
+    return total;
+  }
+
+  // K-th highest lower bound of all seen keys
+  double tau(size_t k) const {
+    std::vector<double> lowers;
+    lowers.reserve(partials.size());
+    for (const auto& p : partials) {
+      lowers.push_back(bound(p.second, lows));
+    }
+
+    return kth(std::move(lowers), k);
+  }
+
+private:
+  const Schema schema_;
+  const size_t col_;
+  const Kind kind_;
+  const bool desc_;
+  const size_t n_;
+
+public:
+  // partial scores of every seen key in each node
+  std::unordered_map<std::string, std::vector<std::optional<double>>> partials;
+  // lower bound of a missing partial score in each node, a key missing in a node may still have rows there
+  std::vector<double> lows;
+  // tau1 of round 1 and threshold of round 2
+  double tau1 = 0;
+  double threshold = 0;
+};
+
+folly::Future<RowCursorPtr> exactTop(folly::ThreadPoolExecutor& pool, const ExecutionPlan& plan, const Fanout& fanout) {
+  const auto& phase = plan.fetch<PhaseType::GLOBAL>();
+  const auto k = phase.top();
+  const auto n = plan.getNodes().size();
+  auto bounds = std::make_shared<TopBounds>(phase.inputSchema(), plan);
+
+  // every round is a continuation of the previous one, no thread waits for nodes in between
+  // round 1: local top K of each node, tau1 bounds the K-th total score from below
+  TopRound top;
+  top.type = TopType::TOP;
+  return fanout(top)
+    .thenValue([&phase, fanout, bounds, k, n](std::vector<folly::Try<RowCursorPtr>> results) {
+      bounds->collect(phase, results, true);
+      const auto tau1 = bounds->tau(k);
+
+      // round 2: every key of top K has at least one partial score >= tau1 / N.
+      // fetch everything if tau1 is not positive since the pigeonhole doesn't hold for non-positive threshold
+      TopRound round;
+      round.type = TopType::THRESHOLD;
+      round.threshold = tau1 > 0 ? std::nextafter(tau1 / n, LOWEST) : LOWEST;
+      bounds->tau1 = tau1;
+      bounds->threshold = round.threshold;
+      return fanout(round);
+    })
+    .thenValue([&phase, fanout, bounds, k, n](std::vector<folly::Try<RowCursorPtr>> results) {
+      const auto threshold = bounds->threshold;
+      bounds->collect(phase, results, false);
+
+      // a key missing in a node after round 2 is below threshold there, or it doesn't exist if everything was fetched
+      const auto all = threshold == LOWEST;
+      std::vector<double> highs(n, all ? 0 : threshold);
+      if (all) {
+        std::fill(bounds->lows.begin(), bounds->lows.end(), 0);
+      }
+
+      const auto tau2 = bounds->tau(k);
+
+      // round 3: fetch partial rows of all candidates whose upper bound reaches tau2
+      TopRound round;
+      round.type = TopType::KEYS;
+      round.threshold = 0;
+      for (const auto& p : bounds->partials) {
+        if (bounds->bound(p.second, highs) >= tau2) {
+          round.keys.push_back(p.first);
+        }
+      }
+
+      LOG(INFO) << "Exact top " << k << " on " << n << " nodes, seen keys: " << bounds->partials.size()
+                << ", candidates: " << round.keys.size() << ", tau1: " << bounds->tau1 << ", tau2: " << tau2;
+
+      return fanout(round);
+    })
+    .thenValue([&pool, &phase](std::vector<folly::Try<RowCursorPtr>> results) {
+      return merge(pool, phase.inputSchema(), phase.fields(), true, results);
+    });
+}
+
+RowCursorPtr topRound(RowCursorPtr merged, const NodePhase& phase, const TopRound& round) {
+  if (round.type == TopType::NONE) {
+    return merged;
+  }
+
+  const auto schema = phase.outputSchema();
+  const auto& fields = phase.fields();
+  const auto col = phase.sorts().front();
+  const auto kind = schema->childType(col)->k();
+  const auto desc = phase.isDesc();
+
+  auto flat = nebula::execution::serde::asBuffer(*merged, schema, fields);
+  const auto size = flat->getRows();
+
+  // pick row ids to return
+  std::vector<size_t> rows;
+  switch (round.type) {
+  case TopType::TOP: {
+    // min heap of top K scores and the lowest score row
+    using Item = std::pair<double, size_t>;
+    std::priority_queue<Item, std::vector<Item>, std::greater<Item>> heap;
+    Item lowest{ std::numeric_limits<double>::max(), 0 };
+    const auto k = phase.top();
+    for (size_t r = 0; r < size; ++r) {
+      Item item{ score(flat->access(r), col, kind, desc), r };
+      lowest = std::min(lowest, item);
+      if (heap.size() < k) {
+        heap.push(item);
+      } else if (heap.top() < item) {
+        heap.pop();
+        heap.push(item);
+      }
+    }
+
+    rows.reserve(heap.size() + 1);
+    while (!heap.empty()) {
+      rows.push_back(heap.top().second);
+      heap.pop();
+    }
+
+    if (size > k) {
+      rows.push_back(lowest.second);
+    }
+    break;
+  }
+  case TopType::THRESHOLD: {
+    for (size_t r = 0; r < size; ++r) {
+      if (score(flat->access(r), col, kind, desc) >= round.threshold) {
+        rows.push_back(r);
+      }
+    }
+    break;
+  }
+  case TopType::KEYS: {
+    std::unordered_set<std::string> keys(round.keys.begin(), round.keys.end());
+    for (size_t r = 0; r < size; ++r) {
+      if (keys.count(encode(flat->access(r), phase.keys(), schema)) > 0) {
+        rows.push_back(r);
+      }
+    }
+    break;
+  }
+  default:
+    break;
+  }
+
+  // copy selected rows with their aggregation states
+  auto result = std::make_unique<FlatBuffer>(schema, fields);
+  for (auto r : rows) {
+    result->add(flat->access(r));
+  }
+
+  return std::make_shared<FlatRowCursor>(std::move(result));
+}
+
+TopPartials& TopPartials::singleton() {
+  static TopPartials partials;
+  return partials;
+}
+
+void TopPartials::put(const std::string& id, std::shared_ptr<const std::string> bytes) {
+  if (FLAGS_EXACT_TOP_TTL_MS == 0) {
+    return;
+  }
+
+  const auto now = std::chrono::steady_clock::now();
+  std::lock_guard<std::mutex> lock(mutex_);
+  expire(now);
+  partials_[id] = { std::move(bytes), now + std::chrono::milliseconds(FLAGS_EXACT_TOP_TTL_MS) };
+}
+
+std::shared_ptr<const std::string> TopPartials::get(const std::string& id, bool take) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  expire(std::chrono::steady_clock::now());
+  auto it = partials_.find(id);
+  if (it == partials_.end()) {
+    return nullptr;
+  }
+
+  auto bytes = it->second.first;
+  if (take) {
+    partials_.erase(it);
+  }
+
+  return bytes;
+}
+
+void TopPartials::expire(std::chrono::steady_clock::time_point now) {
+  for (auto it = partials_.begin(); it != partials_.end();) {
+    if (it->second.second <= now) {
+      it = partials_.erase(it);
+      continue;
+    }
+
+    ++it;
+  }
+}
+
+} // namespace core
+} // namespace execution
+} // namespace nebula
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "common/Folly.h"
+#include "execution/ExecutionPlan.h"
+#include "surface/DataSurface.h"
+
+/**
+ * Exact distributed top K by a SUM or COUNT metric, following the three-phase uniform threshold (TPUT) protocol.
+ *
+ * Server runs 3 rounds against all nodes, only a small multiple of K rows are shipped in each round:
+ * 1. TOP: every node returns its local top K, server gets lower bound of the K-th total score (tau1).
+ * 2. THRESHOLD: every node returns all rows whose local score >= tau1 / N, a key not seen in any node
+ *    can't reach tau1. Server computes upper and lower bounds of every seen key, the K-th lower bound is tau2.
+ * 3. KEYS: keys whose upper bound reaches tau2 are candidates, every node returns its partial rows of them.
+ *    Merging these rows produces exact aggregations of all keys that may be in the final top K.
+ *
+ * A node computes its blocks in round 1 only, it keeps the merged result by query id for the later rounds.
+ *
+ * Original TPUT requires non-negative partial scores. To stay exact with negative SUM,
+ * every node also returns its lowest score row in round 1, and a missing partial score of a key
+ * is bounded by min(0, lowest score of the node) instead of 0.
+ */
+namespace nebula {
+namespace execution {
+namespace core {
+
+// fan out a round to all nodes, the future completes once results of all nodes are collected
+using Fanout = std::function<folly::Future<std::vector<folly::Try<nebula::surface::RowCursorPtr>>>(const TopRound&)>;
+
+// check if the plan asks for top K by a metric which can be answered by the exact top K protocol
+bool isExactTop(const ExecutionPlan&);
+
+// run the protocol on all nodes, return merged rows of all candidate keys for finalize and top sort.
+// rounds are chained as continuations, the plan has to outlive the returned future.
+folly::Future<nebula::surface::RowCursorPtr> exactTop(folly::ThreadPoolExecutor&, const ExecutionPlan&, const Fanout&);
+
+// node side: select rows of the merged node result as the round asks
+nebula::surface::RowCursorPtr topRound(
+  nebula::surface::RowCursorPtr,
+  const NodePhase&,
+  const TopRound&);
+
+// node side: merged node results of queries kept between rounds by query id, so that later rounds
+// select from the result of the first round rather than computing all blocks again.
+// the last round takes it out, or it expires after EXACT_TOP_TTL_MS if the query never gets there.
+class TopPartials {
+public:
+  static TopPartials& singleton();
+
+  TopPartials() = default;
+  TopPartials(TopPartials&) = delete;
+  TopPartials(TopPartials&&) = delete;
+  virtual ~TopPartials() = default;
+
+public:
+  // keep serialized merged result of a query
+  void put(const std::string&, std::shared_ptr<const std::string>);
+
+  // serialized merged result of a query, nullptr if not kept or expired. take it out if it's the last use.
+  std::shared_ptr<const std::string> get(const std::string&, bool);
+
+  inline size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return partials_.size();
+  }
+
+private:
+  void expire(std::chrono::steady_clock::time_point);
+
+private:
+  using Entry = std::pair<std::shared_ptr<const std::string>, std::chrono::steady_clock::time_point>;
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, Entry> partials_;
+};
+
+} // namespace core
+} // namespace execution
+} // namespace nebula
@@ -39,52 +39,17 @@ nebula::surface::RowCursorPtr topSort(
   }
 
   // do the aggregation from all different nodes
-  // sort and top of results
+  // sort and top of results, every sort column has its own direction
   auto schema = phase.outputSchema();
-  std::function<bool(const std::unique_ptr<nebula::surface::RowData>& left,
-                     const std::unique_ptr<nebula::surface::RowData>& right)>
-    less = nullptr;
   const auto& sorts = phase.sorts();
-  if (sorts.size() > 0) {
-    N_ENSURE(sorts.size() == 1, "support single sorting column for now");
-    const auto& col = schema->childType(sorts[0]);
-    const auto kind = col->k();
-    const auto& name = col->name();
-
-// instead of assert, we torelate column not found for sorting
-#define LESS_KIND_CASE(K, F, OP)                                             \
-  case nebula::type::Kind::K: {                                              \
-    less = [&name](const std::unique_ptr<nebula::surface::RowData>& left,    \
-                   const std::unique_ptr<nebula::surface::RowData>& right) { \
-      return left->F(name) OP right->F(name);                                \
-    };                                                                       \
-    break;                                                                   \
-  }
-#define LESS_SWITCH_DESC(OP)                \
-  switch (kind) {                           \
-    LESS_KIND_CASE(BOOLEAN, readBool, OP)   \
-    LESS_KIND_CASE(TINYINT, readByte, OP)   \
-    LESS_KIND_CASE(SMALLINT, readShort, OP) \
-    LESS_KIND_CASE(INTEGER, readInt, OP)    \
-    LESS_KIND_CASE(BIGINT, readLong, OP)    \
-    LESS_KIND_CASE(REAL, readFloat, OP)     \
-    LESS_KIND_CASE(DOUBLE, readDouble, OP)  \
-    LESS_KIND_CASE(VARCHAR, readString, OP) \
-  default:                                  \
-    less = nullptr;                         \
-  }
-
-    if (phase.isDesc()) {
-      LESS_SWITCH_DESC(<)
-    } else {
-      LESS_SWITCH_DESC(>)
-    }
-
-#undef LESS_SWITCH_DESC
-#undef LESS_KIND_CASE
+  std::vector<nebula::surface::SortColumn> columns;
+  columns.reserve(sorts.size());
+  for (size_t i = 0, size = sorts.size(); i < size; ++i) {
+    const auto index = sorts.at(i);
+    columns.emplace_back(index, schema->childType(index)->k(), phase.isDesc(i));
   }
 
-  return std::make_shared<nebula::surface::TopRows>(input, phase.top() * scale, std::move(less));
+  return std::make_shared<nebula::surface::TopRows>(input, phase.top() * scale, columns);
 }
 
 } // namespace core
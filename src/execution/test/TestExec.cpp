@@ -14,13 +14,22 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <fmt/format.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
+#include <future>
+#include <thread>
 #include <yorel/yomm2/cute.hpp>
 
+#include "execution/BlockCache.h"
+#include "execution/BlockIndex.h"
+#include "execution/BlockManager.h"
 #include "execution/ExecutionPlan.h"
+#include "execution/FilterCache.h"
 #include "execution/core/BlockExecutor.h"
+#include "execution/core/Scheduler.h"
+#include "execution/core/TopK.h"
 #include "execution/serde/RowCursorSerde.h"
 #include "memory/Batch.h"
 #include "meta/TestTable.h"
@@ -28,13 +37,22 @@
 #include "surface/eval/UDF.h"
 #include "surface/eval/ValueEval.h"
 
+DECLARE_uint64(EXACT_TOP_TTL_MS);
+
 namespace nebula {
 namespace execution {
 namespace test {
 
+using nebula::execution::core::Admission;
 using nebula::execution::core::BlockExecutor;
+using nebula::execution::core::FairScheduler;
+using nebula::execution::core::Morsel;
+using nebula::execution::core::TopPartials;
 using nebula::memory::Batch;
 using nebula::memory::EvaledBlock;
+using nebula::meta::BlockSignature;
+using nebula::meta::BlockState;
+using nebula::meta::NNode;
 using nebula::surface::MockRowData;
 using nebula::surface::RowData;
 using nebula::surface::eval::BlockEval;
@@ -94,7 +112,7 @@ public:
     }
 
   private:
-    int32_t value;
+    int32_t value = 0;
   };
 
 public:
@@ -207,6 +225,320 @@ TEST(ExecutionTest, TestRowCursorSerde) {
   }
 }
 
+TEST(ExecutionTest, TestMorsels) {
+  nebula::meta::TestTable test;
+  constexpr size_t size = 10000;
+  constexpr size_t rows = 3000;
+  Batch batch(test, size);
+  MockRowData row;
+  for (size_t i = 0; i < size; ++i) {
+    batch.add(row);
+  }
+
+  auto outputSchema = TypeSerializer::from("ROW<key:int, agg:int>");
+  nebula::execution::BlockPhase plan(test.schema(), outputSchema);
+  nebula::surface::eval::Fields selects;
+  selects.reserve(2);
+  selects.push_back(constant<int32_t>(20));
+  selects.push_back(std::make_unique<TestUdaf>());
+  plan.scan(test.name())
+    .compute(std::move(selects))
+    .filter(constant<bool>(true))
+    .keys({ 0 })
+    .aggregate(1, { false, true });
+
+  // every morsel of the block only computes rows in its own range
+  EvaledBlock eb{ &batch, BlockEval::ALL };
+  std::vector<Morsel> morsels;
+  size_t total = 0;
+  for (size_t begin = 0; begin < size; begin += rows) {
+    Morsel morsel(eb, begin, std::min(size, begin + rows));
+    EXPECT_EQ(morsel.whole(), false);
+    morsels.push_back(morsel);
+
+    auto cursor = nebula::execution::core::compute(morsel, plan);
+    EXPECT_EQ(cursor->size(), 1);
+    const auto& r = cursor->next();
+    auto count = std::static_pointer_cast<TestUdaf::Aggregator>(r.getAggregator(1))->finalize();
+    EXPECT_EQ(count, morsel.size());
+    total += count;
+  }
+
+  EXPECT_EQ(total, size);
+  EXPECT_TRUE(Morsel(eb).whole());
+
+  // a worker aggregates all morsels it takes into one table
+  size_t next = 0;
+  const auto source = [&morsels, &next]() -> const Morsel* {
+    return next < morsels.size() ? &morsels[next++] : nullptr;
+  };
+  BlockExecutor local(source, plan);
+  EXPECT_EQ(next, morsels.size());
+  EXPECT_EQ(local.size(), 1);
+  const auto& r = local.next();
+  EXPECT_EQ(std::static_pointer_cast<TestUdaf::Aggregator>(r.getAggregator(1))->finalize(), size);
+}
+
+TEST(ExecutionTest, TestAdmission) {
+  Admission admission{ Admission::parse("adhoc:1:1:1:10,report:2:0:4:0") };
+  EXPECT_EQ(admission.group("unknown").name, "adhoc");
+  EXPECT_EQ(admission.group(std::unordered_set<std::string>{ "x", "report" }).weight, 4);
+
+  // the first query runs, the second one waits in the queue, the third one is rejected
+  auto first = admission.admit("adhoc", 5);
+  EXPECT_TRUE(first.isReady());
+  auto second = admission.admit("adhoc", 5);
+  EXPECT_FALSE(second.isReady());
+  EXPECT_THROW(admission.admit("adhoc", 5), nebula::common::NebulaException);
+  EXPECT_EQ(admission.load("adhoc").first, 1);
+  EXPECT_EQ(admission.load("adhoc").second, 1);
+
+  // query over the cost limit is rejected
+  EXPECT_THROW(admission.admit("adhoc", 20), nebula::common::NebulaException);
+
+  // finishing the first query admits the second one
+  std::move(first).get().reset();
+  EXPECT_TRUE(second.isReady());
+  EXPECT_EQ(admission.load("adhoc").second, 0);
+  std::move(second).get().reset();
+  EXPECT_EQ(admission.load("adhoc").first, 0);
+
+  // a query cancelled while queued leaves the queue and never takes a slot
+  auto running = admission.admit("adhoc", 5);
+  auto cancellation = std::make_shared<nebula::common::Cancellation>();
+  auto cancelled = admission.admit("adhoc", 5, cancellation);
+  EXPECT_EQ(admission.load("adhoc").second, 1);
+  cancellation->cancel();
+  EXPECT_EQ(admission.load("adhoc").second, 0);
+  EXPECT_THROW(std::move(cancelled).get(), nebula::common::NebulaException);
+  std::move(running).get().reset();
+  EXPECT_EQ(admission.load("adhoc").first, 0);
+
+  // a slot taken without waiting is only given when the group has one free and nobody waits for it
+  auto report = admission.tryAdmit("report", 100);
+  EXPECT_NE(report, nullptr);
+  auto more = admission.tryAdmit("report", 100);
+  EXPECT_NE(more, nullptr);
+  EXPECT_EQ(admission.tryAdmit("report", 100), nullptr);
+  EXPECT_EQ(admission.tryAdmit("adhoc", 20), nullptr);
+  more.reset();
+  EXPECT_EQ(admission.load("report").first, 1);
+  report.reset();
+  EXPECT_EQ(admission.load("report").first, 0);
+}
+
+TEST(ExecutionTest, TestFairScheduler) {
+  folly::CPUThreadPoolExecutor pool{ 1 };
+  FairScheduler scheduler{ pool };
+
+  // hold the only thread so that all tasks are queued before any of them runs
+  std::promise<void> gate;
+  auto opened = gate.get_future();
+  pool.add([&opened]() { opened.wait(); });
+
+  auto heavy = scheduler.lane(3);
+  auto light = scheduler.lane(1);
+  std::vector<char> order;
+  constexpr auto tasks = 12;
+  for (auto i = 0; i < tasks; ++i) {
+    heavy->add([&order]() { order.push_back('h'); });
+    light->add([&order]() { order.push_back('l'); });
+  }
+
+  gate.set_value();
+  pool.join();
+
+  // heavy lane runs 3 tasks for every task of light lane while both have tasks
+  EXPECT_EQ(order.size(), 2 * tasks);
+  EXPECT_EQ(std::count(order.begin(), order.begin() + tasks, 'h'), 9);
+}
+
+TEST(ExecutionTest, TestBlockCache) {
+  BlockCache cache{ 10 };
+  cache.put(1, 100, std::make_shared<std::string>("1234"));
+  cache.put(1, 200, std::make_shared<std::string>("5678"));
+  cache.put(2, 100, std::make_shared<std::string>("abcd"));
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(cache.bytes(), 8);
+
+  // the oldest result is evicted for capacity
+  EXPECT_EQ(cache.get(1, 100), nullptr);
+  EXPECT_EQ(*cache.get(1, 200), "5678");
+  EXPECT_EQ(*cache.get(2, 100), "abcd");
+  EXPECT_EQ(cache.get(2, 200), nullptr);
+
+  // a removed block drops all its results
+  cache.put(2, 200, std::make_shared<std::string>("ef"));
+  EXPECT_EQ(cache.evict(2), 2);
+  EXPECT_EQ(cache.get(2, 100), nullptr);
+  EXPECT_EQ(cache.size(), 1);
+  EXPECT_EQ(cache.bytes(), 4);
+  EXPECT_EQ(cache.evict(3), 0);
+}
+
+TEST(ExecutionTest, TestFilterCache) {
+  FilterCache cache{ 1 << 20 };
+
+  // a bitmap is ready once all rows of the block are evaluated
+  Roaring first;
+  first.add(1);
+  first.add(5);
+  cache.add(1, 100, 20, 0, 10, first);
+  EXPECT_EQ(cache.get(1, 100), nullptr);
+
+  // overlapping ranges evaluated by another query don't change it
+  Roaring second;
+  second.add(5);
+  second.add(15);
+  cache.add(1, 100, 20, 5, 20, second);
+  auto matches = cache.get(1, 100);
+  ASSERT_NE(matches, nullptr);
+  EXPECT_EQ(matches->cardinality(), 3);
+  EXPECT_TRUE(matches->contains(15));
+  EXPECT_EQ(cache.get(1, 200), nullptr);
+
+  // a removed block drops all its bitmaps
+  EXPECT_EQ(cache.evict(1), 1);
+  EXPECT_EQ(cache.get(1, 100), nullptr);
+  EXPECT_EQ(cache.size(), 0);
+  EXPECT_EQ(cache.bytes(), 0);
+}
+
+TEST(ExecutionTest, TestTopPartials) {
+  TopPartials partials;
+  partials.put("q1", std::make_shared<std::string>("1234"));
+  partials.put("q2", std::make_shared<std::string>("5678"));
+  EXPECT_EQ(partials.size(), 2);
+
+  // kept between rounds until the last round takes it
+  EXPECT_EQ(*partials.get("q1", false), "1234");
+  EXPECT_EQ(*partials.get("q1", true), "1234");
+  EXPECT_EQ(partials.get("q1", false), nullptr);
+  EXPECT_EQ(partials.get("q3", false), nullptr);
+
+  // expired ones are dropped, 0 keeps nothing
+  auto ttl = FLAGS_EXACT_TOP_TTL_MS;
+  FLAGS_EXACT_TOP_TTL_MS = 1;
+  partials.put("q4", std::make_shared<std::string>("abcd"));
+  std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  EXPECT_EQ(partials.get("q4", false), nullptr);
+  EXPECT_EQ(partials.size(), 1);
+
+  FLAGS_EXACT_TOP_TTL_MS = 0;
+  partials.put("q5", std::make_shared<std::string>("ef"));
+  EXPECT_EQ(partials.get("q5", false), nullptr);
+  FLAGS_EXACT_TOP_TTL_MS = ttl;
+}
+
+TEST(ExecutionTest, TestBlockIndex) {
+  std::vector<io::BatchBlock> blocks;
+  blocks.emplace_back(BlockSignature{ "a", 1, 0, 99 }, NNode::inproc(), BlockState{ 10, 10 });
+  blocks.emplace_back(BlockSignature{ "a", 2, 100, 199 }, NNode::inproc(), BlockState{ 10, 10 });
+  blocks.emplace_back(BlockSignature{ "a", 3, 50, 450 }, NNode::inproc(), BlockState{ 10, 10 });
+  blocks.emplace_back(BlockSignature{ "a", 4, 400, 499 }, NNode::inproc(), BlockState{ 10, 10 });
+  blocks.emplace_back(BlockSignature{ "b", 5, 100, 199 }, NNode::inproc(), BlockState{ 10, 10 });
+
+  BlockIndex index;
+  for (const auto& b : blocks) {
+    index.add(b);
+  }
+
+  const auto ids = [&index](const std::string& table, const QueryWindow& window) {
+    std::vector<size_t> result;
+    index.visit(table, window, [&result](const io::BatchBlock& b) { result.push_back(b.getId()); });
+    std::sort(result.begin(), result.end());
+    return result;
+  };
+
+  EXPECT_EQ(index.count("a"), 4);
+  EXPECT_EQ(ids("a", { 120, 130 }), std::vector<size_t>({ 2, 3 }));
+  EXPECT_EQ(ids("a", { 460, 600 }), std::vector<size_t>({ 4 }));
+  EXPECT_EQ(ids("a", { 500, 600 }), std::vector<size_t>());
+  EXPECT_EQ(ids("b", { 0, 1000 }), std::vector<size_t>({ 5 }));
+  EXPECT_FALSE(index.has("c"));
+
+  // find and remove by id
+  const auto id = blocks.at(2).signature().toString();
+  ASSERT_NE(index.find(id), nullptr);
+  index.remove(*index.find(id));
+  EXPECT_EQ(index.find(id), nullptr);
+  EXPECT_EQ(ids("a", { 120, 130 }), std::vector<size_t>({ 2 }));
+
+  index.remove(blocks.at(4));
+  EXPECT_FALSE(index.has("b"));
+}
+
+TEST(ExecutionTest, TestIndexedBlocks) {
+  const auto block = [](const std::string& table, size_t id) {
+    return io::BatchBlock{ BlockSignature{ table, id, id * 100, id * 100 + 99 }, NNode::inproc(), BlockState{ 10, 10 } };
+  };
+
+  // blocks added one by one, and a duplicate
+  auto v1 = std::make_shared<IndexedBlocks>();
+  IndexedBlocksPtr blocks = v1;
+  for (size_t i = 0; i < 100; ++i) {
+    blocks = blocks->add({ block("a", i) });
+  }
+
+  blocks = blocks->add({ block("a", 10), block("b", 1) });
+  EXPECT_EQ(blocks->size(), 101);
+  EXPECT_EQ(blocks->count("a"), 100);
+  EXPECT_EQ(blocks->count("b"), 1);
+  EXPECT_EQ(v1->size(), 0);
+
+  const auto ids = [](const IndexedBlocksPtr& blocks, const std::string& table, const QueryWindow& window) {
+    std::vector<size_t> result;
+    blocks->visit(table, window, [&result](const io::BatchBlock& b) { result.push_back(b.getId()); });
+    std::sort(result.begin(), result.end());
+    return result;
+  };
+
+  EXPECT_EQ(ids(blocks, "a", { 1050, 1250 }), std::vector<size_t>({ 10, 11, 12 }));
+
+  // removing a block doesn't change the version having it
+  std::vector<io::BatchBlock> removed;
+  const auto id = block("a", 11).signature().toString();
+  auto next = blocks->remove(id, removed);
+  ASSERT_NE(next, nullptr);
+  EXPECT_EQ(removed.size(), 1);
+  EXPECT_EQ(next->find(id), nullptr);
+  EXPECT_NE(blocks->find(id), nullptr);
+  EXPECT_EQ(ids(next, "a", { 1050, 1250 }), std::vector<size_t>({ 10, 12 }));
+  EXPECT_EQ(next->remove(id, removed), nullptr);
+
+  // remove all blocks of a table
+  next = next->remove([](const io::BatchBlock& b) { return b.getTable() == "a"; }, removed);
+  EXPECT_EQ(removed.size(), 100);
+  EXPECT_FALSE(next->has("a"));
+  EXPECT_EQ(next->size(), 1);
+  EXPECT_EQ(next->blocks().size(), 1);
+}
+
+TEST(ExecutionTest, TestBlockSnapshot) {
+  auto bm = BlockManager::init();
+  const std::string table = "nebula.test.snapshot";
+  bm->add(io::BatchBlock{ BlockSignature{ table, 1, 0, 99 }, NNode::inproc(), BlockState{ 10, 10 } });
+  bm->add(io::BatchBlock{ BlockSignature{ table, 2, 100, 199 }, NNode::inproc(), BlockState{ 10, 10 } });
+
+  // a pinned snapshot doesn't see changes published after it
+  const auto pinned = bm->snapshot();
+  EXPECT_EQ(pinned->blocks->count(table), 2);
+  const auto id = BlockSignature{ table, 1, 0, 99 }.toString();
+  EXPECT_EQ(bm->removeById(id), 1);
+  EXPECT_EQ(bm->removeById(id), 0);
+
+  const auto current = bm->snapshot();
+  EXPECT_GT(current->version, pinned->version);
+  EXPECT_EQ(current->blocks->count(table), 1);
+  EXPECT_EQ(pinned->blocks->count(table), 2);
+  EXPECT_NE(pinned->blocks->find(id), nullptr);
+  EXPECT_EQ(bm->estimate(table, { 0, 1000 }), 1);
+
+  // clean up
+  bm->removeById(BlockSignature{ table, 2, 100, 199 }.toString());
+  EXPECT_FALSE(bm->snapshot()->blocks->has(table));
+}
+
 } // namespace test
 } // namespace execution
 } // namespace nebula
\ No newline at end of file
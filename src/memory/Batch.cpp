@@ -15,6 +15,7 @@
  */
 
 #include "Batch.h"
+#include <atomic>
 #include <numeric>
 
 DEFINE_int32(BESS_PAGE_SIZE, 1024, "page size for bess encoded data");
@@ -29,6 +30,12 @@ using nebula::type::Schema;
 using nebula::type::TreeBase;
 using nebula::type::TypeBase;
 
+// ids of batches in this process start from 1
+static size_t nextId() {
+  static std::atomic<size_t> id{ 0 };
+  return ++id;
+}
+
 Batch::Batch(const Table& table, size_t capacity, size_t pid)
   : schema_{ table.schema() },
     data_{ DataNode::buildDataTree(table, capacity) },
@@ -37,7 +44,8 @@ Batch::Batch(const Table& table, size_t capacity, size_t pid)
     bess_{ pod_ != nullptr ? (size_t)FLAGS_BESS_PAGE_SIZE : 0 },
     rows_{ 0 },
     fields_{ schema_->size() },
-    sealed_{ false } {
+    sealed_{ false },
+    id_{ nextId() } {
   // build a field name to data node
   for (size_t i = 0, size = schema_->size(); i < size; ++i) {
     auto f = dynamic_cast<TypeBase*>(schema_->childAt(i).get());
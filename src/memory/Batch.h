@@ -136,12 +136,32 @@ public:
   // This helps release some necessary memory used in batch building
   void seal();
 
+  // a sealed batch never changes
+  inline bool sealed() const {
+    return sealed_;
+  }
+
+  // unique id of the batch in this process, never reused by another batch
+  inline size_t getId() const {
+    return id_;
+  }
+
   // a bloom filter tester
   template <typename T>
   inline bool probably(const std::string& col, const T& value) const {
     return fields_.at(col)->probably(value);
   }
 
+  // number of distinct values of a dictionary encoded column, 0 if the column has no dictionary
+  inline size_t dictSize(const std::string& col) const {
+    return fields_.at(col)->dictSize();
+  }
+
+  // dictionary item of given index of a dictionary encoded column
+  inline std::string_view dictItem(const std::string& col, size_t index) const {
+    return fields_.at(col)->dictItem(index);
+  }
+
   // get a const reference of the histogram object for given column
   template <typename T = nebula::surface::eval::Histogram>
   inline auto histogram(const std::string& col) const ->
@@ -171,6 +191,8 @@ private:
   DnMap fields_;
 
   bool sealed_;
+
+  const size_t id_;
 };
 
 using EvaledBlock = std::pair<Batch*, nebula::surface::eval::BlockEval>;
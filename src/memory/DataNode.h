@@ -110,6 +110,16 @@ public: // data reading API
     return meta_->histogram();
   }
 
+  // number of dictionary items, 0 if this node is not dictionary encoded
+  inline size_t dictSize() const {
+    return meta_->dictSize();
+  }
+
+  // dictionary item of given dictionary index
+  inline std::string_view dictItem(size_t index) const {
+    return meta_->dictItem(index);
+  }
+
 public: // basic metadata exposure
   inline size_t entries() const {
     return count_;
@@ -91,6 +91,11 @@ public:
     return dict_.read(offset, offset2 - offset);
   }
 
+  // number of items in the dictionary
+  inline int32_t size() const {
+    return items_;
+  }
+
   void seal() {
     // release the assitant data structure
     hashItems_ = nullptr;
@@ -17,6 +17,9 @@
 #include "FlatBuffer.h"
 
 #include <gflags/gflags.h>
+
+#include "surface/eval/UDF.h"
+
 DEFINE_uint64(FB_MAIN_PAGE, 1024 * 1024, "Main memory page size");
 DEFINE_uint64(FB_DATA_PAGE, 4096 * 1024, "Data memory page size");
 DEFINE_uint64(FB_LIST_PAGE, 2048 * 1024, "List memory page size");
@@ -29,6 +32,8 @@ using nebula::common::ExtendableSlice;
 using Range = nebula::common::PRange;
 using nebula::surface::ListData;
 using nebula::surface::RowData;
+using nebula::surface::eval::UDFType;
+using nebula::surface::eval::UdfTraits;
 using nebula::type::Kind;
 using nebula::type::ListType;
 using nebula::type::TypeNode;
@@ -37,6 +42,7 @@ void FlatBuffer::initSchema() noexcept {
   // build name to index look up
   nm_.reserve(numColumns_);
   cops_.reserve(numColumns_);
+  keys_.reserve(numColumns_);
 
   // initialize keys and values
   for (size_t i = 0; i < numColumns_; ++i) {
@@ -54,8 +60,18 @@ void FlatBuffer::initSchema() noexcept {
       width = std::max(width, MAX_ALIGNMENT);
     }
 
+    // simple aggregations keep fixed width state inline rather than a sketch
+    auto op = ia ? genInlineOp(i) : InlineOp::NONE;
+    // raw value of a sketch column is its input (e.g. a string for CARDINALITY) rather than the stored type
+    auto parser = op == InlineOp::NONE ?
+                    genParser(f, i, ia ? fields_.at(i)->inputType() : kind) :
+                    genStateParser(i, op);
+
     // generate column parser for each column
-    cops_.emplace_back(genParser(f, i, kind), ia ? genSketcher(i) : nullptr, kind, width);
+    cops_.emplace_back(std::move(parser), ia ? genSketcher(i) : nullptr, kind, width, op);
+    if (!ia) {
+      keys_.emplace_back(i, kind);
+    }
   }
 }
 
@@ -335,6 +351,109 @@ Sketcher FlatBuffer::genSketcher(size_t i) noexcept {
   return {};
 }
 
+InlineOp FlatBuffer::genInlineOp(size_t i) const noexcept {
+  const auto& f = fields_.at(i);
+  if (!InlineState::supports(f->outputType()) || !InlineState::supports(f->inputType())) {
+    return InlineOp::NONE;
+  }
+
+  // UDAF has signature as "{NAME}({inner signature})"
+  const auto sign = f->signature();
+  const auto name = sign.substr(0, sign.find('('));
+  if (name == UdfTraits<UDFType::SUM>::Name) {
+    return InlineOp::SUM;
+  }
+
+  if (name == UdfTraits<UDFType::COUNT>::Name) {
+    return InlineOp::COUNT;
+  }
+
+  if (name == UdfTraits<UDFType::MIN>::Name) {
+    return InlineOp::MIN;
+  }
+
+  if (name == UdfTraits<UDFType::MAX>::Name) {
+    return InlineOp::MAX;
+  }
+
+  return InlineOp::NONE;
+}
+
+// read raw value of given column in its native type
+template <typename T>
+T readValue(const RowData&, size_t);
+
+#define READ_VALUE(TYPE, FUNC)                                   \
+  template <>                                                    \
+  inline TYPE readValue<TYPE>(const RowData& row, size_t index) { \
+    return row.FUNC(index);                                      \
+  }
+
+READ_VALUE(int8_t, readByte)
+READ_VALUE(int16_t, readShort)
+READ_VALUE(int32_t, readInt)
+READ_VALUE(int64_t, readLong)
+READ_VALUE(float, readFloat)
+READ_VALUE(double, readDouble)
+
+#undef READ_VALUE
+
+Parser FlatBuffer::genStateParser(size_t i, InlineOp op) noexcept {
+  const auto& f = fields_.at(i);
+  const auto it = f->inputType();
+
+#define STATE_BY_KIND(O) \
+  case Kind::O: {        \
+    return genStateParser<nebula::type::TypeTraits<Kind::O>::CppType>(i, op, it); \
+  }
+
+  ITERATE_STATE_KINDS(f->outputType())
+
+#undef STATE_BY_KIND
+
+  return {};
+}
+
+template <typename S>
+Parser FlatBuffer::genStateParser(size_t i, InlineOp op, Kind it) noexcept {
+  // state of an input row carrying state already, or state of its raw value
+#define STATE_PARSER(OP)                                                                       \
+  case InlineOp::OP: {                                                                         \
+    return [this, i](const RowData& row) {                                                     \
+      int64_t state;                                                                           \
+      if (row.readState(i, state)) {                                                           \
+        append(state, *main_, cops_.at(i).width);                                              \
+        return;                                                                                \
+      }                                                                                        \
+      auto value = row.isNull(i) ?                                                             \
+                     InlineState::identity<InlineOp::OP, S>() :                                \
+                     InlineState::init<InlineOp::OP, S>(readValue<InputType>(row, i));         \
+      append(value, *main_, cops_.at(i).width);                                                \
+    };                                                                                         \
+  }
+
+#define STATE_BY_KIND(I)                                              \
+  case Kind::I: {                                                     \
+    using InputType = nebula::type::TypeTraits<Kind::I>::CppType;     \
+    switch (op) {                                                     \
+      STATE_PARSER(SUM)                                               \
+      STATE_PARSER(COUNT)                                             \
+      STATE_PARSER(MIN)                                               \
+      STATE_PARSER(MAX)                                               \
+    default:                                                          \
+      break;                                                          \
+    }                                                                 \
+    break;                                                            \
+  }
+
+  ITERATE_STATE_KINDS(it)
+
+#undef STATE_BY_KIND
+#undef STATE_PARSER
+
+  return {};
+}
+
 // add a row into current batch
 // if cols is not empty, we only populate those fileds, otherwise, populate all
 size_t FlatBuffer::add(const nebula::surface::RowData& row) {
@@ -352,7 +471,9 @@ size_t FlatBuffer::add(const nebula::surface::RowData& row) {
   std::vector<bool> nulls;
   nulls.reserve(numColumns_);
   for (size_t i = 0; i < numColumns_; ++i) {
-    auto nv = appendNull(row.isNull(i), cops_.at(i).kind, *main_);
+    // inline state is never null, its parser takes care of null input
+    const auto& cop = cops_.at(i);
+    auto nv = appendNull(!cop.isInline() && row.isNull(i), cop.kind, *main_);
     nulls.push_back(nv);
   }
 
@@ -361,10 +482,11 @@ size_t FlatBuffer::add(const nebula::surface::RowData& row) {
     // push each column props
     auto nv = nulls.at(i);
     const auto& cop = cops_.at(i);
-    auto ia = cop.isAggregate();
+    auto ia = cop.isAggregate() && !cop.isInline();
     auto sketch = ia ? row.getAggregator(i) : nullptr;
     columnProps.emplace_back(nv, main_->offset - rowOffset, sketch);
-    if (!nv) {
+    // a row carrying sketch has no raw value to parse (a string column may hold serialized sketch)
+    if (!nv && sketch == nullptr) {
       cop.parser(row);
     } else if (ia) {
       // reserve space for aligned column
@@ -405,12 +527,75 @@ size_t FlatBuffer::resume(const nebula::surface::RowData& row,
   return main_->offset - origin;
 }
 
+// compute hash value of given row and column list
+// The function has very similar logic as row accessor, we inline it for perf
+// scalar keys are hashed by their own values, only strings and int128 hash bytes
+size_t FlatBuffer::hash(size_t rowId) const {
+  static constexpr size_t start = 0xC6A4A7935BD1E995UL;
+  static constexpr size_t flip = 0x3600ABC35871E005UL;
+  static constexpr size_t prime = 0x9E3779B97F4A7C15UL;
+  size_t hvalue = start;
+
+  const auto& rowProps = rows_[rowId];
+  const auto& slice = main_->slice;
+  for (const auto& key : keys_) {
+    const auto& colProps = rowProps.colProps[key.index];
+    size_t h = flip;
+    if (!colProps.isNull) {
+      const auto offset = rowProps.offset + colProps.offset;
+      switch (key.kind) {
+      case Kind::BOOLEAN:
+      case Kind::TINYINT: {
+        h = slice.read<uint8_t>(offset);
+        break;
+      }
+      case Kind::SMALLINT: {
+        h = slice.read<uint16_t>(offset);
+        break;
+      }
+      case Kind::INTEGER:
+      case Kind::REAL: {
+        h = slice.read<uint32_t>(offset);
+        break;
+      }
+      case Kind::BIGINT:
+      case Kind::DOUBLE: {
+        h = slice.read<uint64_t>(offset);
+        break;
+      }
+      case Kind::INT128: {
+        h = slice.hash<int128_t>(offset);
+        break;
+      }
+      case Kind::VARCHAR: {
+        auto r = Range::make(slice, offset);
+        h = r.size == 0 ? 0 : data_->slice.hash(r.offset, r.size);
+        break;
+      }
+      default: {
+        LOG(ERROR) << "Hash a non-supported column: " << key.index;
+        break;
+      }
+      }
+    }
+
+    hvalue = (hvalue ^ h) * prime;
+    hvalue ^= (hvalue >> 32);
+  }
+
+  return hvalue;
+}
+
 // random access to a row - may require internal seek
 const std::unique_ptr<RowData> FlatBuffer::crow(size_t rowId) const {
   // pass in row offset and column props of this row
   return std::make_unique<RowAccessor>(*this, rows_.at(rowId));
 }
 
+RowAccessor FlatBuffer::access(size_t rowId) const {
+  return RowAccessor(*this, rows_.at(rowId));
+}
+
 const RowData& FlatBuffer::row(size_t rowId) {
   // pass in row offset and column props of this row
   current_ = std::make_unique<RowAccessor>(*this, rows_.at(rowId));
@@ -436,7 +621,8 @@ FlatColumnProps FlatBuffer::rebuildColumnProps(size_t rowOffset) {
     }
 
     // for aggregated fields, rebuild its sketch from the serialized binary
-    if (cop.isAggregate()) {
+    // inline states are read from main buffer directly, no sketch needed
+    if (cop.isAggregate() && !cop.isInline()) {
       cp.sketch = cop.sketcher();
       N_ENSURE_NOT_NULL(cp.sketch, "aggregated field should have sketch");
       // load data of the sketch from main buffer since it's fit
@@ -535,6 +721,103 @@ size_t FlatBuffer::serialize(NByte* buffer) const {
   return offset;
 }
 
+size_t FlatBuffer::dedupStrings() {
+  // strings are copied into a new data buffer, distinct strings in it are looked up by hash
+  auto data = std::make_unique<Buffer>(FLAGS_FB_DATA_PAGE);
+  std::unordered_multimap<size_t, Range> dictionary;
+
+  // move the string referred by given position of a buffer into the new data buffer
+  const auto intern = [this, &data, &dictionary](Buffer& dest, size_t position) {
+    const auto r = Range::make(dest.slice, position);
+    const auto str = data_->slice.read(r.offset, r.size);
+    const auto hash = data_->slice.hash(r.offset, r.size);
+    auto range = dictionary.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second.size == r.size && data->slice.read(it->second.offset, it->second.size) == str) {
+        Range::write(dest.slice, position, it->second.offset, it->second.size);
+        return;
+      }
+    }
+
+    const auto offset = data->offset;
+    data->offset += data->slice.write(offset, (NByte*)str.data(), str.size());
+    dictionary.emplace(hash, Range{ (uint32_t)offset, r.size });
+    Range::write(dest.slice, position, offset, r.size);
+  };
+
+  for (const auto& row : rows_) {
+    for (size_t i = 0; i < numColumns_; ++i) {
+      const auto& p = row.colProps.at(i);
+      if (p.isNull || isAggregate(i)) {
+        continue;
+      }
+
+      const auto position = row.offset + p.offset;
+      const auto kind = cops_.at(i).kind;
+      if (kind == Kind::VARCHAR) {
+        intern(*main_, position);
+        continue;
+      }
+
+      if (kind != Kind::ARRAY) {
+        continue;
+      }
+
+      auto listType = std::static_pointer_cast<ListType>(schema_->childType(i));
+      if (listType->childType(0)->k() != Kind::VARCHAR) {
+        continue;
+      }
+
+      // every list item has a null byte followed by its range if it's not null
+      const auto list = Range::make(main_->slice, position);
+      auto offset = list.size;
+      for (size_t k = 0; k < list.offset; ++k) {
+        const auto isNull = (HIGH6_1 & list_->slice.read<int8_t>(offset)) != 0;
+        offset += 1;
+        if (!isNull) {
+          intern(*list_, offset);
+          offset += widthInMain(Kind::VARCHAR);
+        }
+      }
+    }
+  }
+
+  const auto saved = data_->offset - data->offset;
+  data_ = std::move(data);
+
+  // the last row can't be rolled back to old data offset any more
+  last_ = std::make_tuple(main_->offset, data_->offset, list_->offset);
+  return saved;
+}
+
+std::vector<std::string_view> FlatBuffer::segments(std::vector<size_t>& header) const {
+  // same as prepareSerde, sketches are written into data buffer first
+  serializeSketches();
+
+  // header is the same as serialize: num rows, all rows' offset, size of each block and a reserved value
+  const auto numRows = rows_.size();
+  header.clear();
+  header.push_back(numRows);
+  if (numRows == 0) {
+    return { std::string_view((const char*)header.data(), SIZET_SIZE) };
+  }
+
+  header.reserve(numRows + 5);
+  for (const auto& row : rows_) {
+    header.push_back(row.offset);
+  }
+
+  header.push_back(main_->offset);
+  header.push_back(data_->offset);
+  header.push_back(list_->offset);
+  header.push_back(MAGIC);
+
+  return { std::string_view((const char*)header.data(), header.size() * SIZET_SIZE),
+           main_->slice.read(0, main_->offset),
+           data_->slice.read(0, data_->offset),
+           list_->slice.read(0, list_->offset) };
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 RowAccessor::RowAccessor(const FlatBuffer& fb, const RowProps& rowProps)
   : fb_{ fb }, rowProps_{ rowProps } {}
@@ -593,9 +876,26 @@ std::unique_ptr<nebula::surface::MapData> RowAccessor::readMap(const std::string
 }
 
 inline std::shared_ptr<nebula::surface::eval::Sketch> RowAccessor::getAggregator(IndexType index) const {
+  // inline state has no sketch object, materialize one from the state for the caller
+  const auto& cop = fb_.cops_[index];
+  if (cop.isInline()) {
+    auto sketch = cop.sketcher();
+    sketch->load(fb_.main_->slice, rowProps_.offset + rowProps_.colProps[index].offset);
+    return sketch;
+  }
+
   return rowProps_.colProps[index].sketch;
 }
 
+bool RowAccessor::readState(IndexType index, int64_t& state) const {
+  if (!fb_.cops_[index].isInline()) {
+    return false;
+  }
+
+  state = fb_.main_->slice.read<int64_t>(rowProps_.offset + rowProps_.colProps[index].offset);
+  return true;
+}
+
 #define FORWARD_NAME_2_INDEX(TYPE, FUNC)                   \
   TYPE RowAccessor::FUNC(const std::string& field) const { \
     return FUNC(fb_.nm_.at(field));                        \
@@ -16,6 +16,8 @@
 
 #pragma once
 
+#include <algorithm>
+#include <limits>
 #include <stack>
 #include <unordered_map>
 #include <unordered_set>
@@ -104,12 +106,100 @@ using Parser = std::function<void(const nebula::surface::RowData&)>;
 // Aggregator on one column to create aggregator object associated with the row
 using Sketcher = std::function<std::shared_ptr<nebula::surface::eval::Sketch>()>;
 
+// simple aggregations have fixed width state (no more than MAX_ALIGNMENT bytes)
+// their states are stored inline in main buffer rather than in a sketch object
+// every row in a flat buffer carries the state of such column, not its raw input value
+enum class InlineOp {
+  NONE,
+  SUM,
+  COUNT,
+  MIN,
+  MAX
+};
+
+// state functions of inline aggregations
+struct InlineState {
+  // kinds supported as inline state or its input
+  static inline bool supports(nebula::type::Kind kind) {
+    switch (kind) {
+    case nebula::type::Kind::TINYINT:
+    case nebula::type::Kind::SMALLINT:
+    case nebula::type::Kind::INTEGER:
+    case nebula::type::Kind::BIGINT:
+    case nebula::type::Kind::REAL:
+    case nebula::type::Kind::DOUBLE:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // state of a single input value
+  template <InlineOp OP, typename T, typename I>
+  static inline T init(I v) {
+    if constexpr (OP == InlineOp::COUNT) {
+      return 1;
+    } else {
+      return static_cast<T>(v);
+    }
+  }
+
+  // state of a null input value, which is identity of the combine
+  template <InlineOp OP, typename T>
+  static inline T identity() {
+    if constexpr (OP == InlineOp::MIN) {
+      return std::numeric_limits<T>::max();
+    } else if constexpr (OP == InlineOp::MAX) {
+      return std::numeric_limits<T>::lowest();
+    } else {
+      return 0;
+    }
+  }
+
+  // combine two states into one
+  template <InlineOp OP, typename T>
+  static inline T combine(T s1, T s2) {
+    if constexpr (OP == InlineOp::MIN) {
+      return std::min(s1, s2);
+    } else if constexpr (OP == InlineOp::MAX) {
+      return std::max(s1, s2);
+    } else {
+      return s1 + s2;
+    }
+  }
+};
+
+// iterate all kinds supported by inline state, client provides macro STATE_BY_KIND(KIND)
+#define ITERATE_STATE_KINDS(K)  \
+  switch (K) {                  \
+    STATE_BY_KIND(TINYINT)      \
+    STATE_BY_KIND(SMALLINT)     \
+    STATE_BY_KIND(INTEGER)      \
+    STATE_BY_KIND(BIGINT)       \
+    STATE_BY_KIND(REAL)         \
+    STATE_BY_KIND(DOUBLE)       \
+  default:                      \
+    break;                      \
+  }
+
+// a key column, hash and comparison are specialized by its kind
+struct KeyColumn {
+  explicit KeyColumn(size_t i, nebula::type::Kind k)
+    : index{ i }, kind{ k } {}
+
+  size_t index;
+  nebula::type::Kind kind;
+};
+
 struct ColumnOperations {
   explicit ColumnOperations(Parser p, Sketcher s, nebula::type::Kind k, size_t w)
+    : ColumnOperations(std::move(p), std::move(s), k, w, InlineOp::NONE) {}
+  explicit ColumnOperations(Parser p, Sketcher s, nebula::type::Kind k, size_t w, InlineOp o)
     : parser{ std::move(p) },
       sketcher{ std::move(s) },
       kind{ k },
-      width{ w } {}
+      width{ w },
+      op{ o } {}
 
   // function to parse a row data
   Parser parser;
@@ -123,9 +213,16 @@ struct ColumnOperations {
   // column width if not null or reserved for sketch
   size_t width;
 
+  // inline aggregation of this column, NONE if the column is not aggregated or using sketch
+  InlineOp op;
+
   inline bool isAggregate() const {
     return sketcher != nullptr;
   }
+
+  inline bool isInline() const {
+    return op != InlineOp::NONE;
+  }
 };
 
 class FlatBuffer {
@@ -157,10 +254,23 @@ public:
   // const version without internal cache
   const std::unique_ptr<nebula::surface::RowData> crow(size_t) const;
 
+  // accessor of given row without internal cache nor allocation, safe to read in multiple threads
+  RowAccessor access(size_t) const;
+
+  // compute hash value of given row on all key (non-aggregated) columns
+  // the same keys in different flat buffers of the same schema have the same hash value
+  size_t hash(size_t rowId) const;
+
   inline auto getRows() const {
     return rows_.size();
   }
 
+  // estimated bytes allocated by this flat buffer, not counting sketch objects
+  virtual size_t allocation() const {
+    return main_->slice.capacity() + data_->slice.capacity() + list_->slice.capacity() +
+           rows_.capacity() * sizeof(RowProps) + rows_.size() * numColumns_ * sizeof(ColumnProps);
+  }
+
   inline size_t prepareSerde() const {
     LOG(INFO) << "sketch size:" << serializeSketches();
     return SIZET_SIZE +                                   // num rows
@@ -174,10 +284,25 @@ public:
 
   size_t serialize(NByte*) const;
 
+  // store every distinct string of key columns (including strings in lists) once in data buffer,
+  // rows of the same string refer to the same bytes. It keeps the same format so readers need nothing to decode it.
+  // It's supposed to be called once all rows are added and before serialization, it returns number of bytes saved.
+  size_t dedupStrings();
+
+  // serialized form of this buffer as memory segments in order without copying them: given header
+  // followed by main, data and list buffers. Put together, they are the same bytes written by serialize.
+  // segments refer to memory of this buffer and the header, they are valid while both are alive.
+  std::vector<std::string_view> segments(std::vector<size_t>& header) const;
+
   const nebula::type::Schema& schema() const {
     return schema_;
   }
 
+  // check if a column stores its aggregation state inline
+  inline bool isInline(size_t col) const noexcept {
+    return cops_.at(col).isInline();
+  }
+
   inline const void* chunk() const {
     return chunk_;
   }
@@ -199,6 +324,16 @@ private:
 
   Sketcher genSketcher(size_t) noexcept;
 
+  // decide if an aggregated column can store its state inline
+  InlineOp genInlineOp(size_t) const noexcept;
+
+  // parser of inline state column, it takes state from input row if it carries one
+  // otherwise it converts the raw input value into a state
+  Parser genStateParser(size_t, InlineOp) noexcept;
+
+  template <typename S>
+  Parser genStateParser(size_t, InlineOp, nebula::type::Kind) noexcept;
+
   // build column properties of given row offset
   FlatColumnProps rebuildColumnProps(size_t);
 
@@ -227,6 +362,9 @@ protected:
   // parsers are function pointers to parse row data of each column
   std::vector<ColumnOperations> cops_;
 
+  // key columns, which are all non-aggregated columns
+  std::vector<KeyColumn> keys_;
+
   // offset of last row used for supporting roll back
   std::tuple<size_t, size_t, size_t> last_;
 
@@ -267,6 +405,9 @@ public:
   // fetch aggregator object for given column
   std::shared_ptr<nebula::surface::eval::Sketch> getAggregator(const std::string&) const override;
 
+  // read inline aggregation state for given column
+  bool readState(IndexType, int64_t&) const override;
+
   bool isNull(IndexType) const override;
   bool readBool(IndexType) const override;
   int8_t readByte(IndexType) const override;
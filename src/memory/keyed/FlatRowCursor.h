@@ -50,6 +50,27 @@ private:
   std::unique_ptr<FlatBuffer> flat_;
 };
 
+// a cursor reading rows of a flat buffer owned by others, the buffer has to outlive the cursor
+class FlatViewCursor : public nebula::surface::RowCursor {
+public:
+  explicit FlatViewCursor(FlatBuffer& flat)
+    : nebula::surface::RowCursor(flat.getRows()),
+      flat_{ flat } {}
+
+  virtual ~FlatViewCursor() = default;
+
+  virtual const nebula::surface::RowData& next() override {
+    return flat_.row(index_++);
+  }
+
+  virtual std::unique_ptr<nebula::surface::RowData> item(size_t index) const override {
+    return flat_.crow(index);
+  }
+
+private:
+  FlatBuffer& flat_;
+};
+
 } // namespace keyed
 } // namespace memory
 } // namespace nebula
\ No newline at end of file
@@ -30,158 +30,22 @@ using nebula::type::TypeTraits;
 
 void HashFlat::init() {
   ops_.reserve(numColumns_);
-  keys_.reserve(numColumns_);
   values_.reserve(numColumns_);
 
   for (size_t i = 0; i < numColumns_; ++i) {
-    // every column may have its own operations
-    ops_.emplace_back(genComparator(i), genHasher(i), genCopier(i));
-    if (!isAggregate(i)) {
-      keys_.emplace(i);
-    } else {
-      values_.emplace(i);
+    // every value column has its own copier
+    ops_.emplace_back(genCopier(i));
+    const auto& cop = cops_.at(i);
+    if (!cop.isAggregate()) {
+      continue;
     }
-  }
-
-  // set a max load factor to reduce rehash
-  rowKeys_.max_load_factor(0.5);
-}
-
-Comparator HashFlat::genComparator(size_t i) noexcept {
-  // only need for key
-  if (isAggregate(i)) {
-    return {};
-  }
-
-#define PREPARE_AND_NULLCHECK()                     \
-  const auto& row1Props = rows_[row1];              \
-  const auto& row2Props = rows_[row2];              \
-  auto row1Offset = row1Props.offset;               \
-  auto row2Offset = row2Props.offset;               \
-  const auto& colProps1 = row1Props.colProps.at(i); \
-  const auto& colProps2 = row2Props.colProps.at(i); \
-  if (colProps1.isNull != colProps2.isNull) {       \
-    return -1;                                      \
-  }                                                 \
-  if (colProps1.isNull) {                           \
-    return 0;                                       \
-  }
-
-#define TYPE_COMPARE(KIND, TYPE)                                                                       \
-  case Kind::KIND: {                                                                                   \
-    return [this, i](size_t row1, size_t row2) -> int {                                                \
-      PREPARE_AND_NULLCHECK()                                                                          \
-      return main_->slice.compare<TYPE>(row1Offset + colProps1.offset, row2Offset + colProps2.offset); \
-    };                                                                                                 \
-  }
-
-  // fetch value
-  Kind k = cops_.at(i).kind;
-  // we only support primitive types for keys
-  switch (k) {
-    TYPE_COMPARE(BOOLEAN, bool)
-    TYPE_COMPARE(TINYINT, int8_t)
-    TYPE_COMPARE(SMALLINT, int16_t)
-    TYPE_COMPARE(INTEGER, int32_t)
-    TYPE_COMPARE(BIGINT, int64_t)
-    TYPE_COMPARE(REAL, int32_t)
-    TYPE_COMPARE(DOUBLE, int64_t)
-    TYPE_COMPARE(INT128, int128_t)
-  case Kind::VARCHAR: {
-    // read the real data from data_
-    // TODO(cao) - we don't need convert strings from bytes for hash
-    // instead, slice should be able to compare two byte range
-    return [this, i](size_t row1, size_t row2) -> int {
-      PREPARE_AND_NULLCHECK()
-
-      // offset and length of each
-      auto r1 = Range::make(main_->slice, row1Offset + colProps1.offset);
-      auto r2 = Range::make(main_->slice, row2Offset + colProps2.offset);
-
-      // length has to be the same
-      if (r1.size != r2.size) {
-        return r1.size - r2.size;
-      }
-
-      return data_->slice.compare(r1.offset, r2.offset, r1.size);
-    };
-  }
-  default:
-    return [i](size_t, size_t) -> int {
-      LOG(ERROR) << "Compare a non-supported column: " << i;
-      return 0;
-    };
-  }
-
-#undef PREPARE_AND_NULLCHECK
-#undef TYPE_COMPARE
-}
-
-Hasher HashFlat::genHasher(size_t i) noexcept {
-  static constexpr size_t flip = 0x3600ABC35871E005UL;
-
-  // only need for key
-  if (isAggregate(i)) {
-    return {};
-  }
-
-  // TODO(why do we hash these bytes instead using its own value?)
-#define PREPARE_AND_NULL()                        \
-  const auto& rowProps = rows_.at(row);           \
-  auto rowOffset = rowProps.offset;               \
-  const auto& colProps = rowProps.colProps.at(i); \
-  if (colProps.isNull) {                          \
-    return (hash ^ flip) >> 32;                   \
-  }
 
-#define TYPE_HASH(KIND, TYPE)                                        \
-  case Kind::KIND: {                                                 \
-    return [this, i](size_t row, size_t hash) {                      \
-      PREPARE_AND_NULL()                                             \
-      auto h = main_->slice.hash<TYPE>(rowOffset + colProps.offset); \
-      return (hash ^ h) >> 32;                                       \
-    };                                                               \
-  }
-
-  // fetch value
-  Kind k = cops_.at(i).kind;
-  switch (k) {
-    TYPE_HASH(BOOLEAN, bool)
-    TYPE_HASH(TINYINT, int8_t)
-    TYPE_HASH(SMALLINT, int16_t)
-    TYPE_HASH(INTEGER, int32_t)
-    TYPE_HASH(BIGINT, int64_t)
-    TYPE_HASH(REAL, int32_t)
-    TYPE_HASH(DOUBLE, int64_t)
-    TYPE_HASH(INT128, int128_t)
-  case Kind::VARCHAR: {
-    // read 4 bytes offset and 4 bytes length
-    return [this, i](size_t row, size_t hash) {
-      PREPARE_AND_NULL()
-
-      auto so = rowOffset + colProps.offset;
-      auto r = Range::make(main_->slice, so);
-
-      // read the real data from data_
-      // TODO(cao) - we don't need convert strings from bytes for hash
-      // instead, slice should be able to hash the range[offset, len] much cheaper
-      if (r.size == 0) {
-        return hash;
-      }
-
-      auto h = data_->slice.hash(r.offset, r.size);
-      return (hash ^ h) >> 32;
-    };
-  }
-  default:
-    return [i](size_t, size_t) -> size_t {
-      LOG(ERROR) << "Hash a non-supported column: " << i;
-      return 0;
-    };
+    if (cop.isInline()) {
+      states_.emplace_back(i);
+    } else {
+      values_.emplace_back(i);
+    }
   }
-
-#undef PREPARE_AND_NULL
-#undef TYPE_HASH
 }
 
 // TODO(cao): I spent a couple of days trying to nail down which GCC optimization
@@ -199,6 +63,45 @@ Copier HashFlat::genCopier(size_t i) noexcept {
   const auto ot = f->outputType();
   const auto it = f->inputType();
 
+  // inline states are combined in place in main buffer
+  if (cops_.at(i).isInline()) {
+#define STATE_COPIER(OP)                                                   \
+  case InlineOp::OP: {                                                     \
+    return [this, i](size_t row1, size_t row2) {                           \
+      const auto& row1Props = rows_[row1];                                 \
+      const auto& row2Props = rows_[row2];                                 \
+      auto& slice = main_->slice;                                          \
+      const auto offset1 = row1Props.offset + row1Props.colProps[i].offset; \
+      const auto offset2 = row2Props.offset + row2Props.colProps[i].offset; \
+      slice.write(offset2,                                                 \
+                  InlineState::combine<InlineOp::OP, StateType>(           \
+                    slice.read<StateType>(offset2),                        \
+                    slice.read<StateType>(offset1)));                      \
+    };                                                                     \
+  }
+
+#define STATE_BY_KIND(O)                                         \
+  case Kind::O: {                                                \
+    using StateType = TypeTraits<Kind::O>::CppType;              \
+    switch (cops_.at(i).op) {                                    \
+      STATE_COPIER(SUM)                                          \
+      STATE_COPIER(COUNT)                                        \
+      STATE_COPIER(MIN)                                          \
+      STATE_COPIER(MAX)                                          \
+    default:                                                     \
+      break;                                                     \
+    }                                                            \
+    break;                                                       \
+  }
+
+    ITERATE_STATE_KINDS(ot)
+
+#undef STATE_BY_KIND
+#undef STATE_COPIER
+
+    return {};
+  }
+
 // below provides a template to write core logic for all input / output type combinations
 #define LOGIC_BY_IO(O, I)                                                                  \
   case Kind::I: {                                                                          \
@@ -217,7 +120,7 @@ Copier HashFlat::genCopier(size_t i) noexcept {
         return;                                                                            \
       }                                                                                    \
       auto row1Offset = row1Props.offset + colProps1.offset;                               \
-      auto value = main_->slice.read<InputType>(row1Offset);                               \
+      auto value = readInput<InputType>(row1Offset);                                       \
       auto agg = std::static_pointer_cast<Aggregator<Kind::O, Kind::I>>(colProps2.sketch); \
       agg->merge(value);                                                                   \
     };                                                                                     \
@@ -232,26 +135,69 @@ Copier HashFlat::genCopier(size_t i) noexcept {
   return {};
 }
 
-// compute hash value of given row and column list
-// The function has very similar logic as row accessor, we inline it for perf
-size_t HashFlat::hash(size_t rowId) const {
-  static constexpr size_t start = 0xC6A4A7935BD1E995UL;
-  size_t hvalue = start;
-
-  // hash on every column
-  for (auto index : keys_) {
-    hvalue = ops_.at(index).hasher(rowId, hvalue);
-  }
-
-  return hvalue;
-}
-
 // check if two rows are equal to each other on given columns
 bool HashFlat::equal(size_t row1, size_t row2) const {
-  for (auto index : keys_) {
-    if (ops_.at(index).comparator(row1, row2) != 0) {
+  const auto& row1Props = rows_[row1];
+  const auto& row2Props = rows_[row2];
+  auto& slice = main_->slice;
+  for (const auto& key : keys_) {
+    const auto& colProps1 = row1Props.colProps[key.index];
+    const auto& colProps2 = row2Props.colProps[key.index];
+    if (colProps1.isNull != colProps2.isNull) {
       return false;
     }
+
+    if (colProps1.isNull) {
+      continue;
+    }
+
+    const auto offset1 = row1Props.offset + colProps1.offset;
+    const auto offset2 = row2Props.offset + colProps2.offset;
+
+#define TYPE_EQUAL(TYPE)                                        \
+  if (slice.read<TYPE>(offset1) != slice.read<TYPE>(offset2)) { \
+    return false;                                               \
+  }                                                             \
+  break;
+
+    switch (key.kind) {
+    case Kind::BOOLEAN:
+    case Kind::TINYINT: {
+      TYPE_EQUAL(int8_t)
+    }
+    case Kind::SMALLINT: {
+      TYPE_EQUAL(int16_t)
+    }
+    case Kind::INTEGER:
+    case Kind::REAL: {
+      TYPE_EQUAL(int32_t)
+    }
+    case Kind::BIGINT:
+    case Kind::DOUBLE: {
+      TYPE_EQUAL(int64_t)
+    }
+    case Kind::INT128: {
+      if (slice.compare<int128_t>(offset1, offset2) != 0) {
+        return false;
+      }
+      break;
+    }
+    case Kind::VARCHAR: {
+      // offset and length of each, length has to be the same
+      auto r1 = Range::make(slice, offset1);
+      auto r2 = Range::make(slice, offset2);
+      if (r1.size != r2.size || data_->slice.compare(r1.offset, r2.offset, r1.size) != 0) {
+        return false;
+      }
+      break;
+    }
+    default: {
+      LOG(ERROR) << "Compare a non-supported column: " << key.index;
+      break;
+    }
+    }
+
+#undef TYPE_EQUAL
   }
 
   return true;
@@ -264,14 +210,53 @@ bool HashFlat::update(const nebula::surface::RowData& row) {
   this->add(row);
 
   auto newRow = getRows() - 1;
-  auto hValue = hash(newRow);
-  Key key{ *this, newRow, hValue };
-  auto itr = rowKeys_.find(key);
-  if (itr != rowKeys_.end()) {
+  auto result = rowKeys_.emplace(hash(newRow), newRow, [this, newRow](size_t existing) {
+    return equal(existing, newRow);
+  });
+
+  return settle(newRow, result.first);
+}
+
+bool HashFlat::update(const nebula::surface::RowData& row, size_t slot) {
+  if (UNLIKELY(slot >= slotRows_.size())) {
+    slotRows_.resize(std::max(slot + 1, slotRows_.size() * 2), NONE);
+  }
+
+  this->add(row);
+
+  auto newRow = getRows() - 1;
+  auto& target = slotRows_[slot];
+  if (target == NONE) {
+    // first row of the slot is resolved by key, so the same key is found either by slot or by hash
+    target = rowKeys_.emplace(hash(newRow), newRow, [this, newRow](size_t existing) {
+                       return equal(existing, newRow);
+                     })
+               .first;
+  }
+
+  return settle(newRow, target);
+}
+
+void HashFlat::resetSlots() {
+  std::fill(slotRows_.begin(), slotRows_.end(), NONE);
+}
+
+void HashFlat::append(const nebula::surface::RowData& row) {
+  this->add(row);
+
+  auto newRow = getRows() - 1;
+  settle(newRow, newRow);
+}
+
+bool HashFlat::settle(size_t newRow, size_t target) {
+  if (target != newRow) {
     // copy the new row data into target for non-keys
-    auto oldRow = std::get<1>(*itr);
+    for (size_t i : states_) {
+      ops_[i](newRow, target);
+    }
+
     for (size_t i : values_) {
-      ops_.at(i).copier(newRow, oldRow);
+      ops_.at(i)(newRow, target);
     }
 
     // rollback the new added row
@@ -280,17 +265,15 @@ bool HashFlat::update(const nebula::surface::RowData& row) {
     return true;
   }
 
-  // resume all values population and add a new row key
-  rowKeys_.insert(key);
-
   // since this is a new row, create aggregator for all its value fields
+  // inline states are already initialized by parsing the row
   auto& rowProps = rows_.at(newRow);
   for (size_t i : values_) {
     auto& sketch = rowProps.colProps.at(i).sketch;
     if (sketch == nullptr) {
       sketch = cops_.at(i).sketcher();
       // since this is the first time sketch created, merge its own value
-      ops_.at(i).copier(newRow, newRow);
+      ops_.at(i)(newRow, newRow);
     }
   }
 
@@ -16,10 +16,10 @@
 
 #pragma once
 
-// #include <folly/container/F14Set.h>
-#include <unordered_set>
+#include <limits>
 
 #include "FlatBuffer.h"
+#include "RowTable.h"
 #include "surface/DataSurface.h"
 #include "surface/eval/ValueEval.h"
 
@@ -31,30 +31,10 @@ namespace keyed {
 * And, hash flat will not allow duplicate keys in the data set.
 */
 
-// column comparator between two rows
-using Comparator = std::function<int32_t(size_t, size_t)>;
-
-// Hasher on one column of given row and base hash value
-using Hasher = std::function<size_t(size_t, size_t)>;
-
 // Copier on one column from given row1 to row2 which using external updater
 using Copier = std::function<void(size_t, size_t)>;
 
-struct ColOps {
-  explicit ColOps(Comparator c, Hasher h, Copier o)
-    : comparator{ std::move(c) },
-      hasher{ std::move(h) },
-      copier{ std::move(o) } {}
-
-  Comparator comparator;
-  Hasher hasher;
-  Copier copier;
-};
-
 class HashFlat : public FlatBuffer {
-  // key is tuple of hash flat object, row id, row hash (by keys)
-  using Key = std::tuple<HashFlat&, size_t, size_t>;
-
 public:
   HashFlat(const nebula::type::Schema schema,
            const nebula::surface::eval::Fields& fields)
@@ -70,51 +50,63 @@ public:
 
   virtual ~HashFlat() = default;
 
-  // compute hash value of given row and column list
-  size_t hash(size_t rowId) const;
-
   // check if two rows are equal to each other on given columns
   bool equal(size_t row1, size_t row2) const;
 
-  // copy data of row1 into row2
-  bool copy(size_t row1, size_t row2);
-
   // update a row in hash flat, if same key existings, update the row and return true
   // otherwise we get a new row, return false
   bool update(const nebula::surface::RowData&);
 
-  struct Hash {
-    inline size_t operator()(const Key& key) const noexcept {
-      return std::get<2>(key);
-    }
-  };
-
-  struct Equal {
-    bool operator()(const Key& row1, const Key& row2) const noexcept {
-      // both keys have to coming from the same flat object
-      auto& flat = std::get<0>(row1);
-      // two rows equal if they have the same keys
-      return flat.equal(std::get<1>(row1), std::get<1>(row2));
-    }
-  };
+  // update a row whose keys are already resolved into a dense slot by the caller
+  // slot index bypasses key hashing and comparison except the first row of the slot,
+  // caller has to make sure same keys always go to the same slot until slots are reset
+  bool update(const nebula::surface::RowData&, size_t slot);
+
+  // forget rows of all slots, such as slots of a different block
+  void resetSlots();
+
+  // append a row as a new group without looking up its keys
+  // the flat may have duplicate keys after this, which are combined by a later merge
+  void append(const nebula::surface::RowData&);
+
+  // flat buffer allocation plus its key index
+  virtual size_t allocation() const override {
+    return FlatBuffer::allocation() + rowKeys_.allocation() + slotRows_.capacity() * sizeof(size_t);
+  }
 
 private:
   void init();
-  Comparator genComparator(size_t) noexcept;
-  Hasher genHasher(size_t) noexcept;
   Copier genCopier(size_t) noexcept;
 
+  // merge the new added row into target row if they are different rows (rollback the new row)
+  // otherwise initialize aggregators of the new row
+  bool settle(size_t newRow, size_t target);
+
+  // read a raw value of an aggregated column for its sketch, a string lives in data buffer
+  template <typename T>
+  inline T readInput(size_t offset) const {
+    if constexpr (std::is_same_v<T, std::string_view>) {
+      auto r = nebula::common::PRange::make(main_->slice, offset);
+      return data_->slice.read(r.offset, r.size);
+    } else {
+      return main_->slice.read<T>(offset);
+    }
+  }
+
 private:
-  std::unordered_set<size_t> keys_;
-  std::unordered_set<size_t> values_;
-  // customized operations for each column
-  std::vector<ColOps> ops_;
-
-  // TODO(cao):
-  // build error Undefined symbols for architecture x86_64: "folly::f14::detail::F14LinkCheck
-  // https://engineering.fb.com/developer-tools/f14/
-  // folly::F14FastSet<Key, Hash, Equal> rowKeys_;
-  std::unordered_set<Key, Hash, Equal> rowKeys_;
+  // aggregated columns using sketch objects
+  std::vector<size_t> values_;
+  // aggregated columns having inline states
+  std::vector<size_t> states_;
+  // customized copier for each value column
+  std::vector<Copier> ops_;
+
+  // open addressing table of row id by its key hash
+  RowTable rowKeys_;
+
+  // row id of each dense key slot, NONE if the slot has no row yet
+  static constexpr size_t NONE = std::numeric_limits<size_t>::max();
+  std::vector<size_t> slotRows_;
 };
 } // namespace keyed
 } // namespace memory
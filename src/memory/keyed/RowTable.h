@@ -0,0 +1,196 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "common/Errors.h"
+#include "common/Likely.h"
+
+/**
+ * An open addressing hash table to index rows of a flat buffer by their key hash.
+ *
+ * It follows swiss table layout:
+ * every slot has one control byte holding 7 bits of the hash or EMPTY,
+ * slots store row hash and row id inline, and probing goes group by group (16 slots).
+ * Keys are not stored in the table, key equality is delegated to the caller by row id.
+ *
+ * Rows are only added (no erase), so we don't need tombstones.
+ */
+namespace nebula {
+namespace memory {
+namespace keyed {
+
+class RowTable {
+  static constexpr size_t GROUP = 16;
+  static constexpr int8_t EMPTY = -128;
+  static constexpr size_t MIN_CAPACITY = GROUP;
+
+  struct Slot {
+    size_t hash;
+    size_t row;
+  };
+
+public:
+  explicit RowTable(size_t capacity = MIN_CAPACITY) {
+    // capacity is power of 2 and multiple of group size
+    size_t c = MIN_CAPACITY;
+    while (c < capacity) {
+      c <<= 1;
+    }
+
+    reset(c);
+  }
+  virtual ~RowTable() = default;
+
+  // find a row equal to given row by the equal function, return <found row, false>
+  // otherwise insert given row and return <row, true>
+  template <typename Equal>
+  std::pair<size_t, bool> emplace(size_t hash, size_t row, Equal&& equal) {
+    const auto mixed = mix(hash);
+    const auto h2 = tag(mixed);
+    size_t group = (mixed >> 7) & groupMask_;
+    for (size_t step = 1;; ++step) {
+      const auto base = group * GROUP;
+
+      // check all candidates in this group having the same tag
+      auto matches = match(base, h2);
+      while (matches != 0) {
+        const auto index = base + __builtin_ctz(matches);
+        const auto& slot = slots_[index];
+        if (slot.hash == hash && equal(slot.row)) {
+          return { slot.row, false };
+        }
+        matches &= (matches - 1);
+      }
+
+      // an empty slot in the group means the key does not exist
+      auto empties = match(base, EMPTY);
+      if (empties != 0) {
+        // grow and insert again if reached max load
+        if (UNLIKELY(size_ >= growth_)) {
+          reset(ctrl_.size() * 2);
+          insert(hash, row);
+          return { row, true };
+        }
+
+        const auto index = base + __builtin_ctz(empties);
+        ctrl_[index] = h2;
+        slots_[index] = { hash, row };
+        ++size_;
+        return { row, true };
+      }
+
+      // triangular probing visits every group when group count is power of 2
+      group = (group + step) & groupMask_;
+    }
+  }
+
+  inline size_t size() const {
+    return size_;
+  }
+
+  inline size_t capacity() const {
+    return ctrl_.size();
+  }
+
+  // bytes allocated by control bytes and slots
+  inline size_t allocation() const {
+    return ctrl_.size() * (sizeof(int8_t) + sizeof(Slot));
+  }
+
+private:
+  // spread the hash bits since key hash may not have good entropy in high bits
+  static inline size_t mix(size_t hash) {
+    return hash * 0x9E3779B97F4A7C15UL;
+  }
+
+  // top 7 bits as tag in control byte, never equals EMPTY
+  static inline int8_t tag(size_t mixed) {
+    return static_cast<int8_t>(mixed >> 57);
+  }
+
+  // bit mask of slots in the group starting at base having given control byte
+  inline uint32_t match(size_t base, int8_t c) const {
+#if defined(__SSE2__)
+    auto ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ctrl_.data() + base));
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(c))));
+#else
+    uint32_t mask = 0;
+    for (size_t i = 0; i < GROUP; ++i) {
+      mask |= (uint32_t)(ctrl_[base + i] == c) << i;
+    }
+    return mask;
+#endif
+  }
+
+  // insert a new row without equality check, used by rehash
+  void insert(size_t hash, size_t row) {
+    const auto mixed = mix(hash);
+    size_t group = (mixed >> 7) & groupMask_;
+    for (size_t step = 1;; ++step) {
+      const auto base = group * GROUP;
+      auto empties = match(base, EMPTY);
+      if (empties != 0) {
+        const auto index = base + __builtin_ctz(empties);
+        ctrl_[index] = tag(mixed);
+        slots_[index] = { hash, row };
+        ++size_;
+        return;
+      }
+
+      group = (group + step) & groupMask_;
+    }
+  }
+
+  // allocate given capacity and move all existing slots into it
+  void reset(size_t capacity) {
+    N_ENSURE(capacity % GROUP == 0, "capacity should be multiple of group size");
+    std::vector<int8_t> ctrl(capacity, EMPTY);
+    std::vector<Slot> slots(capacity);
+    ctrl.swap(ctrl_);
+    slots.swap(slots_);
+
+    // max load factor 7/8
+    groupMask_ = capacity / GROUP - 1;
+    growth_ = capacity - capacity / 8;
+    size_ = 0;
+
+    for (size_t i = 0, size = ctrl.size(); i < size; ++i) {
+      if (ctrl[i] != EMPTY) {
+        const auto& slot = slots[i];
+        insert(slot.hash, slot.row);
+      }
+    }
+  }
+
+private:
+  std::vector<int8_t> ctrl_;
+  std::vector<Slot> slots_;
+  size_t groupMask_;
+  size_t growth_;
+  size_t size_;
+};
+
+} // namespace keyed
+} // namespace memory
+} // namespace nebula
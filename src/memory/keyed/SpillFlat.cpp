@@ -0,0 +1,172 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "SpillFlat.h"
+
+#include <cstdio>
+#include <fstream>
+#include <unistd.h>
+
+#include "common/Memory.h"
+
+namespace nebula {
+namespace memory {
+namespace keyed {
+
+using nebula::common::Pool;
+
+SpillFlat::SpillFlat(const nebula::type::Schema schema,
+                     const nebula::surface::eval::Fields& fields,
+                     size_t budget,
+                     size_t partitions,
+                     const std::string& dir)
+  : schema_{ schema },
+    fields_{ fields },
+    budget_{ budget },
+    partitions_{ partitions },
+    dir_{ dir },
+    bits_{ 0 },
+    flat_{ std::make_unique<HashFlat>(schema, fields) },
+    baseline_{ flat_->allocation() },
+    spills_{ 0 } {
+  N_ENSURE(partitions_ > 1 && (partitions_ & (partitions_ - 1)) == 0, "spill partitions should be power of 2");
+  while ((1UL << bits_) < partitions_) {
+    ++bits_;
+  }
+}
+
+SpillFlat::~SpillFlat() {
+  // remove all temp files left, in case finish is not called
+  for (const auto& file : files_) {
+    std::remove(file.c_str());
+  }
+}
+
+void SpillFlat::update(const nebula::surface::RowData& row) {
+  flat_->update(row);
+
+  // budget is counted on memory grown by aggregated rows, not initial pages of an empty flat
+  if (UNLIKELY(budget_ > 0 && flat_->allocation() > baseline_ + budget_)) {
+    spill();
+  }
+}
+
+void SpillFlat::spill() {
+  // create temp files for all partitions at the first spill
+  if (files_.empty()) {
+    files_.reserve(partitions_);
+    for (size_t i = 0; i < partitions_; ++i) {
+      auto name = dir_ + "/nebula.spill.XXXXXX";
+      auto fd = mkstemp(name.data());
+      N_ENSURE(fd != -1, "Failed to create spill file");
+      close(fd);
+      files_.push_back(std::move(name));
+    }
+  }
+
+  // partition of every row
+  const auto rows = flat_->getRows();
+  std::vector<size_t> parts;
+  parts.reserve(rows);
+  for (size_t r = 0; r < rows; ++r) {
+    parts.push_back(partition(flat_->hash(r)));
+  }
+
+  // append every partition as a chunk of [size][flat buffer] to its file
+  // partitions are written one by one to avoid holding all of their copies at the same time
+  for (size_t i = 0; i < partitions_; ++i) {
+    // aggregation states are carried over by the rows
+    FlatBuffer part(schema_, fields_);
+    for (size_t r = 0; r < rows; ++r) {
+      if (parts[r] == i) {
+        part.add(flat_->access(r));
+      }
+    }
+
+    if (part.getRows() == 0) {
+      continue;
+    }
+
+    const auto capacity = part.prepareSerde();
+    auto buffer = static_cast<NByte*>(Pool::getDefault().allocate(capacity));
+    const size_t size = part.serialize(buffer);
+
+    std::ofstream output(files_.at(i), std::ios::binary | std::ios::app);
+    output.write(reinterpret_cast<const char*>(&size), sizeof(size));
+    output.write(reinterpret_cast<const char*>(buffer), size);
+    Pool::getDefault().free(buffer, capacity);
+    N_ENSURE(output.good(), "Failed to write spill file");
+  }
+
+  LOG(INFO) << "Spilled rows: " << flat_->getRows() << ", allocation: " << flat_->allocation();
+  flat_ = std::make_unique<HashFlat>(schema_, fields_);
+  ++spills_;
+}
+
+std::unique_ptr<HashFlat> SpillFlat::load(size_t partition) {
+  auto hf = std::make_unique<HashFlat>(schema_, fields_);
+  std::ifstream input(files_.at(partition), std::ios::binary);
+  size_t size = 0;
+  while (input.read(reinterpret_cast<char*>(&size), sizeof(size))) {
+    // deserialized flat buffer owns the chunk and frees it
+    auto buffer = static_cast<NByte*>(Pool::getDefault().allocate(size));
+    input.read(reinterpret_cast<char*>(buffer), size);
+    N_ENSURE(input.good(), "Failed to read spill file");
+
+    FlatBuffer chunk(schema_, fields_, buffer);
+    for (size_t r = 0, rows = chunk.getRows(); r < rows; ++r) {
+      hf->update(chunk.access(r));
+    }
+  }
+
+  return hf;
+}
+
+std::vector<std::unique_ptr<FlatBuffer>> SpillFlat::finish() {
+  std::vector<std::unique_ptr<FlatBuffer>> result;
+  if (spills_ == 0) {
+    if (flat_->getRows() > 0) {
+      result.push_back(std::move(flat_));
+    }
+
+    return result;
+  }
+
+  // spill the remaining to have all states in partitions
+  if (flat_->getRows() > 0) {
+    spill();
+  }
+  flat_ = nullptr;
+
+  // chunks of a partition are released once merged, merged partitions are kept for the result.
+  // TODO(cao): a partition may still be over budget with extremely skewed keys,
+  // we can split it again with more hash bits if it turns out to be a problem.
+  result.reserve(partitions_);
+  for (size_t i = 0; i < partitions_; ++i) {
+    auto hf = load(i);
+    std::remove(files_.at(i).c_str());
+    if (hf->getRows() > 0) {
+      result.push_back(std::move(hf));
+    }
+  }
+
+  files_.clear();
+  return result;
+}
+
+} // namespace keyed
+} // namespace memory
+} // namespace nebula
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "HashFlat.h"
+#include "surface/DataSurface.h"
+#include "surface/eval/ValueEval.h"
+
+namespace nebula {
+namespace memory {
+namespace keyed {
+/**
+ * Spill flat aggregates rows in a hash flat within a memory budget.
+ * When the hash flat grows over the budget, its rows are scattered by key hash into partitions
+ * and each partition is appended to its own local temp file in flat buffer serialized form,
+ * then aggregation starts over with an empty hash flat.
+ *
+ * On finish, partitions are loaded and merged one at a time, so spilled chunks of only one partition
+ * are in memory at any time. A key only belongs to one partition, hence merged partitions have no
+ * overlapping keys and can be simply concatenated.
+ *
+ * The budget bounds memory of aggregating, not the result: all merged partitions are returned together,
+ * as large as one aggregated state per key. Spilling pays off when inputs have far more rows than keys,
+ * or many partial states of the same keys spread across inputs.
+ */
+class SpillFlat {
+public:
+  // budget in bytes grown by aggregated rows, 0 means no limit; partitions has to be power of 2
+  SpillFlat(const nebula::type::Schema,
+            const nebula::surface::eval::Fields&,
+            size_t budget,
+            size_t partitions,
+            const std::string& dir);
+  virtual ~SpillFlat();
+
+  // aggregate a row, may spill current hash flat if it is over budget
+  void update(const nebula::surface::RowData&);
+
+  // final aggregated flats, no key shows up in more than one flat
+  // a single flat if nothing spilled, otherwise one flat per partition, all in memory when returned
+  std::vector<std::unique_ptr<FlatBuffer>> finish();
+
+  // number of spills happened so far
+  inline size_t spills() const {
+    return spills_;
+  }
+
+private:
+  // write all rows of current hash flat into partition files and reset it
+  void spill();
+
+  // merge all chunks of a spilled partition into a new hash flat
+  std::unique_ptr<HashFlat> load(size_t);
+
+  // partition of a row by its key hash
+  inline size_t partition(size_t hash) const {
+    return (hash * 0xC2B2AE3D27D4EB4FUL) >> (64 - bits_);
+  }
+
+private:
+  const nebula::type::Schema schema_;
+  const nebula::surface::eval::Fields& fields_;
+  const size_t budget_;
+  const size_t partitions_;
+  const std::string dir_;
+  size_t bits_;
+
+  std::unique_ptr<HashFlat> flat_;
+  // allocation of an empty hash flat
+  size_t baseline_;
+
+  // temp file of every partition, created at the first spill
+  std::vector<std::string> files_;
+  size_t spills_;
+};
+
+} // namespace keyed
+} // namespace memory
+} // namespace nebula
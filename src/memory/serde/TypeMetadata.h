@@ -148,6 +148,10 @@ public:
     return dict_->get(index);
   }
 
+  inline size_t dictSize() const {
+    return dict_ == nullptr ? 0 : dict_->size();
+  }
+
   inline void seal() {
     // release hash items for lookup
     if (dict_) {
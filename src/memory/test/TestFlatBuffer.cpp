@@ -18,10 +18,15 @@
 #include <gtest/gtest.h>
 #include <valarray>
 
+#include "api/udf/Cardinality.h"
+#include "api/udf/Count.h"
+#include "api/udf/Sum.h"
 #include "common/Memory.h"
 #include "fmt/format.h"
 #include "memory/keyed/FlatBuffer.h"
 #include "memory/keyed/HashFlat.h"
+#include "memory/keyed/RowTable.h"
+#include "memory/keyed/SpillFlat.h"
 #include "meta/TestTable.h"
 #include "surface/DataSurface.h"
 #include "surface/MockSurface.h"
@@ -39,6 +44,9 @@ namespace test {
 using nebula::common::Evidence;
 using nebula::memory::keyed::FlatBuffer;
 using nebula::memory::keyed::HashFlat;
+using nebula::memory::keyed::RowTable;
+using nebula::memory::keyed::SpillFlat;
+using nebula::surface::IndexType;
 using nebula::surface::MockRowData;
 using nebula::surface::RowData;
 using nebula::type::TypeSerializer;
@@ -185,6 +193,79 @@ TEST(FlatBufferTest, TestSerde) {
   // delete[] buffer;
 }
 
+TEST(FlatBufferTest, TestSegments) {
+  nebula::meta::TestTable test;
+  FlatBuffer fb(test.schema(), test.testFields());
+
+  constexpr auto rows2test = 1053;
+  MockRowData row(Evidence::unix_timestamp());
+  for (auto i = 0; i < rows2test; ++i) {
+    fb.add(row);
+  }
+
+  // put all segments together as a serialized buffer
+  std::vector<size_t> header;
+  const auto segments = fb.segments(header);
+  EXPECT_EQ(segments.size(), 4);
+  size_t size = 0;
+  for (const auto& s : segments) {
+    size += s.size();
+  }
+
+  auto buffer = static_cast<NByte*>(nebula::common::Pool::getDefault().allocate(size));
+  size_t offset = 0;
+  for (const auto& s : segments) {
+    std::memcpy(buffer + offset, s.data(), s.size());
+    offset += s.size();
+  }
+
+  FlatBuffer fb2(test.schema(), test.testFields(), buffer);
+  EXPECT_EQ(fb2.getRows(), rows2test);
+  for (auto i = 0; i < rows2test; ++i) {
+    EXPECT_EQ(line(fb.row(i)), line(fb2.row(i)));
+  }
+
+  // an empty buffer has only number of rows
+  FlatBuffer empty(test.schema(), test.testFields());
+  EXPECT_EQ(empty.segments(header).size(), 1);
+  EXPECT_EQ(header.size(), 1);
+}
+
+TEST(FlatBufferTest, TestDedupStrings) {
+  nebula::meta::TestTable test;
+  FlatBuffer fb(test.schema(), test.testFields());
+
+  // a few distinct strings repeated in many rows
+  constexpr auto rows2test = 1000;
+  for (auto i = 0; i < rows2test; ++i) {
+    auto items = std::make_unique<nebula::surface::StaticList>(
+      std::vector<std::string>{ fmt::format("item-{0}", i % 3), "item-x" });
+    nebula::surface::StaticRow row{ i, i, fmt::format("event-{0}", i % 7), std::move(items), false, 1, i, 0.5 };
+    fb.add(row);
+  }
+
+  std::vector<std::string> lines;
+  lines.reserve(rows2test);
+  for (auto i = 0; i < rows2test; ++i) {
+    lines.push_back(line(fb.row(i)));
+  }
+
+  EXPECT_GT(fb.dedupStrings(), 0);
+  for (auto i = 0; i < rows2test; ++i) {
+    EXPECT_EQ(line(fb.row(i)), lines[i]);
+  }
+
+  // deduped buffer is read as usual after serde
+  auto size = fb.prepareSerde();
+  auto buffer = static_cast<NByte*>(nebula::common::Pool::getDefault().allocate(size));
+  EXPECT_EQ(size, fb.serialize(buffer));
+  FlatBuffer fb2(test.schema(), test.testFields(), buffer);
+  EXPECT_EQ(fb2.getRows(), rows2test);
+  for (auto i = 0; i < rows2test; ++i) {
+    EXPECT_EQ(line(fb2.row(i)), lines[i]);
+  }
+}
+
 TEST(FlatBufferTest, TestHashFlatSerde) {
   auto schema = TypeSerializer::from("ROW<id:int, count:int>");
 
@@ -243,6 +324,195 @@ TEST(FlatBufferTest, TestHashFlatSerde) {
   }
 }
 
+TEST(FlatBufferTest, TestRowTable) {
+  // keys of rows, row id is the index
+  constexpr auto rows2test = 100000;
+  constexpr auto distinct = 1000;
+  std::vector<int> keys;
+  keys.reserve(rows2test);
+  for (auto i = 0; i < rows2test; ++i) {
+    keys.push_back(i % distinct);
+  }
+
+  // using a weak hash to have lots of collisions
+  RowTable table;
+  for (size_t i = 0; i < rows2test; ++i) {
+    auto key = keys.at(i);
+    auto result = table.emplace(key % 7, i, [&keys, key](size_t row) {
+      return keys.at(row) == key;
+    });
+
+    // first appearance gets inserted, otherwise found the first row with the same key
+    EXPECT_EQ(result.second, i < distinct);
+    EXPECT_EQ(result.first, i % distinct);
+  }
+
+  EXPECT_EQ(table.size(), distinct);
+  EXPECT_TRUE(table.capacity() >= distinct);
+}
+
+// a row of (key, 1, value) to aggregate by key
+class KeyValueRow : public RowData {
+public:
+  KeyValueRow(int32_t key, int32_t value) : key_{ key }, value_{ value } {}
+  virtual ~KeyValueRow() = default;
+
+#define NOT_USED(TYPE, FUNC)                    \
+  TYPE FUNC(const std::string&) const override { \
+    throw NException("Not used");                \
+  }
+
+  NOT_USED(bool, isNull)
+  NOT_USED(bool, readBool)
+  NOT_USED(int8_t, readByte)
+  NOT_USED(int16_t, readShort)
+  NOT_USED(int32_t, readInt)
+  NOT_USED(int64_t, readLong)
+  NOT_USED(float, readFloat)
+  NOT_USED(double, readDouble)
+  NOT_USED(int128_t, readInt128)
+  NOT_USED(std::string_view, readString)
+  NOT_USED(std::unique_ptr<nebula::surface::ListData>, readList)
+  NOT_USED(std::unique_ptr<nebula::surface::MapData>, readMap)
+
+#undef NOT_USED
+
+  bool isNull(IndexType) const override {
+    return false;
+  }
+
+  int32_t readInt(IndexType index) const override {
+    return index == 0 ? key_ : (index == 1 ? 1 : value_);
+  }
+
+  int64_t readLong(IndexType index) const override {
+    return readInt(index);
+  }
+
+private:
+  int32_t key_;
+  int32_t value_;
+};
+
+TEST(FlatBufferTest, TestSpillFlat) {
+  auto schema = TypeSerializer::from("ROW<id:int, count:bigint, sum:bigint>");
+
+  // group by id, count is an inline state and sum is using a sketch
+  nebula::surface::eval::Fields f;
+  f.reserve(3);
+  f.emplace_back(nebula::surface::eval::column<int32_t>("id"));
+  f.emplace_back(std::make_unique<nebula::api::udf::Count<>>("COUNT", nebula::surface::eval::constant(1)));
+  f.emplace_back(std::make_unique<nebula::api::udf::Sum<nebula::type::Kind::INTEGER>>(
+    "sum", nebula::surface::eval::column<int32_t>("value")));
+
+  constexpr auto rows2test = 50000;
+  constexpr auto distinct = 10000;
+
+  // a tiny budget forces a lot of spills
+  SpillFlat sf(schema, f, 256 * 1024, 8, "/tmp");
+  HashFlat hf(schema, f);
+  for (auto i = 0; i < rows2test; ++i) {
+    KeyValueRow row((i * 7919) % distinct, i);
+    sf.update(row);
+    hf.update(row);
+  }
+
+  EXPECT_TRUE(sf.spills() > 0);
+
+  // count state and sum of a row
+  using SumAggregator = nebula::surface::eval::Aggregator<nebula::type::Kind::BIGINT, nebula::type::Kind::INTEGER>;
+  const auto values = [](const RowData& r) {
+    int64_t count = 0;
+    EXPECT_TRUE(r.readState(1, count));
+    return std::make_pair(count, std::static_pointer_cast<SumAggregator>(r.getAggregator(2))->finalize());
+  };
+
+  // every key shows up once in the spilled result with the same aggregations
+  std::unordered_map<int32_t, std::pair<int64_t, int64_t>> expected;
+  for (size_t i = 0; i < hf.getRows(); ++i) {
+    const auto& r = hf.row(i);
+    expected.emplace(r.readInt(0), values(r));
+  }
+
+  size_t keys = 0;
+  for (auto& flat : sf.finish()) {
+    for (size_t i = 0; i < flat->getRows(); ++i) {
+      const auto& r = flat->row(i);
+      auto it = expected.find(r.readInt(0));
+      ASSERT_TRUE(it != expected.end());
+      EXPECT_EQ(it->second, values(r));
+      expected.erase(it);
+      ++keys;
+    }
+  }
+
+  EXPECT_EQ(keys, distinct);
+  EXPECT_TRUE(expected.empty());
+}
+
+
+// key and a string value to feed string sketches
+class KeyStringRow : public KeyValueRow {
+public:
+  KeyStringRow(int32_t key, const std::string& value) : KeyValueRow(key, 0), value_{ value } {}
+  virtual ~KeyStringRow() = default;
+
+  using KeyValueRow::isNull;
+  using KeyValueRow::readString;
+
+  std::string_view readString(IndexType) const override {
+    return value_;
+  }
+
+private:
+  std::string value_;
+};
+
+TEST(FlatBufferTest, TestStringSketch) {
+  auto schema = TypeSerializer::from("ROW<id:int, tags:bigint>");
+
+  // group by id, count distinct strings through a sketch
+  nebula::surface::eval::Fields f;
+  f.reserve(2);
+  f.emplace_back(nebula::surface::eval::column<int32_t>("id"));
+  f.emplace_back(std::make_unique<nebula::api::udf::Cardinality<nebula::type::Kind::VARCHAR>>(
+    "tags", nebula::surface::eval::column<std::string_view>("tag")));
+
+  constexpr auto keys = 10;
+  constexpr auto rows2test = 20000;
+  HashFlat hf(schema, f);
+  for (auto i = 0; i < rows2test; ++i) {
+    KeyStringRow row(i % keys, fmt::format("tag-{0}", i % 2000));
+    hf.update(row);
+  }
+
+  // serialize and merge twice, duplicate strings should not change the result
+  auto size = hf.prepareSerde();
+  auto buffer = static_cast<NByte*>(nebula::common::Pool::getDefault().allocate(size));
+  EXPECT_EQ(size, hf.serialize(buffer));
+
+  HashFlat merged(schema, f);
+  for (auto k = 0; k < 2; ++k) {
+    // flat buffer takes the ownership of the buffer, give each one a copy
+    auto copy = static_cast<NByte*>(nebula::common::Pool::getDefault().allocate(size));
+    std::memcpy(copy, buffer, size);
+    FlatBuffer fb(schema, f, copy);
+    for (size_t i = 0; i < fb.getRows(); ++i) {
+      merged.update(fb.row(i));
+    }
+  }
+
+  nebula::common::Pool::getDefault().free(buffer, size);
+
+  using CardinalityAggregator = nebula::surface::eval::Aggregator<nebula::type::Kind::BIGINT, nebula::type::Kind::VARCHAR>;
+  EXPECT_EQ(merged.getRows(), keys);
+  for (size_t i = 0; i < merged.getRows(); ++i) {
+    const auto& r = merged.row(i);
+    auto value = std::static_pointer_cast<CardinalityAggregator>(r.getAggregator(1))->finalize();
+    EXPECT_NEAR(value, 200, 2);
+  }
+}
+
 } // namespace test
 } // namespace memory
-} // namespace nebula
\ No newline at end of file
+} // namespace nebula
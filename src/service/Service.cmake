@@ -71,6 +71,7 @@ add_library(${NEBULA_SERVICE} STATIC
     ${NEBULA_SRC}/service/node/TaskExecutor.cpp
     ${NEBULA_SRC}/service/server/NodeSync.cpp
     ${NEBULA_SRC}/service/server/QueryHandler.cpp
+    ${NEBULA_SRC}/service/server/ResultCache.cpp
     ${nproto_srcs}
     ${ngrpc_srcs}
     ${nodegrpc_srcs})
@@ -16,6 +16,7 @@
 
 #include "NebulaService.h"
 
+#include <lz4.h>
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 
@@ -48,6 +49,8 @@ using nebula::common::Task;
 using nebula::common::TaskState;
 using nebula::common::TaskType;
 using nebula::execution::QueryWindow;
+using nebula::execution::TopRound;
+using nebula::execution::TopType;
 using nebula::ingest::BlockExpire;
 using nebula::ingest::IngestSpec;
 using nebula::ingest::SpecState;
@@ -82,6 +85,7 @@ const std::string ServiceProperties::errorMessage(ErrorCode error) {
     ERROR_MESSSAGE_CASE(FAIL_EXECUTE_QUERY)
     ERROR_MESSSAGE_CASE(AUTH_REQUIRED)
     ERROR_MESSSAGE_CASE(PERMISSION_REQUIRED)
+    ERROR_MESSSAGE_CASE(QUERY_REJECTED)
   default: throw NException("Error Code Not Covered");
   }
 }
@@ -175,7 +179,8 @@ const std::string ServiceProperties::jsonify(const RowCursorPtr data, const Sche
 }
 
 // serialize a query and meta data
-flatbuffers::grpc::Message<QueryPlan> QuerySerde::serialize(const Query& q, const std::string& id, const QueryWindow& window) {
+flatbuffers::grpc::Message<QueryPlan> QuerySerde::serialize(
+  const Query& q, const std::string& id, const QueryWindow& window, const TopRound& round, size_t weight, BatchType type) {
   flatbuffers::grpc::MessageBuilder mb;
   auto tbl = q.table_->name();
   auto filter = Serde::serialize(*q.filter_);
@@ -197,9 +202,23 @@ flatbuffers::grpc::Message<QueryPlan> QuerySerde::serialize(const Query& q, cons
     sorts.push_back(i);
   }
 
+  std::vector<uint8_t> descs;
+  descs.reserve(q.sorts_.size());
+  for (size_t i = 0, size = q.sorts_.size(); i < size; ++i) {
+    const auto type = i < q.sortTypes_.size() ? q.sortTypes_.at(i) : q.sortType_;
+    descs.push_back(type == SortType::DESC);
+  }
+
+  std::vector<flatbuffers::Offset<flatbuffers::String>> keys;
+  keys.reserve(round.keys.size());
+  for (auto& key : round.keys) {
+    keys.push_back(mb.CreateString(key));
+  }
+
   auto request_offset = CreateQueryPlanDirect(
     mb, id.c_str(), tbl.c_str(), filter.c_str(), &fields, &groups, &sorts,
-    q.sortType_ == SortType::DESC, q.limit_, window.first, window.second);
+    q.sortType_ == SortType::DESC, q.limit_, window.first, window.second,
+    static_cast<int8_t>(round.type), round.threshold, &keys, &descs, weight, type);
   mb.Finish(request_offset);
   return mb.ReleaseMessage<QueryPlan>();
 }
@@ -255,6 +274,15 @@ nebula::api::dsl::Query QuerySerde::deserialize(
 
   // sort type
   q.sortType_ = plan->desc() ? SortType::DESC : SortType::ASC;
+  if (plan->descs() != nullptr) {
+    auto ds = plan->descs();
+    std::vector<SortType> types;
+    types.reserve(ds->size());
+    for (uint32_t i = 0, size = ds->size(); i < size; ++i) {
+      types.push_back(ds->Get(i) ? SortType::DESC : SortType::ASC);
+    }
+    q.sortTypes_ = std::move(types);
+  }
 
   // set limit
   q.limit_ = plan->limit();
@@ -274,46 +302,199 @@ std::unique_ptr<nebula::execution::ExecutionPlan> QuerySerde::from(
 
   // set a few other properties associated with execution plan
   auto p = msg->GetRoot();
+  if (p->uuid()) {
+    plan->setId(p->uuid()->str());
+  }
+
   plan->setWindow({ p->tstart(), p->tend() });
+  plan->setWeight(p->weight());
+
+  // the same serialized table, fields and groups compute the same partial result of a block
+  std::hash<std::string> hash;
+  auto compute = hash(flatbuffers::GetString(p->tbl()));
+  const auto fs = p->fields();
+  for (uint32_t i = 0, size = fs->size(); i < size; ++i) {
+    compute = compute * 31 + hash(flatbuffers::GetString(fs->Get(i)));
+  }
+
+  const auto gs = p->groups();
+  for (uint32_t i = 0, size = gs->size(); i < size; ++i) {
+    compute = compute * 31 + gs->Get(i);
+  }
+
+  plan->setFingerprint(compute, hash(flatbuffers::GetString(p->filter())));
 
   // return this compiled plan
   return plan;
 }
 
-flatbuffers::grpc::Message<BatchRows> BatchSerde::serialize(const FlatBuffer& fb) {
-  flatbuffers::grpc::MessageBuilder mb;
-  auto schema = mb.CreateString(nebula::type::TypeSerializer::to(fb.schema()));
-  int8_t* buffer;
-  auto size = fb.prepareSerde();
-  auto bytes = mb.CreateUninitializedVector<int8_t>(size, &buffer);
-  fb.serialize(buffer);
-
-  auto batch = CreateBatchRows(mb, schema, BatchType::BatchType_Flat, bytes);
-  mb.Finish(batch);
-  return mb.ReleaseMessage<BatchRows>();
+TopRound QuerySerde::round(const flatbuffers::grpc::Message<QueryPlan>* msg) {
+  auto p = msg->GetRoot();
+  TopRound round;
+  round.type = static_cast<TopType>(p->top_type());
+  round.threshold = p->top_threshold();
+
+  // keys are only present in KEYS round
+  if (auto keys = p->top_keys()) {
+    round.keys.reserve(keys->size());
+    for (uint32_t i = 0, size = keys->size(); i < size; ++i) {
+      round.keys.push_back(keys->Get(i)->str());
+    }
+  }
+
+  return round;
+}
+
+BatchType QuerySerde::batchType(const flatbuffers::grpc::Message<QueryPlan>* msg) {
+  const auto type = msg->GetRoot()->batch_type();
+  switch (type) {
+  case BatchType::BatchType_FlatDict:
+  case BatchType::BatchType_FlatDictLz4:
+    return type;
+  default:
+    return BatchType::BatchType_Flat;
+  }
+}
+
+size_t BatchSerde::serialize(FlatBuffer& fb,
+                             BatchType type,
+                             size_t chunkSize,
+                             const std::function<bool(const flatbuffers::grpc::Message<BatchRows>&)>& writer) {
+  N_ENSURE_GT(chunkSize, 0, "chunk size should be positive");
+  if (type == BatchType::BatchType_FlatDict || type == BatchType::BatchType_FlatDictLz4) {
+    auto saved = fb.dedupStrings();
+    VLOG(1) << "Dictionary of key strings saved bytes: " << saved;
+  }
+
+  std::vector<size_t> header;
+  const auto segments = fb.segments(header);
+  size_t total = 0;
+  for (const auto& s : segments) {
+    total += s.size();
+  }
+
+  // copy next bytes of segments in order, a chunk may span multiple segments and a segment may span multiple chunks
+  size_t segment = 0;
+  size_t offset = 0;
+  const auto next = [&segments, &segment, &offset](NByte* buffer, size_t size) {
+    for (size_t written = 0; written < size;) {
+      const auto& s = segments.at(segment);
+      const auto len = std::min(size - written, s.size() - offset);
+      std::memcpy(buffer + written, s.data() + offset, len);
+      written += len;
+      offset += len;
+      if (offset == s.size()) {
+        ++segment;
+        offset = 0;
+      }
+    }
+  };
+
+  // buffers to compress a chunk, they are reused by all chunks
+  const auto compress = type == BatchType::BatchType_FlatDictLz4;
+  std::vector<NByte> raw;
+  std::vector<char> compressed;
+  if (compress) {
+    raw.resize(std::min(total, chunkSize));
+    compressed.resize(LZ4_compressBound(raw.size()));
+  }
+
+  size_t chunks = 0;
+  size_t left = total;
+  do {
+    flatbuffers::grpc::MessageBuilder mb;
+    const auto size = std::min(left, chunkSize);
+    // schema and total size are only sent along with the first chunk
+    flatbuffers::Offset<flatbuffers::String> schema;
+    if (chunks == 0) {
+      schema = mb.CreateString(nebula::type::TypeSerializer::to(fb.schema()));
+    }
+
+    // a chunk is sent as it is if it's not compressible
+    auto chunkType = type;
+    flatbuffers::Offset<flatbuffers::Vector<int8_t>> bytes;
+    if (compress) {
+      next(raw.data(), size);
+      auto len = LZ4_compress_default((const char*)raw.data(), compressed.data(), size, compressed.size());
+      if (len > 0 && (size_t)len < size) {
+        bytes = mb.CreateVector((const int8_t*)compressed.data(), len);
+      } else {
+        bytes = mb.CreateVector((const int8_t*)raw.data(), size);
+        chunkType = BatchType::BatchType_FlatDict;
+      }
+    } else {
+      int8_t* buffer;
+      bytes = mb.CreateUninitializedVector<int8_t>(size, &buffer);
+      next((NByte*)buffer, size);
+    }
+
+    mb.Finish(CreateBatchRows(mb, schema, chunkType, bytes, chunks == 0 ? total : 0));
+    ++chunks;
+    left -= size;
+    if (!writer(mb.ReleaseMessage<BatchRows>())) {
+      break;
+    }
+  } while (left > 0);
+
+  return chunks;
+}
+
+BatchAssembler::~BatchAssembler() {
+  if (bytes_) {
+    Pool::getDefault().free(bytes_, size_);
+  }
 }
 
-RowCursorPtr BatchSerde::deserialize(const flatbuffers::grpc::Message<BatchRows>* batch,
-                                     const nebula::surface::eval::Fields& fields) {
-  auto ptr = batch->GetRoot();
+void BatchAssembler::add(const flatbuffers::grpc::Message<BatchRows>& chunk) {
+  auto ptr = chunk.GetRoot();
 
-  const auto schema = nebula::type::TypeSerializer::from(flatbuffers::GetString(ptr->schema()));
-  N_ENSURE(ptr->type() == BatchType::BatchType_Flat, "only support flat for now");
+  // the first chunk tells schema and size of the whole batch
+  if (!schema_) {
+    schema_ = nebula::type::TypeSerializer::from(flatbuffers::GetString(ptr->schema()));
+    size_ = ptr->size();
+    if (size_ > 0) {
+      bytes_ = static_cast<NByte*>(Pool::getDefault().allocate(size_));
+    }
+  }
 
-  // TODO(cao) - can we avoid this allocation?
   auto data = ptr->data();
-  auto size = data->size();
-  // short circuit of zero size data
+  const auto size = data->size();
   if (size == 0) {
+    return;
+  }
+
+  switch (ptr->type()) {
+  case BatchType::BatchType_Flat:
+  case BatchType::BatchType_FlatDict: {
+    N_ENSURE_LE(offset_ + size, size_, "chunks are over size of the batch");
+    std::memcpy(bytes_ + offset_, data->data(), size);
+    offset_ += size;
+    break;
+  }
+  case BatchType::BatchType_FlatDictLz4: {
+    // decompress the chunk right into its place of the batch
+    auto len = LZ4_decompress_safe((const char*)data->data(), (char*)bytes_ + offset_, size, size_ - offset_);
+    N_ENSURE_GT(len, 0, "failed to decompress a chunk");
+    offset_ += len;
+    break;
+  }
+  default:
+    throw NException(fmt::format("Batch type not supported: {0}", EnumNameBatchType(ptr->type())));
+  }
+}
+
+RowCursorPtr BatchAssembler::read(const nebula::surface::eval::Fields& fields) {
+  N_ENSURE_EQ(offset_, size_, "batch is not complete");
+
+  // short circuit of zero row batch
+  if (size_ == 0 || *reinterpret_cast<const size_t*>(bytes_) == 0) {
     LOG(INFO) << "Received an empty result set.";
     return EmptyRowCursor::instance();
   }
 
-  auto bytes = static_cast<NByte*>(Pool::getDefault().allocate(size));
-  std::memcpy(bytes, data->data(), size);
-
-  // TODO(cao) - It is not good, we're reference some data from batch but actually not owning it.
-  auto fb = std::make_unique<FlatBuffer>(schema, fields, bytes);
+  // the flat buffer owns the bytes from now on
+  auto fb = std::make_unique<FlatBuffer>(schema_, fields, bytes_);
+  bytes_ = nullptr;
   return std::make_shared<FlatRowCursor>(std::move(fb));
 }
 
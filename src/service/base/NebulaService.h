@@ -19,6 +19,8 @@
 #define RAPIDJSON_HAS_STDSTRING 1
 #endif
 
+#include <functional>
+
 #include "api/dsl/Query.h"
 #include "common/Task.h"
 #include "ingest/IngestSpec.h"
@@ -46,7 +48,8 @@ enum ErrorCode {
   FAIL_COMPILE_QUERY = 5,
   FAIL_EXECUTE_QUERY = 6,
   AUTH_REQUIRED = 7,
-  PERMISSION_REQUIRED = 8
+  PERMISSION_REQUIRED = 8,
+  QUERY_REJECTED = 9
 };
 
 template <ErrorCode E>
@@ -97,6 +100,11 @@ struct ErrorTraits<ErrorCode::PERMISSION_REQUIRED> {
   static constexpr auto MESSAGE = "User Has No Permission To Execute";
 };
 
+template <>
+struct ErrorTraits<ErrorCode::QUERY_REJECTED> {
+  static constexpr auto MESSAGE = "Query Rejected By Resource Limits";
+};
+
 class ServiceProperties final {
 public:
   // nebula server listening port
@@ -123,18 +131,56 @@ public:
  */
 class QuerySerde {
 public:
-  static flatbuffers::grpc::Message<QueryPlan> serialize(const nebula::api::dsl::Query&, const std::string&, const nebula::execution::QueryWindow&);
+  static flatbuffers::grpc::Message<QueryPlan> serialize(
+    const nebula::api::dsl::Query&,
+    const std::string&,
+    const nebula::execution::QueryWindow&,
+    const nebula::execution::TopRound& = {},
+    size_t = 1,
+    BatchType = BatchType::BatchType_Flat);
   static nebula::api::dsl::Query deserialize(const std::shared_ptr<nebula::meta::MetaService>, const flatbuffers::grpc::Message<QueryPlan>*);
   static std::unique_ptr<nebula::execution::ExecutionPlan> from(const std::shared_ptr<nebula::meta::MetaService>, const flatbuffers::grpc::Message<QueryPlan>*);
+  // exact top K round the node is asked to execute for the query
+  static nebula::execution::TopRound round(const flatbuffers::grpc::Message<QueryPlan>*);
+  // encoding of results the server accepts, the one to reply in if node supports it or flat
+  static BatchType batchType(const flatbuffers::grpc::Message<QueryPlan>*);
 };
 
 /**
- * A batch serde to transmit a batch between nodes in fb format w/ zero-copy.
+ * A batch serde to transmit a batch between nodes in fb format as a stream of bounded chunks.
+ * Chunks are byte ranges of the serialized flat buffer in order, the first one carries its schema and total size.
  */
 class BatchSerde {
 public:
-  static flatbuffers::grpc::Message<BatchRows> serialize(const nebula::memory::keyed::FlatBuffer&);
-  static nebula::surface::RowCursorPtr deserialize(const flatbuffers::grpc::Message<BatchRows>*, const nebula::surface::eval::Fields&);
+  // serialize a flat buffer in given encoding into chunks of at most given bytes, every chunk is handed over
+  // to the writer once built. it stops if the writer returns false. return number of chunks written.
+  // a chunk is built from memory of the flat buffer directly into a message buffer unless it's compressed.
+  static size_t serialize(nebula::memory::keyed::FlatBuffer&,
+                          BatchType,
+                          size_t,
+                          const std::function<bool(const flatbuffers::grpc::Message<BatchRows>&)>&);
+};
+
+// put chunks of a serialized batch together in the order they arrive, a chunk can be released once it's added.
+// memory of the batch is allocated once by its total size, so no chunk or message is kept around.
+class BatchAssembler {
+public:
+  BatchAssembler() : bytes_{ nullptr }, size_{ 0 }, offset_{ 0 } {}
+  BatchAssembler(BatchAssembler&) = delete;
+  BatchAssembler(BatchAssembler&&) = delete;
+  virtual ~BatchAssembler();
+
+  // add next chunk of the batch
+  void add(const flatbuffers::grpc::Message<BatchRows>&);
+
+  // read all rows of the batch once all chunks are added, the batch can be read only once
+  nebula::surface::RowCursorPtr read(const nebula::surface::eval::Fields&);
+
+private:
+  nebula::type::Schema schema_;
+  NByte* bytes_;
+  size_t size_;
+  size_t offset_;
 };
 
 /**
@@ -26,6 +26,19 @@ std::shared_ptr<ConnectionPool> ConnectionPool::init() noexcept {
   return inst;
 }
 
+ConnectionPool::~ConnectionPool() {
+  cq_.Shutdown();
+  poller_.join();
+}
+
+void ConnectionPool::poll() {
+  void* tag = nullptr;
+  bool ok = false;
+  while (cq_.Next(&tag, &ok)) {
+    static_cast<AsyncCall*>(tag)->done(ok);
+  }
+}
+
 // TODO(cao): we don't have maintainance yet,
 // ideally to have health check peridically and recreate channel when necessary.
 // api to get maintained channel
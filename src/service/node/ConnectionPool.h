@@ -16,6 +16,7 @@
 #pragma once
 
 #include <grpcpp/grpcpp.h>
+#include <thread>
 #include <unordered_map>
 
 #include "common/Evidence.h"
@@ -26,8 +27,19 @@ namespace nebula {
 namespace service {
 namespace node {
 
+// an async call in flight, the completion queue poller completes it once it finishes
+class AsyncCall {
+public:
+  virtual ~AsyncCall() = default;
+
+  // called once by the poller, ok is false if the call didn't finish normally
+  virtual void done(bool ok) = 0;
+};
+
 /**
- * Create a connection pool to maintain connections with nodes in cluster
+ * Create a connection pool to maintain connections with nodes in cluster.
+ * Async calls to nodes share one completion queue, polled by a dedicated thread
+ * so that no executor thread waits for a node to reply.
  */
 class ConnectionPool {
 public:
@@ -36,7 +48,7 @@ public:
 public:
   ConnectionPool(ConnectionPool&) = delete;
   ConnectionPool(ConnectionPool&&) = delete;
-  virtual ~ConnectionPool() = default;
+  virtual ~ConnectionPool();
 
   // TODO(cao): we don't have maintainance yet,
   // ideally to have health check peridically and recreate channel when necessary.
@@ -46,6 +58,11 @@ public:
   // reset the connection to this node
   void reset(const nebula::meta::NNode&);
 
+  // completion queue for async calls, tag of every call is an AsyncCall
+  inline grpc::CompletionQueue* completion() noexcept {
+    return &cq_;
+  }
+
 private:
   void recordReset(const std::string& addr) {
     auto reported = resets_.find(addr);
@@ -76,11 +93,16 @@ private:
     }
   }
 
+  // complete all finished calls until the queue shuts down
+  void poll();
+
 private:
-  ConnectionPool() = default;
+  ConnectionPool() : poller_{ [this]() { poll(); } } {}
   std::unordered_map<std::string, std::shared_ptr<grpc::Channel>> connections_;
   //recording resets times, firs time stamp to reset and total reset count
   std::unordered_map<std::string, std::pair<size_t, size_t>> resets_;
+  grpc::CompletionQueue cq_;
+  std::thread poller_;
 };
 
 } // namespace node
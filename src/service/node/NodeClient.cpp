@@ -15,8 +15,15 @@
  */
 
 #include "NodeClient.h"
+#include <fmt/format.h>
+#include <gflags/gflags.h>
+#include "common/Errors.h"
 #include "execution/BlockManager.h"
 
+DEFINE_string(NODE_BATCH_TYPE,
+              "FlatDictLz4",
+              "encoding of query results asked from nodes: Flat, FlatDict or FlatDictLz4");
+
 /**
  * Define node server that does the work as nebula server asks.
  */
@@ -24,17 +31,18 @@ namespace nebula {
 namespace service {
 namespace node {
 
+using nebula::common::CancellationPtr;
 using nebula::common::Task;
 using nebula::common::TaskState;
 using nebula::execution::BlockManager;
 using nebula::execution::BlockSet;
 using nebula::execution::ExecutionPlan;
+using nebula::execution::TopRound;
 using nebula::execution::io::BatchBlock;
 using nebula::meta::BlockSignature;
-using nebula::service::base::BatchSerde;
+using nebula::service::base::BatchAssembler;
 using nebula::service::base::QuerySerde;
 using nebula::service::base::TaskSerde;
-using nebula::surface::EmptyRowCursor;
 using nebula::surface::RowCursorPtr;
 using nebula::surface::eval::Fields;
 
@@ -84,38 +92,108 @@ void NodeClient::echos(const std::string& name, size_t count) {
   }
 }
 
-folly::Future<RowCursorPtr> NodeClient::execute(const ExecutionPlan& plan) {
-  auto p = std::make_shared<folly::Promise<RowCursorPtr>>();
-  auto addr = node_.toString();
-
-  // pass values since we reutrn the whole lambda - don't reference temporary things
-  // such as local stack allocated variables, including "this" the client itself.
-  pool_.add([p, addr, q = query_, &plan]() {
-    // a response message placeholder
-    flatbuffers::grpc::Message<BatchRows> qr;
-
-    const Fields& f = plan.fetch<nebula::execution::PhaseType::PARTIAL>().fields();
-    auto qp = QuerySerde::serialize(*q, plan.id(), plan.getWindow());
-    grpc::ClientContext context;
-    auto channel = ConnectionPool::init()->connection(addr);
-    N_ENSURE(channel != nullptr, "requires a valid channel");
-    auto stub = nebula::service::NodeServer::NewStub(channel);
-    auto status = stub->Query(&context, qp, &qr);
-    if (status.ok()) {
-      auto fb = BatchSerde::deserialize(&qr, f);
-      VLOG(1) << "Received batch as number of rows: " << fb->size();
+// encoding of query results asked from nodes by flag, flat if it's not known
+static BatchType batchType() {
+  static const auto type = []() {
+    for (auto t : EnumValuesBatchType()) {
+      if (t != BatchType::BatchType_Json && FLAGS_NODE_BATCH_TYPE == EnumNameBatchType(t)) {
+        return t;
+      }
+    }
+
+    LOG(WARNING) << "Unknown batch type " << FLAGS_NODE_BATCH_TYPE << ", use Flat instead.";
+    return BatchType::BatchType_Flat;
+  }();
 
-      // update into current server block management
-      p->setValue(fb);
+  return type;
+}
+
+// an async query call, it fulfills its promise with itself once the node finishes streaming its result.
+// every chunk of the result is put into the batch as it arrives, so only one chunk is in flight at a time.
+// it listens on cancellation of its query to cancel the call, so that the node stops computing it.
+// it shares the cancellation since the call may complete after its query plan is gone.
+struct QueryCall : public AsyncCall {
+  enum class Step {
+    START,
+    READ,
+    FINISH
+  };
+
+  explicit QueryCall(CancellationPtr c) : cancellation{ std::move(c) }, listener{ 0 }, step{ Step::START } {}
+
+  CancellationPtr cancellation;
+  size_t listener;
+  Step step;
+  grpc::ClientContext context;
+  flatbuffers::grpc::Message<BatchRows> chunk;
+  BatchAssembler batch;
+  std::string failure;
+  grpc::Status status;
+  std::unique_ptr<grpc::ClientAsyncReader<flatbuffers::grpc::Message<BatchRows>>> reader;
+  folly::Promise<std::unique_ptr<QueryCall>> promise;
+
+  virtual void done(bool ok) override {
+    if (step != Step::FINISH) {
+      // a chunk arrived, copy it into the batch and release it right away
+      if (ok && step == Step::READ) {
+        try {
+          batch.add(chunk);
+        } catch (const std::exception& ex) {
+          failure = ex.what();
+          context.TryCancel();
+        }
+
+        chunk = {};
+      }
+
+      // keep reading until the stream ends
+      if (ok) {
+        step = Step::READ;
+        reader->Read(&chunk, this);
+        return;
+      }
+
+      step = Step::FINISH;
+      reader->Finish(&status, this);
       return;
     }
 
-    LOG(ERROR) << "Node failure: " << status.error_message();
-    // else return empty result set
-    p->setValue(EmptyRowCursor::instance());
-  });
+    // the call finished, it is no longer cancellable
+    cancellation->remove(listener);
+    if (!failure.empty()) {
+      status = grpc::Status(grpc::StatusCode::DATA_LOSS, failure);
+    }
 
-  return p->getFuture();
+    auto p = std::move(promise);
+    p.setValue(std::unique_ptr<QueryCall>(this));
+  }
+};
+
+folly::Future<RowCursorPtr> NodeClient::execute(const ExecutionPlan& plan, const TopRound& round) {
+  // the call is owned by the completion queue until the node finishes, then by the future
+  auto call = new QueryCall(plan.cancellationPtr());
+  auto future = call->promise.getFuture();
+  auto qp = QuerySerde::serialize(*query_, plan.id(), plan.getWindow(), round, plan.getWeight(), batchType());
+  call->reader = stub_->PrepareAsyncQuery(&call->context, qp, ConnectionPool::init()->completion());
+  call->listener = call->cancellation->listen([call]() { call->context.TryCancel(); });
+  call->reader->StartCall(call);
+
+  // deserialize the batch in the pool, the poller thread only completes calls.
+  // the batch refers to fields of the partial phase, which the plan owns as long as its results are alive.
+  // a cancelled query may be unwinding its plan, so the continuation checks cancellation before touching them.
+  const Fields* fields = &plan.fetch<nebula::execution::PhaseType::PARTIAL>().fields();
+  return std::move(future).via(&pool_).thenValue([fields](std::unique_ptr<QueryCall> c) -> RowCursorPtr {
+    c->cancellation->ensure();
+    if (c->status.ok()) {
+      auto fb = c->batch.read(*fields);
+      VLOG(1) << "Received batch as number of rows: " << fb->size();
+      return fb;
+    }
+
+    // a failed node fails its result, so that callers can tell it from an empty one
+    LOG(ERROR) << "Node failure: " << c->status.error_message();
+    throw NException(fmt::format("Node failure: {0}", c->status.error_message()));
+  });
 }
 
 void NodeClient::state() {
@@ -58,7 +58,9 @@ public:
   void echos(const std::string&, size_t);
 
   // execute a plan on remote node
-  virtual folly::Future<nebula::surface::RowCursorPtr> execute(const nebula::execution::ExecutionPlan& plan) override;
+  virtual folly::Future<nebula::surface::RowCursorPtr> execute(
+    const nebula::execution::ExecutionPlan& plan,
+    const nebula::execution::TopRound& round) override;
 
   // pull node state
   virtual void state() override;
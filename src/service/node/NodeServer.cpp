@@ -18,6 +18,7 @@
 // #define USE_YOMM2_MD
 // #endif
 
+#include <cmath>
 #include <gflags/gflags.h>
 
 #include "NodeServer.h"
@@ -29,6 +30,9 @@
 #include "surface/DataSurface.h"
 
 DEFINE_int32(MAX_MSG_SIZE, 1073741824, "max message size sending between node and server, default to 1G");
+DEFINE_uint64(RESULT_CHUNK_SIZE, 4194304, "max bytes of a chunk when streaming query results from node to server");
+DEFINE_uint32(INGEST_WEIGHT, 1, "weight of ingestion tasks to share node threads with queries");
+DEFINE_double(INGEST_CPU_SHARE, 0.25, "max share of node threads ingestion tasks can take at the same time");
 
 /**
  * Define node server that does the work as nebula server asks.
@@ -101,27 +105,41 @@ grpc::Status NodeServerImpl::Echos(
   return grpc::Status::OK;
 }
 
-// TODO(cao) - we may want to change this endpoint as streaming
-// So that we don't need to do aggregation here, instead push all block executor results to server for aggregation.
-// Single aggregation - perf?
+// TODO(cao) - push all block executor results to server for aggregation instead of a single aggregation here?
+// result of a query is streamed back in chunks, so that neither side holds a message as large as the whole result.
 grpc::Status NodeServerImpl::Query(
-  grpc::ServerContext*,
+  grpc::ServerContext* context,
   const flatbuffers::grpc::Message<QueryPlan>* query,
-  flatbuffers::grpc::Message<BatchRows>* batch) {
+  grpc::ServerWriter<flatbuffers::grpc::Message<BatchRows>>* writer) {
 #ifdef PPROF
   ProfilerStart("/tmp/ns_query.out");
 #endif
   try {
     auto plan = QuerySerde::from(tableService_, query);
 
-    // execute this plan and get results
-    NodeExecutor executor(BlockManager::init());
-    auto cursor = executor.execute(threadPool_, *plan);
+    // execute this plan and get results.
+    // the execution is chained in the pool, only this rpc thread waits for it.
+    // the query is cancelled once the server cancels this call (timeout or abandoned by its user).
+    NodeExecutor executor(BlockManager::init(), false, &scheduler_);
+    auto cursor = nebula::common::await(
+      executor.execute(threadPool_, *plan, QuerySerde::round(query)),
+      plan->cancellation(),
+      [context]() { return context->IsCancelled(); });
     const auto& phase = plan->fetch<PhaseType::PARTIAL>();
     const auto& buffer = nebula::execution::serde::asBuffer(*cursor, phase.outputSchema(), phase.fields());
 
-    // serialize row cursor back
-    *batch = BatchSerde::serialize(*buffer);
+    // stream row cursor back in the encoding server accepts, a chunk is built once the previous one is written
+    bool sent = true;
+    auto chunks = BatchSerde::serialize(
+      *buffer, QuerySerde::batchType(query), FLAGS_RESULT_CHUNK_SIZE, [writer, &sent](const flatbuffers::grpc::Message<BatchRows>& chunk) {
+        return (sent = writer->Write(chunk));
+      });
+
+    if (!sent) {
+      return grpc::Status(grpc::StatusCode::CANCELLED, "result stream closed by server");
+    }
+
+    VLOG(1) << "Sent " << buffer->getRows() << " rows in " << chunks << " chunks";
   } catch (const std::exception& exp) {
     return grpc::Status(grpc::StatusCode::INTERNAL, exp.what());
   }
@@ -225,10 +243,16 @@ void RunServer() {
     server->Shutdown();
   };
 
+  // ingestion runs in its own lane of low priority, with a cap of threads it can take at the same time
+  const auto threads = node.pool().numThreads();
+  const auto cap = std::max<size_t>(1, std::lround(threads * FLAGS_INGEST_CPU_SHARE));
+  auto ingestion = node.scheduler().lane(FLAGS_INGEST_WEIGHT, cap, folly::Executor::LO_PRI);
+  LOG(INFO) << "Ingestion takes at most " << cap << " of " << threads << " threads";
+
   taskScheduler.setInterval(
     1000,
-    [shutdownHandler, &priorityPool = node.pool()] {
-      nebula::service::node::TaskExecutor::singleton().process(shutdownHandler, priorityPool);
+    [shutdownHandler, ingestion] {
+      nebula::service::node::TaskExecutor::singleton().process(shutdownHandler, *ingestion);
     });
 
   // NOTE that, this is blocking main thread to wait for server down
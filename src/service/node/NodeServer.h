@@ -19,6 +19,7 @@
 #include <grpcpp/grpcpp.h>
 
 #include "common/Folly.h"
+#include "execution/core/Scheduler.h"
 #include "execution/meta/TableService.h"
 #include "node/node.grpc.fb.h"
 #include "node/node_generated.h"
@@ -46,7 +47,7 @@ class NodeServerImpl final : public NodeServer::Service {
   virtual grpc::Status Query(
     grpc::ServerContext*,
     const flatbuffers::grpc::Message<QueryPlan>*,
-    flatbuffers::grpc::Message<BatchRows>*)
+    grpc::ServerWriter<flatbuffers::grpc::Message<BatchRows>>*)
     override;
 
   virtual grpc::Status Poll(
@@ -64,6 +65,7 @@ class NodeServerImpl final : public NodeServer::Service {
 public:
   NodeServerImpl()
     : tableService_{ nebula::execution::meta::TableService::singleton() },
+      scheduler_{ threadPool_ },
       threadPool_{ std::thread::hardware_concurrency(), 2 } {}
   virtual ~NodeServerImpl() = default;
 
@@ -71,9 +73,17 @@ public:
     return threadPool_;
   }
 
+  nebula::execution::core::FairScheduler& scheduler() {
+    return scheduler_;
+  }
+
 private:
   std::shared_ptr<nebula::execution::meta::TableService> tableService_;
 
+  // queries and ingestion share pool threads through their lanes in this scheduler.
+  // it only keeps a reference of the pool, declared before the pool so that it outlives pool threads.
+  nebula::execution::core::FairScheduler scheduler_;
+
   // by default if not specified, CPUThreadPoolExecutor will use UnboundedBlockingQueue
   // so we can add as many task as we want.
   // Initialize this pool with two priority queues:
@@ -43,7 +43,7 @@ TaskExecutor& TaskExecutor::singleton() {
   return executor;
 }
 
-void TaskExecutor::process(std::function<void()> shutdown, folly::ThreadPoolExecutor& pool) {
+void TaskExecutor::process(std::function<void()> shutdown, folly::Executor& pool) {
   // process all items in sequence
   while (!queue_.isEmpty()) {
     Task* task = queue_.frontPtr();
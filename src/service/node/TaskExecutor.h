@@ -41,7 +41,7 @@ public:
   static TaskExecutor& singleton();
 
 public:
-  void process(std::function<void()>, folly::ThreadPoolExecutor&);
+  void process(std::function<void()>, folly::Executor&);
 
   nebula::common::TaskState enqueue(const nebula::common::Task&);
 
@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <condition_variable>
 #include <cstdlib>
 #include <fmt/format.h>
 #include <gflags/gflags.h>
@@ -21,6 +22,7 @@
 #include <grpcpp/grpcpp.h>
 #include <iostream>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <unordered_map>
@@ -32,6 +34,7 @@
 #include "common/Folly.h"
 #include "common/TaskScheduler.h"
 #include "execution/BlockManager.h"
+#include "execution/core/Scheduler.h"
 #include "execution/meta/TableService.h"
 #include "ingest/SpecRepo.h"
 #include "memory/Batch.h"
@@ -129,33 +132,18 @@ grpc::Status V1ServiceImpl::State(grpc::ServerContext*, const TableStateRequest*
   return Status::OK;
 }
 
-grpc::Status V1ServiceImpl::Query(grpc::ServerContext* ctx, const QueryRequest* request, QueryResponse* reply) {
-  // validate the query request and build the call
-  nebula::common::Evidence::Duration tick;
-  ErrorCode error = ErrorCode::NONE;
-
-  auto tableName = request->table();
-  constexpr auto NUCLEAR = "_nuclear_";
-  if (NUCLEAR == tableName) {
-    LOG(INFO) << "Received a nuclear command, tearing down everything";
-    // DEBUG/PROFILE PURPOSE:
-    // shutdown the local node by this command
-    RemoteNodeConnector connector{ nullptr };
-    auto nodes = nebula::meta::ClusterInfo::singleton().nodes();
-    N_ENSURE(nodes.size() > 0, "cluster info has no nodes??");
-    auto client = connector.makeClient(*nodes.begin(), threadPool_);
-    Task task(TaskType::COMMAND, SingleCommandTask::shutdown());
-    client->task(task);
-    return Status::OK;
-  }
-
+V1ServiceImpl::Prepared V1ServiceImpl::prepare(
+  grpc::ServerContext* ctx, const QueryRequest* request, ErrorCode& error) {
+  const auto& tableName = request->table();
   // get the table
   auto table = TableService::singleton()->query(tableName);
 
   // build the query
-  auto query = handler_.build(*table, *request, error);
+  Prepared prepared;
+  prepared.table = table;
+  prepared.query = handler_.build(*table, *request, error);
   if (error != ErrorCode::NONE) {
-    return replyError(error, reply, 0);
+    return prepared;
   }
 
   // build query context
@@ -180,17 +168,72 @@ grpc::Status V1ServiceImpl::Query(grpc::ServerContext* ctx, const QueryRequest*
 
   // compile the query into a plan
   LOG(INFO) << "Started a query for user: " << user << ", with groups:" << groups.size();
-  QueryContext queryContext{ user, std::move(groups) };
-  auto plan = handler_.compile(
-    query, { request->start(), request->end() }, queryContext, error);
+  auto& admission = nebula::execution::core::Admission::singleton();
+  const auto& group = admission.group(groups);
+  prepared.context = std::make_unique<QueryContext>(user, std::move(groups));
+  prepared.plan = handler_.compile(
+    prepared.query, { request->start(), request->end() }, *prepared.context, error);
   if (error != ErrorCode::NONE) {
-    return replyError(error, reply, 0);
+    return prepared;
+  }
+  N_ENSURE_NOT_NULL(prepared.plan, "Incorrect query compile");
+
+  // admit the query into its resource group by its estimated cost, it may wait for a running query to finish.
+  // the ticket is held until the query is replied. a client gone while queued takes its query out of the queue.
+  try {
+    auto blocks = BlockManager::init()->estimate(tableName, { request->start(), request->end() });
+    auto& plan = *prepared.plan;
+    prepared.ticket = nebula::common::await(
+      admission.admit(group.name, blocks, plan.cancellationPtr()),
+      plan.cancellation(),
+      [ctx]() { return ctx->IsCancelled(); });
+  } catch (const std::exception& ex) {
+    LOG(WARNING) << "Query rejected: " << ex.what();
+    error = ErrorCode::QUERY_REJECTED;
+    return prepared;
   }
-  N_ENSURE_NOT_NULL(plan, "Incorrect query compile");
+
+  // node threads are shared among queries by weight of their group
+  prepared.plan->setWeight(group.weight);
+  return prepared;
+}
+
+grpc::Status V1ServiceImpl::Query(grpc::ServerContext* ctx, const QueryRequest* request, QueryResponse* reply) {
+  // validate the query request and build the call
+  nebula::common::Evidence::Duration tick;
+  ErrorCode error = ErrorCode::NONE;
+
+  auto tableName = request->table();
+  constexpr auto NUCLEAR = "_nuclear_";
+  if (NUCLEAR == tableName) {
+    LOG(INFO) << "Received a nuclear command, tearing down everything";
+    // DEBUG/PROFILE PURPOSE:
+    // shutdown the local node by this command
+    RemoteNodeConnector connector{ nullptr };
+    auto nodes = nebula::meta::ClusterInfo::singleton().nodes();
+    N_ENSURE(nodes.size() > 0, "cluster info has no nodes??");
+    auto client = connector.makeClient(*nodes.begin(), threadPool_);
+    Task task(TaskType::COMMAND, SingleCommandTask::shutdown());
+    client->task(task);
+    return Status::OK;
+  }
+
+  auto prepared = prepare(ctx, request, error);
+  if (error != ErrorCode::NONE) {
+    return replyError(error, reply, tick.elapsedMs());
+  }
+
+  const auto& plan = prepared.plan;
 
   // create a remote connector and execute the query plan
-  auto connector = std::make_shared<RemoteNodeConnector>(query);
-  RowCursorPtr result = handler_.query(threadPool_, *plan, connector, error);
+  auto connector = std::make_shared<RemoteNodeConnector>(prepared.query);
+  // aggregation queries are answered by partial results of time buckets, most of them are cached for refreshing
+  auto abandoned = [ctx]() { return ctx->IsCancelled(); };
+  RowCursorPtr result = QueryHandler::cacheable(*request, *plan) ?
+                          handler_.cached(
+                            threadPool_, *prepared.table, *request, *plan, *prepared.context,
+                            prepared.ticket->group().name, error, abandoned) :
+                          handler_.query(threadPool_, *plan, connector, error, abandoned);
   auto durationMs = tick.elapsedMs();
   if (error != ErrorCode::NONE) {
     return replyError(error, reply, durationMs);
@@ -212,6 +255,94 @@ grpc::Status V1ServiceImpl::Query(grpc::ServerContext* ctx, const QueryRequest*
   return Status::OK;
 }
 
+grpc::Status V1ServiceImpl::Stream(
+  grpc::ServerContext* ctx, const QueryRequest* request, grpc::ServerWriter<QueryResponse>* writer) {
+  nebula::common::Evidence::Duration tick;
+  ErrorCode error = ErrorCode::NONE;
+  auto prepared = prepare(ctx, request, error);
+  if (error != ErrorCode::NONE) {
+    QueryResponse reply;
+    auto status = replyError(error, &reply, tick.elapsedMs());
+    writer->Write(reply);
+    return status;
+  }
+
+  // latest report not written yet, it is replaced by a newer report if the client reads slower than nodes respond.
+  // reports are built in the pool, only this rpc thread writes to the client.
+  std::mutex mutex;
+  std::condition_variable ready;
+  std::unique_ptr<QueryResponse> latest;
+  const auto& plan = *prepared.plan;
+  const auto schema = plan.getOutputSchema();
+  auto connector = std::make_shared<RemoteNodeConnector>(prepared.query);
+  auto done = handler_.stream(
+    threadPool_, plan, connector, [&mutex, &ready, &latest, &tick, &schema](RowCursorPtr result, size_t nodes, size_t total) {
+      auto reply = std::make_unique<QueryResponse>();
+      auto stats = reply->mutable_stats();
+      stats->set_querytimems(tick.elapsedMs());
+      stats->set_rowsscanned(0);
+      auto coverage = reply->mutable_coverage();
+      coverage->set_done(nodes);
+      coverage->set_total(total);
+      reply->set_type(DataType::JSON);
+      reply->set_data(ServiceProperties::jsonify(result, schema));
+
+      std::lock_guard<std::mutex> lock(mutex);
+      latest = std::move(reply);
+      ready.notify_one();
+    });
+
+  // write reports until the final one or the query is over, the query is cancelled once the client goes away.
+  // a failed query may never report its final coverage, its future tells it is over.
+  static constexpr auto POLL = std::chrono::milliseconds(10);
+  while (true) {
+    // a report made before the query is over is taken in this round, so it is the last round once it is over
+    const auto over = done.isReady();
+    std::unique_ptr<QueryResponse> reply;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      ready.wait_for(lock, POLL, [&latest]() { return latest != nullptr; });
+      reply = std::move(latest);
+    }
+
+    if (ctx->IsCancelled()) {
+      LOG(INFO) << "Streaming query abandoned by its client, cancelling it";
+      plan.cancellation().cancel();
+      break;
+    }
+
+    if (reply) {
+      if (!writer->Write(*reply)) {
+        LOG(INFO) << "Streaming query lost its client, cancelling it";
+        plan.cancellation().cancel();
+        break;
+      }
+
+      if (reply->coverage().done() == reply->coverage().total()) {
+        break;
+      }
+    }
+
+    if (over) {
+      break;
+    }
+  }
+
+  // reports reference locals of this call, wait for the query to finish before leaving
+  try {
+    std::move(done).get();
+  } catch (const std::exception& ex) {
+    LOG(ERROR) << "Error in streaming query: " << ex.what();
+    QueryResponse reply;
+    auto status = replyError(ErrorCode::FAIL_EXECUTE_QUERY, &reply, tick.elapsedMs());
+    writer->Write(reply);
+    return status;
+  }
+
+  LOG(INFO) << "Finished a streaming query in " << tick.elapsedMs();
+  return Status::OK;
+}
+
 grpc::Status V1ServiceImpl::replyError(ErrorCode code, QueryResponse* reply, size_t durationMs) const {
   N_ENSURE_NE(code, ErrorCode::NONE, "Error Reply Code Not 0");
 
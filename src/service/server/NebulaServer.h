@@ -17,6 +17,7 @@
 
 #include <grpcpp/grpcpp.h>
 #include "QueryHandler.h"
+#include "execution/core/Scheduler.h"
 #include "meta/TestTable.h"
 #include "nebula.grpc.pb.h"
 
@@ -32,6 +33,7 @@ class V1ServiceImpl final : public V1::Service {
   grpc::Status Tables(grpc::ServerContext*, const ListTables*, TableList*);
   grpc::Status State(grpc::ServerContext*, const TableStateRequest*, TableStateResponse*);
   grpc::Status Query(grpc::ServerContext*, const QueryRequest*, QueryResponse*);
+  grpc::Status Stream(grpc::ServerContext*, const QueryRequest*, grpc::ServerWriter<QueryResponse>*);
 
   // query handler to handle all the queries
   QueryHandler handler_;
@@ -45,6 +47,18 @@ public:
   }
 
 private:
+  // a query compiled into its plan and admitted to run, it holds the admission ticket while running
+  struct Prepared {
+    std::shared_ptr<nebula::meta::Table> table;
+    std::unique_ptr<nebula::api::dsl::QueryContext> context;
+    std::shared_ptr<nebula::api::dsl::Query> query;
+    std::unique_ptr<nebula::execution::ExecutionPlan> plan;
+    nebula::execution::core::Admission::TicketPtr ticket;
+  };
+
+  // build, compile and admit a query, error is set if any step fails
+  Prepared prepare(grpc::ServerContext*, const QueryRequest*, nebula::service::base::ErrorCode&);
+
   grpc::Status replyError(nebula::service::base::ErrorCode, QueryResponse*, size_t) const;
   folly::CPUThreadPoolExecutor threadPool_;
 };
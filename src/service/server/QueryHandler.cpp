@@ -16,14 +16,33 @@
 
 #include "QueryHandler.h"
 
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <fmt/format.h>
 #include <folly/Conv.h>
 #include <gflags/gflags.h>
 
+#include "ResultCache.h"
+#include "execution/BlockManager.h"
+#include "execution/core/AggregationMerge.h"
+#include "execution/core/Finalize.h"
+#include "execution/core/Scheduler.h"
 #include "execution/core/ServerExecutor.h"
+#include "execution/core/TopSort.h"
+#include "execution/serde/RowCursorSerde.h"
+#include "memory/keyed/FlatRowCursor.h"
 #include "service/node/NodeClient.h"
 #include "service/node/RemoteNodeConnector.h"
 
 DEFINE_uint32(AUTO_WINDOW_SIZE, 1000, "maximum data point when selecting auto window");
+DEFINE_uint64(RESULT_CACHE_BUCKET, 3600, "seconds of a time bucket to cache partial query results by");
+DEFINE_uint64(RESULT_CACHE_MAX_BUCKETS, 720, "queries of more time buckets than this are not answered by buckets");
+DEFINE_uint64(RESULT_CACHE_CONCURRENT_BUCKETS,
+              4,
+              "max number of buckets of a query computed at the same time, every bucket but the first one in a round "
+              "takes its own admission slot of the query group, so it only runs if a slot is free");
+DECLARE_uint64(RESULT_CACHE_MB);
 
 /**
  * Define some basic sharable proerpties for nebula service
@@ -51,10 +70,17 @@ using nebula::api::dsl::QueryContext;
 using nebula::api::dsl::SortType;
 using nebula::api::dsl::starts;
 using nebula::api::dsl::table;
+using nebula::common::Pool;
+using nebula::execution::BlockManager;
 using nebula::execution::ExecutionPlan;
+using nebula::execution::FinalPhase;
+using nebula::execution::PhaseType;
 using nebula::execution::QueryWindow;
+using nebula::execution::core::Admission;
 using nebula::execution::core::NodeConnector;
 using nebula::execution::core::ServerExecutor;
+using nebula::memory::keyed::FlatBuffer;
+using nebula::memory::keyed::FlatRowCursor;
 using nebula::meta::NNode;
 using nebula::meta::Table;
 using nebula::service::Operation;
@@ -114,11 +140,16 @@ RowCursorPtr QueryHandler::query(
   folly::ThreadPoolExecutor& pool,
   const ExecutionPlan& plan,
   const std::shared_ptr<NodeConnector> connector,
-  ErrorCode& err) const noexcept {
+  ErrorCode& err,
+  const std::function<bool()>& abandoned) const noexcept {
   // execute the query plan
   try {
-    // create a node connector for this executor
-    return ServerExecutor(NNode::local().toString()).execute(pool, plan, connector);
+    // create a node connector for this executor.
+    // the execution is chained in the pool, only the calling rpc thread waits for it.
+    return nebula::common::await(
+      ServerExecutor(NNode::local().toString()).execute(pool, plan, connector),
+      plan.cancellation(),
+      abandoned);
   } catch (const std::exception& exp) {
     LOG(ERROR) << "Error in executing query: " << exp.what();
     err = ErrorCode::FAIL_EXECUTE_QUERY;
@@ -126,6 +157,219 @@ RowCursorPtr QueryHandler::query(
   }
 }
 
+bool QueryHandler::cacheable(const QueryRequest& req, const ExecutionPlan& plan) noexcept {
+  // timeline buckets its rows by query start time, partial results of different windows don't merge
+  return FLAGS_RESULT_CACHE_MB > 0
+         && FLAGS_RESULT_CACHE_BUCKET > 0
+         && req.display() != DisplayType::TIMELINE
+         && req.end() >= req.start()
+         && (req.end() - req.start()) / FLAGS_RESULT_CACHE_BUCKET < FLAGS_RESULT_CACHE_MAX_BUCKETS
+         && plan.fetch<PhaseType::GLOBAL>().hasAggregation();
+}
+
+// serialize a partial result with states of its sketches
+static std::shared_ptr<const std::string> pack(const FlatBuffer& flat) {
+  auto bytes = std::make_shared<std::string>(flat.prepareSerde(), 0);
+  flat.serialize(reinterpret_cast<NByte*>(bytes->data()));
+  return bytes;
+}
+
+// every use of a cached partial result gets its own copy, merge updates sketches of its inputs
+static RowCursorPtr unpack(const std::string& bytes, const FinalPhase& phase) {
+  auto data = static_cast<NByte*>(Pool::getDefault().allocate(bytes.size()));
+  std::memcpy(data, bytes.data(), bytes.size());
+  return std::make_shared<FlatRowCursor>(std::make_unique<FlatBuffer>(phase.inputSchema(), phase.fields(), data));
+}
+
+// windows being computed by buckets, each with its own plan.
+// plans have to outlive their computing, so the computing still in flight is cancelled and drained
+// at any exit, such as a failure to build a later window or the query being cancelled.
+struct Buckets {
+  explicit Buckets(nebula::common::Cancellation& c) : cancellation{ c }, listener{ 0 } {}
+
+  // cancelling the query cancels all windows being computed, listen once all plans are built
+  void listen() {
+    listener = cancellation.listen([this]() {
+      for (auto& p : plans) {
+        p->cancellation().cancel();
+      }
+    });
+  }
+
+  ~Buckets() {
+    cancellation.remove(listener);
+    for (auto& p : plans) {
+      p->cancellation().cancel();
+    }
+
+    for (auto& f : computing) {
+      if (f.valid()) {
+        f.wait();
+      }
+    }
+  }
+
+  nebula::common::Cancellation& cancellation;
+  size_t listener;
+  std::vector<std::unique_ptr<ExecutionPlan>> plans;
+  std::vector<std::shared_ptr<NodeConnector>> connectors;
+  // estimated blocks of every window, a window computed on a slot of its own is charged by it
+  std::vector<size_t> blocks;
+  std::vector<folly::Future<RowCursorPtr>> computing;
+  // admission slots taken by windows computed together with the first one of a round
+  std::vector<Admission::TicketPtr> tickets;
+};
+
+RowCursorPtr QueryHandler::cached(
+  folly::ThreadPoolExecutor& pool,
+  const Table& table,
+  const QueryRequest& req,
+  const ExecutionPlan& plan,
+  const QueryContext& context,
+  const std::string& group,
+  ErrorCode& err,
+  const std::function<bool()>& abandoned) const noexcept {
+  try {
+    const auto& phase = plan.fetch<PhaseType::GLOBAL>();
+    auto& cache = ResultCache::singleton();
+    auto bm = BlockManager::init();
+
+    // the same query in any window shares one fingerprint, sorting and limit only apply to final result
+    QueryRequest normalized = req;
+    normalized.clear_start();
+    normalized.clear_end();
+    normalized.clear_top();
+    normalized.clear_order();
+    const auto fingerprint = fmt::format(
+      "{0}:{1:x}", req.table(), std::hash<std::string>()(normalized.SerializeAsString()));
+
+    // split the window into buckets, partial buckets at both edges are computed every time
+    const auto bucket = FLAGS_RESULT_CACHE_BUCKET;
+    std::vector<folly::Try<RowCursorPtr>> partials;
+    auto& cancellation = plan.cancellation();
+    Buckets buckets{ cancellation };
+    auto& plans = buckets.plans;
+    auto& computing = buckets.computing;
+    std::vector<std::pair<std::string, size_t>> keys;
+    size_t hits = 0;
+    for (uint64_t start = req.start(), end = req.end(); start <= end;) {
+      const auto first = start / bucket * bucket;
+      const auto last = std::min<uint64_t>(end, first + bucket - 1);
+      const QueryWindow window{ start, last };
+      const auto whole = start == first && last == first + bucket - 1;
+      start = last + 1;
+
+      // no data at all in the window
+      const auto version = bm->version(table.name(), window);
+      if (version == 0) {
+        continue;
+      }
+
+      const auto key = fmt::format("{0}@{1}", fingerprint, first);
+      if (whole) {
+        if (auto bytes = cache.get(key, version)) {
+          partials.emplace_back(unpack(*bytes, phase));
+          ++hits;
+          continue;
+        }
+      }
+
+      // compute partial result of the window, no limit so that nodes return all groups
+      QueryRequest r = req;
+      r.set_start(window.first);
+      r.set_end(window.second);
+      auto q = build(table, r, err);
+      if (err != ErrorCode::NONE) {
+        return EmptyRowCursor::instance();
+      }
+
+      q->limit(0);
+      QueryContext ctx = context;
+      auto p = compile(q, window, ctx, err);
+      if (err != ErrorCode::NONE) {
+        return EmptyRowCursor::instance();
+      }
+
+      p->setWeight(plan.getWeight());
+      plans.push_back(std::move(p));
+      buckets.connectors.push_back(std::make_shared<nebula::service::node::RemoteNodeConnector>(q));
+      buckets.blocks.push_back(bm->estimate(table.name(), window));
+      keys.emplace_back(whole ? key : "", version);
+    }
+
+    LOG(INFO) << fmt::format("Query by buckets: {0} cached, {1} to compute", hits, plans.size());
+
+    // windows are computed in rounds, every window is a query fanned out to all nodes.
+    // the first window of a round runs on the slot of this query, more windows join the round
+    // only if each of them gets a free slot of the group, so a long window never floods nodes
+    // and never waits on slots held by itself.
+    buckets.listen();
+    auto& admission = Admission::singleton();
+    const auto concurrency = std::max<size_t>(1, FLAGS_RESULT_CACHE_CONCURRENT_BUCKETS);
+    std::vector<folly::Try<RowCursorPtr>> computed;
+    computed.reserve(plans.size());
+    for (size_t next = 0; next < plans.size();) {
+      for (const auto first = next; next < plans.size() && next - first < concurrency; ++next) {
+        if (next > first) {
+          auto ticket = admission.tryAdmit(group, buckets.blocks.at(next));
+          if (!ticket) {
+            break;
+          }
+
+          buckets.tickets.push_back(std::move(ticket));
+        }
+
+        computing.push_back(
+          ServerExecutor(NNode::local().toString()).partial(pool, *plans.at(next), buckets.connectors.at(next)));
+      }
+
+      // all windows of the round are done when collected, none of them still refers to its plan
+      auto all = folly::collectAll(computing).via(&pool);
+      computing.clear();
+      auto round = nebula::common::await(std::move(all), cancellation, abandoned);
+      buckets.tickets.clear();
+      cancellation.ensure();
+      std::move(round.begin(), round.end(), std::back_inserter(computed));
+    }
+
+    // cache whole buckets before merging, merge changes sketches of its inputs.
+    // a bucket fails if any node fails computing it, it is left out rather than cached incomplete.
+    for (size_t i = 0; i < computed.size(); ++i) {
+      auto& result = computed.at(i);
+      if (!result.hasValue() || !result.value()) {
+        partials.push_back(std::move(result));
+        continue;
+      }
+
+      auto flat = nebula::execution::serde::asBuffer(*result.value(), phase.inputSchema(), phase.fields());
+      const auto& key = keys.at(i);
+      if (!key.first.empty()) {
+        cache.put(key.first, key.second, pack(*flat));
+      }
+
+      partials.emplace_back(std::make_shared<FlatRowCursor>(std::move(flat)));
+    }
+
+    auto merged = nebula::common::await(
+      nebula::execution::core::merge(pool, phase.inputSchema(), phase.fields(), true, partials),
+      cancellation,
+      abandoned);
+    return nebula::execution::core::topSort(nebula::execution::core::finalize(merged, phase), phase);
+  } catch (const std::exception& exp) {
+    LOG(ERROR) << "Error in executing query by buckets: " << exp.what();
+    err = ErrorCode::FAIL_EXECUTE_QUERY;
+    return EmptyRowCursor::instance();
+  }
+}
+
+folly::Future<folly::Unit> QueryHandler::stream(
+  folly::ThreadPoolExecutor& pool,
+  const ExecutionPlan& plan,
+  const std::shared_ptr<NodeConnector> connector,
+  ServerExecutor::Progress progress) const {
+  return ServerExecutor(NNode::local().toString()).stream(pool, plan, connector, std::move(progress));
+}
+
 inline SortType orderTypeConvert(OrderType type) {
   return type == OrderType::DESC ? SortType::DESC : SortType::ASC;
 }
@@ -311,6 +555,7 @@ std::shared_ptr<Expression> QueryHandler::buildMetric(const Metric& metric) cons
     BUILD_METRIC_CASE(P99, pct, 99)
     BUILD_METRIC_CASE(P99_9, pct, 99.9)
     BUILD_METRIC_CASE(P99_99, pct, 99.99)
+    BUILD_METRIC_CASE(CARDINALITY, cardinality)
   default:
     throw NException("Rollup method not supported");
   }
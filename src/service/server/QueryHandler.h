@@ -19,6 +19,7 @@
 #include "api/dsl/Expressions.h"
 #include "execution/ExecutionPlan.h"
 #include "execution/core/NodeConnector.h"
+#include "execution/core/ServerExecutor.h"
 #include "execution/meta/TableService.h"
 #include "meta/Table.h"
 #include "nebula.grpc.pb.h"
@@ -47,11 +48,37 @@ public:
     nebula::api::dsl::QueryContext&,
     nebula::service::base::ErrorCode&) const noexcept;
 
+  // execute the plan, it is cancelled once the caller abandons it by the given check
   nebula::surface::RowCursorPtr query(
     folly::ThreadPoolExecutor&,
     const nebula::execution::ExecutionPlan&,
     const std::shared_ptr<nebula::execution::core::NodeConnector> connector,
-    nebula::service::base::ErrorCode&) const noexcept;
+    nebula::service::base::ErrorCode&,
+    const std::function<bool()>& abandoned = {}) const noexcept;
+
+  // true if the query can be answered by merging partial results of its time buckets
+  static bool cacheable(const QueryRequest&, const nebula::execution::ExecutionPlan&) noexcept;
+
+  // execute the plan by merging partial results of its time buckets.
+  // partial results of whole buckets are cached and reused until blocks in the bucket change,
+  // so that refreshing the same query with a sliding window only computes buckets with new data.
+  // buckets computed together take more admission slots of the given resource group of the query.
+  nebula::surface::RowCursorPtr cached(
+    folly::ThreadPoolExecutor&,
+    const nebula::meta::Table&,
+    const QueryRequest&,
+    const nebula::execution::ExecutionPlan&,
+    const nebula::api::dsl::QueryContext&,
+    const std::string&,
+    nebula::service::base::ErrorCode&,
+    const std::function<bool()>& abandoned = {}) const noexcept;
+
+  // execute the plan and report merged results as nodes respond, the plan has to outlive the returned future
+  folly::Future<folly::Unit> stream(
+    folly::ThreadPoolExecutor&,
+    const nebula::execution::ExecutionPlan&,
+    const std::shared_ptr<nebula::execution::core::NodeConnector>,
+    nebula::execution::core::ServerExecutor::Progress) const;
 
 private:
   //  build query internally which can throw
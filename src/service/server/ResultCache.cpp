@@ -0,0 +1,84 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ResultCache.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+DEFINE_uint64(RESULT_CACHE_MB, 1024, "memory budget in MB of cached partial query results, 0 to disable the cache");
+
+/**
+ * Cache partial results of queries by time buckets on server.
+ */
+namespace nebula {
+namespace service {
+namespace server {
+
+ResultCache& ResultCache::singleton() {
+  static ResultCache cache{ FLAGS_RESULT_CACHE_MB << 20 };
+  return cache;
+}
+
+std::shared_ptr<const std::string> ResultCache::get(const std::string& key, size_t version) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = index_.find(key);
+  if (found == index_.end()) {
+    return nullptr;
+  }
+
+  // data in the bucket changed, the entry is stale
+  auto it = found->second;
+  if (it->version != version) {
+    erase(it);
+    return nullptr;
+  }
+
+  entries_.splice(entries_.begin(), entries_, it);
+  return it->data;
+}
+
+void ResultCache::put(const std::string& key, size_t version, std::shared_ptr<const std::string> data) {
+  const auto size = data->size();
+  if (size > capacity_) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = index_.find(key);
+  if (found != index_.end()) {
+    erase(found->second);
+  }
+
+  entries_.push_front(Entry{ key, version, std::move(data) });
+  index_[key] = entries_.begin();
+  bytes_ += size;
+
+  while (bytes_ > capacity_) {
+    VLOG(1) << "Evict cached result: " << entries_.back().key;
+    erase(std::prev(entries_.end()));
+  }
+}
+
+void ResultCache::erase(std::list<Entry>::iterator it) {
+  bytes_ -= it->data->size();
+  index_.erase(it->key);
+  entries_.erase(it);
+}
+
+} // namespace server
+} // namespace service
+} // namespace nebula
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2017-present Shawn Cao
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * Cache partial results of queries by time buckets on server.
+ * Dashboards refresh the same query with a sliding window, partial results of whole buckets
+ * are reused as long as data in the bucket doesn't change, so that a refresh only computes new data.
+ */
+namespace nebula {
+namespace service {
+namespace server {
+
+class ResultCache {
+public:
+  // capacity from flag RESULT_CACHE_MB
+  static ResultCache& singleton();
+
+  // serialized partial results of at most given bytes in total, least recently used ones are evicted first
+  explicit ResultCache(size_t capacity) : capacity_{ capacity }, bytes_{ 0 } {}
+  ResultCache(ResultCache&) = delete;
+  ResultCache(ResultCache&&) = delete;
+  virtual ~ResultCache() = default;
+
+public:
+  // partial result of a bucket of a query, nullptr if not cached or its data version changed
+  std::shared_ptr<const std::string> get(const std::string&, size_t);
+
+  // cache partial result of a bucket of a query computed from data of given version
+  void put(const std::string&, size_t, std::shared_ptr<const std::string>);
+
+  inline size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return entries_.size();
+  }
+
+  inline size_t bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+  }
+
+private:
+  struct Entry {
+    std::string key;
+    size_t version;
+    std::shared_ptr<const std::string> data;
+  };
+
+  void erase(std::list<Entry>::iterator);
+
+private:
+  const size_t capacity_;
+  size_t bytes_;
+  // most recently used entry is at front
+  std::list<Entry> entries_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+  mutable std::mutex mutex_;
+};
+
+} // namespace server
+} // namespace service
+} // namespace nebula
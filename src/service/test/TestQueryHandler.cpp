@@ -29,6 +29,7 @@
 #include "service/base/NebulaService.h"
 #include "service/node/RemoteNodeConnector.h"
 #include "service/server/QueryHandler.h"
+#include "service/server/ResultCache.h"
 #include "surface/DataSurface.h"
 #include "surface/MockSurface.h"
 #include "type/Serde.h"
@@ -50,6 +51,7 @@ using nebula::service::base::ErrorCode;
 using nebula::service::base::QuerySerde;
 using nebula::service::base::ServiceProperties;
 using nebula::service::server::QueryHandler;
+using nebula::service::server::ResultCache;
 using nebula::surface::RowCursorPtr;
 using nebula::surface::RowData;
 using nebula::type::Schema;
@@ -281,7 +283,7 @@ TEST(ServiceTest, TestQuerySerde) {
 
   // pass the query plan to a server to execute - usually it is itself
   folly::CPUThreadPoolExecutor pool{ 8 };
-  auto result1 = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan1);
+  auto result1 = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan1).get();
   auto str1 = ServiceProperties::jsonify(result1, plan1->getOutputSchema());
 
   // serialize this query
@@ -292,7 +294,7 @@ TEST(ServiceTest, TestQuerySerde) {
   LOG(INFO) << "Query serde time (ms): " << tick.elapsedMs();
 
   // pass the query plan to a server to execute - usually it is itself
-  auto result2 = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan2);
+  auto result2 = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan2).get();
   auto str2 = ServiceProperties::jsonify(result2, plan2->getOutputSchema());
 
   // check these two plans are the same
@@ -337,7 +339,7 @@ TEST(ServiceTest, TestDataSerde) {
   // get result with default in proc connector
   nebula::common::Evidence::Duration tick;
   folly::CPUThreadPoolExecutor pool{ 8 };
-  auto result1 = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan1);
+  auto result1 = ServerExecutor(nebula::meta::NNode::local().toString()).execute(pool, *plan1).get();
   LOG(INFO) << "Query time with in-proc connector (ms): " << tick.elapsedMs();
   auto str1 = ServiceProperties::jsonify(result1, plan1->getOutputSchema());
 
@@ -353,6 +355,34 @@ TEST(ServiceTest, TestDataSerde) {
   LOG(INFO) << "result is " << str1;
 }
 
+TEST(ServiceTest, TestResultCache) {
+  ResultCache cache{ 10 };
+  cache.put("a", 1, std::make_shared<std::string>("1234"));
+  cache.put("b", 1, std::make_shared<std::string>("5678"));
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(cache.bytes(), 8);
+
+  // hit of the same version only, stale entry is dropped
+  EXPECT_EQ(*cache.get("a", 1), "1234");
+  EXPECT_EQ(cache.get("b", 2), nullptr);
+  EXPECT_EQ(cache.size(), 1);
+  EXPECT_EQ(cache.get("b", 1), nullptr);
+
+  // least recently used entry is evicted when over capacity
+  cache.put("c", 1, std::make_shared<std::string>("abcd"));
+  cache.get("a", 1);
+  cache.put("d", 1, std::make_shared<std::string>("efgh"));
+  EXPECT_EQ(cache.size(), 2);
+  EXPECT_EQ(cache.get("c", 1), nullptr);
+  EXPECT_EQ(*cache.get("a", 1), "1234");
+  EXPECT_EQ(*cache.get("d", 1), "efgh");
+
+  // entry larger than capacity is never cached
+  cache.put("e", 1, std::make_shared<std::string>(11, 'x'));
+  EXPECT_EQ(cache.get("e", 1), nullptr);
+  EXPECT_EQ(cache.bytes(), 8);
+}
+
 } // namespace test
 } // namespace service
 } // namespace nebula
@@ -120,6 +120,12 @@ public:
   virtual std::shared_ptr<eval::Sketch> getAggregator(IndexType) const {
     return nullptr;
   }
+
+  // a fixed width aggregation state (no more than 8 bytes) carried inline by the row
+  // state bytes are copied into given value, return false if the row has no inline state for the column
+  virtual bool readState(IndexType, int64_t&) const {
+    return false;
+  }
 #undef NOT_IMPL_FUNC
 };
 
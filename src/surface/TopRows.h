@@ -17,52 +17,128 @@
 #pragma once
 
 #include <algorithm>
-#include <queue>
+#include <numeric>
 #include "DataSurface.h"
 #include "common/Cursor.h"
+#include "type/Type.h"
 
 /**
  * Implement a sorting and top cutoff wrapper for row cursor to return all values
  */
 namespace nebula {
 namespace surface {
+
+// a column to sort rows by, index of the column in the row, its type and direction
+struct SortColumn {
+  explicit SortColumn(size_t i, nebula::type::Kind k, bool d) : index{ i }, kind{ k }, desc{ d } {}
+  size_t index;
+  nebula::type::Kind kind;
+  bool desc;
+};
+
 class TopRows : public RowCursor {
-  using Less = std::function<bool(const std::unique_ptr<RowData>&, const std::unique_ptr<RowData>&)>;
+  // sort keys of one column extracted from all rows, only one of the value vectors is used by its kind
+  struct SortKeys {
+    explicit SortKeys(const SortColumn& c) : column{ c } {}
+
+    // compare two rows on this column by ascending order, null is the lowest value
+    inline int compare(size_t left, size_t right) const {
+      if (nulls[left] || nulls[right]) {
+        return (int)nulls[right] - (int)nulls[left];
+      }
+
+      switch (column.kind) {
+      case nebula::type::Kind::REAL:
+      case nebula::type::Kind::DOUBLE:
+        return (reals[left] > reals[right]) - (reals[left] < reals[right]);
+      case nebula::type::Kind::VARCHAR: {
+        std::string_view l{ strings.data() + offsets[left], offsets[left + 1] - offsets[left] };
+        std::string_view r{ strings.data() + offsets[right], offsets[right + 1] - offsets[right] };
+        return l.compare(r);
+      }
+      default:
+        return (ints[left] > ints[right]) - (ints[left] < ints[right]);
+      }
+    }
+
+    SortColumn column;
+    std::vector<bool> nulls;
+    std::vector<int64_t> ints;
+    std::vector<double> reals;
+    // all string values stored back to back, with N+1 offsets
+    std::string strings;
+    std::vector<size_t> offsets;
+  };
 
 public:
   // top rows will pick sorted top N rows, if max is 0, it means we don't apply limit and return all
-  TopRows(const RowCursorPtr& rows, size_t max, Less less)
+  // sort keys are extracted from all rows once, then a bounded heap of N row indices picks the top rows,
+  // only the picked rows are fetched from input rows when iterating.
+  // columns not supported for sorting (such as list or map) are ignored.
+  TopRows(const RowCursorPtr& rows, size_t max, const std::vector<SortColumn>& sorts)
     : RowCursor(max == 0 ? rows->size() : std::min(max, rows->size())),
-      heap_(rows->size()),
       rows_{ rows } {
-    // build heap / priority queue
-    if (less != nullptr) {
-      compare_ = [this, func = std::move(less)](size_t left, size_t right) -> bool {
-        return func(rows_->item(left), rows_->item(right));
-      };
-
-      // fill the vector with its index
-      std::iota(heap_.begin(), heap_.end(), 0);
-      std::make_heap(heap_.begin(), heap_.end(), compare_);
+    for (const auto& c : sorts) {
+      if (sortable(c.kind)) {
+        keys_.emplace_back(c);
+      }
+    }
+
+    // no sort needed, pass through input rows
+    if (keys_.empty()) {
+      return;
+    }
+
+    const auto total = rows->size();
+    extract(total);
+
+    // rank rows by all sort columns in order, row index breaks tie to make it stable
+    const auto before = [this](size_t left, size_t right) {
+      for (const auto& k : keys_) {
+        const auto c = k.compare(left, right);
+        if (c != 0) {
+          return k.column.desc ? c > 0 : c < 0;
+        }
+      }
+
+      return left < right;
+    };
+
+    // sort all rows if no limit or limit covers all rows
+    if (size_ == total) {
+      order_.resize(total);
+      std::iota(order_.begin(), order_.end(), 0);
+      std::sort(order_.begin(), order_.end(), before);
+      return;
+    }
+
+    // bounded heap keeps the best N rows, its front is the worst of them
+    order_.reserve(size_);
+    for (size_t i = 0; i < total; ++i) {
+      if (order_.size() < size_) {
+        order_.push_back(i);
+        std::push_heap(order_.begin(), order_.end(), before);
+      } else if (before(i, order_.front())) {
+        std::pop_heap(order_.begin(), order_.end(), before);
+        order_.back() = i;
+        std::push_heap(order_.begin(), order_.end(), before);
+      }
     }
+
+    std::sort_heap(order_.begin(), order_.end(), before);
   }
 
-  // TODO(cao) - might be too expensive if there are many items/rows to iterate on
   virtual const RowData& next() override {
     // stop condition
     index_++;
 
-    // no need heap
-    if (!compare_) {
+    // no need to sort
+    if (order_.empty()) {
       return rows_->next();
     }
 
-    // fetch the top one and return its value
-    std::pop_heap(heap_.begin(), heap_.end(), compare_);
-    auto top = heap_.back();
-    heap_.pop_back();
-
-    current_ = rows_->item(top);
+    // fetch the row of next top index
+    current_ = rows_->item(order_.at(index_ - 1));
     return *current_;
   }
 
@@ -71,12 +147,86 @@ public:
   }
 
 private:
-  std::vector<size_t> heap_;
+  static bool sortable(nebula::type::Kind kind) {
+    switch (kind) {
+    case nebula::type::Kind::BOOLEAN:
+    case nebula::type::Kind::TINYINT:
+    case nebula::type::Kind::SMALLINT:
+    case nebula::type::Kind::INTEGER:
+    case nebula::type::Kind::BIGINT:
+    case nebula::type::Kind::REAL:
+    case nebula::type::Kind::DOUBLE:
+    case nebula::type::Kind::VARCHAR:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // iterate all input rows once to extract sort keys by column index
+  void extract(size_t total) {
+    for (auto& k : keys_) {
+      k.nulls.reserve(total);
+      switch (k.column.kind) {
+      case nebula::type::Kind::REAL:
+      case nebula::type::Kind::DOUBLE:
+        k.reals.reserve(total);
+        break;
+      case nebula::type::Kind::VARCHAR:
+        k.offsets.reserve(total + 1);
+        k.offsets.push_back(0);
+        break;
+      default:
+        k.ints.reserve(total);
+        break;
+      }
+    }
+
+    while (rows_->hasNext()) {
+      const auto& row = rows_->next();
+      for (auto& k : keys_) {
+        const auto i = k.column.index;
+        const auto null = row.isNull(i);
+        k.nulls.push_back(null);
+
+#define EXTRACT_KEY(KIND, VALUES, F)                  \
+  case nebula::type::Kind::KIND: {                    \
+    k.VALUES.push_back(null ? 0 : row.F(i));          \
+    break;                                            \
+  }
+
+        switch (k.column.kind) {
+          EXTRACT_KEY(BOOLEAN, ints, readBool)
+          EXTRACT_KEY(TINYINT, ints, readByte)
+          EXTRACT_KEY(SMALLINT, ints, readShort)
+          EXTRACT_KEY(INTEGER, ints, readInt)
+          EXTRACT_KEY(BIGINT, ints, readLong)
+          EXTRACT_KEY(REAL, reals, readFloat)
+          EXTRACT_KEY(DOUBLE, reals, readDouble)
+        case nebula::type::Kind::VARCHAR: {
+          if (!null) {
+            k.strings.append(row.readString(i));
+          }
+          k.offsets.push_back(k.strings.size());
+          break;
+        }
+        default:
+          break;
+        }
+
+#undef EXTRACT_KEY
+      }
+    }
+  }
+
+private:
   RowCursorPtr rows_;
-  std::function<bool(size_t, size_t)> compare_;
+  std::vector<SortKeys> keys_;
+  // input row indices in sorted order
+  std::vector<size_t> order_;
 
   std::unique_ptr<RowData> current_;
-}; // namespace surface
+};
 
 } // namespace surface
-} // namespace nebula
\ No newline at end of file
+} // namespace nebula
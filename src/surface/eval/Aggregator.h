@@ -109,8 +109,7 @@ public:
  * and of course providing input/output types using type::Kind
 **/
 
-// TODO: support aggregation on input of string type
-// temporarly disabling it LOGIC_BY_IO(O, VARCHAR)
+// string input is only accepted by sketches which don't keep the value itself, such as CARDINALITY
 #ifndef ITERATE_BY_IO_CASE
 #define ITERATE_BY_IO_CASE(O, IT)                                     \
   case Kind::O: {                                                     \
@@ -123,6 +122,7 @@ public:
       LOGIC_BY_IO(O, REAL)                                            \
       LOGIC_BY_IO(O, DOUBLE)                                          \
       LOGIC_BY_IO(O, INT128)                                          \
+      LOGIC_BY_IO(O, VARCHAR)                                         \
     default:                                                          \
       LOG(ERROR) << "Unsupported aggregation types (#O, " << (int)IT; \
       break;                                                          \
@@ -127,7 +127,8 @@ enum class UDFType {
   AVG,
   COUNT,
   SUM,
-  PCT
+  PCT,
+  CARDINALITY
 };
 
 // UDF traits tells us:
@@ -176,7 +177,17 @@ struct UdfTraits {};
 #define UDF_NOT_SUPPORT(NAME, INPUT) FUNCTION_TRAITS(NAME, false, INPUT, INPUT)
 
 // shortcut: for UDAF to define all supported types with same types
-#define UDF_SAME_AS_INPUT_ALL(NAME) REPEAT_ALL_TYPES(UDF_SAME_AS_INPUT, NAME)
+// string input is not supported since their states can't hold a string value
+#define UDF_SAME_AS_INPUT_ALL(NAME)                    \
+  UDF_SAME_AS_INPUT(nebula::type::Kind::BOOLEAN, NAME)  \
+  UDF_SAME_AS_INPUT(nebula::type::Kind::TINYINT, NAME)  \
+  UDF_SAME_AS_INPUT(nebula::type::Kind::SMALLINT, NAME) \
+  UDF_SAME_AS_INPUT(nebula::type::Kind::INTEGER, NAME)  \
+  UDF_SAME_AS_INPUT(nebula::type::Kind::BIGINT, NAME)   \
+  UDF_SAME_AS_INPUT(nebula::type::Kind::REAL, NAME)     \
+  UDF_SAME_AS_INPUT(nebula::type::Kind::DOUBLE, NAME)   \
+  UDF_SAME_AS_INPUT(nebula::type::Kind::INT128, NAME)   \
+  UDF_NOT_SUPPORT(NAME, nebula::type::Kind::VARCHAR)
 
 // define traits for UDF: NOT
 // regardless what input expression is, it will always work as C++ syntax, such as
@@ -272,6 +283,12 @@ UDF_NOT_SUPPORT(PCT, nebula::type::Kind::BOOLEAN)
 UDF_NOT_SUPPORT(PCT, nebula::type::Kind::VARCHAR)
 UDF_NOT_SUPPORT(PCT, nebula::type::Kind::INT128)
 
+// define traits for UDAF: CARDINALITY
+// distinct count of values always has BIGINT as result, it is supported on all types.
+// input values are stored as they are and aggregated into a mergeable sketch (HyperLogLog)
+STATIC_TRAITS(CARDINALITY, true)
+REPEAT_ALL_TYPES(UDF_TRAITS_INPUT1, CARDINALITY, nebula::type::Kind::BIGINT)
+
 #undef UDF_SAME_AS_INPUT_ALL
 #undef UDF_SAME_AS_INPUT
 #undef UDF_NOT_SUPPORT
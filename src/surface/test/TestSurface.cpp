@@ -21,12 +21,19 @@
 #include "fmt/format.h"
 #include "surface/DataSurface.h"
 #include "surface/MockSurface.h"
+#include "surface/TopRows.h"
 
 namespace nebula {
 namespace memory {
 namespace test {
 
 using namespace nebula::common;
+using nebula::surface::IndexType;
+using nebula::surface::RowCursor;
+using nebula::surface::RowData;
+using nebula::surface::SortColumn;
+using nebula::surface::TopRows;
+using nebula::type::Kind;
 
 TEST(SurfaceTest, TestDataSurface) {
   // these are all dumb right, they are just show case the interfaces usage
@@ -76,6 +83,103 @@ TEST(SurfaceTest, TestInt128Surface) {
   }
 }
 
+// a row of (score:long, name:string) read by column index only
+class IndexRow : public RowData {
+public:
+  IndexRow(int64_t score, std::string name) : score_{ score }, name_{ std::move(name) } {}
+
+#define NAME_NOT_IMPL(TYPE, NAME)                \
+  TYPE NAME(const std::string&) const override { \
+    throw NException("read by index only");      \
+  }
+
+  NAME_NOT_IMPL(bool, isNull)
+  NAME_NOT_IMPL(bool, readBool)
+  NAME_NOT_IMPL(int8_t, readByte)
+  NAME_NOT_IMPL(int16_t, readShort)
+  NAME_NOT_IMPL(int32_t, readInt)
+  NAME_NOT_IMPL(int64_t, readLong)
+  NAME_NOT_IMPL(float, readFloat)
+  NAME_NOT_IMPL(double, readDouble)
+  NAME_NOT_IMPL(int128_t, readInt128)
+  NAME_NOT_IMPL(std::string_view, readString)
+  NAME_NOT_IMPL(std::unique_ptr<nebula::surface::ListData>, readList)
+  NAME_NOT_IMPL(std::unique_ptr<nebula::surface::MapData>, readMap)
+
+#undef NAME_NOT_IMPL
+
+  bool isNull(IndexType) const override {
+    return false;
+  }
+
+  int64_t readLong(IndexType) const override {
+    return score_;
+  }
+
+  std::string_view readString(IndexType) const override {
+    return name_;
+  }
+
+private:
+  int64_t score_;
+  std::string name_;
+};
+
+class IndexRowCursor : public RowCursor {
+public:
+  IndexRowCursor(const std::vector<IndexRow>& rows) : RowCursor(rows.size()), rows_{ rows } {}
+
+  virtual const RowData& next() override {
+    return rows_.at(index_++);
+  }
+
+  virtual std::unique_ptr<RowData> item(size_t index) const override {
+    return std::make_unique<IndexRow>(rows_.at(index));
+  }
+
+private:
+  const std::vector<IndexRow>& rows_;
+};
+
+TEST(SurfaceTest, TestTopRowsMultipleColumns) {
+  // score has few distinct values so that name decides order in ties
+  const size_t size = 1000000;
+  std::vector<IndexRow> rows;
+  std::vector<std::pair<int64_t, std::string>> expected;
+  rows.reserve(size);
+  expected.reserve(size);
+  std::srand(Evidence::unix_timestamp());
+  for (size_t i = 0; i < size; ++i) {
+    auto score = std::rand() % 100;
+    auto name = fmt::format("n{0}", std::rand() % 100000);
+    rows.emplace_back(score, name);
+    expected.emplace_back(score, name);
+  }
+
+  // order by score asc, name desc
+  std::sort(expected.begin(), expected.end(), [](const auto& left, const auto& right) {
+    return left.first != right.first ? left.first < right.first : left.second > right.second;
+  });
+
+  const std::vector<SortColumn> sorts{ SortColumn(0, Kind::BIGINT, false), SortColumn(1, Kind::VARCHAR, true) };
+  for (size_t top : { 100, 0 }) {
+    Evidence::Duration tick;
+    auto cursor = std::make_shared<IndexRowCursor>(rows);
+    TopRows result(cursor, top, sorts);
+    LOG(INFO) << "top " << top << " of " << size << " rows in ms: " << tick.elapsedMs();
+
+    EXPECT_EQ(result.size(), top == 0 ? size : top);
+    size_t i = 0;
+    while (result.hasNext()) {
+      const auto& row = result.next();
+      EXPECT_EQ(row.readLong(0), expected.at(i).first);
+      EXPECT_EQ(row.readString(1), expected.at(i).second);
+      ++i;
+    }
+    EXPECT_EQ(i, result.size());
+  }
+}
+
 } // namespace test
 } // namespace memory
 } // namespace nebula
\ No newline at end of file